@@ -7,42 +7,51 @@
 #include "rxe.h"
 #include "rxe_loc.h"
 
-/* Compute a partial ICRC for all the IB transport headers. */
-u32 rxe_icrc_hdr(struct rxe_pkt_info *pkt, struct sk_buff *skb)
+static bool skip_icrc_trusted;
+module_param(skip_icrc_trusted, bool, 0644);
+MODULE_PARM_DESC(skip_icrc_trusted,
+		 "Do not verify ICRC on packets received over loopback or veth links (default: false)");
+
+/* This seed is the result of computing a CRC with a seed of
+ * 0xfffffff and 8 bytes of 0xff representing a masked LRH.
+ */
+#define RXE_ICRC_SEED		(0xdebb20e3)
+
+/* The masked pseudo header is built using the ipv6 header size since
+ * it is bigger than ipv4, followed by the largest IB transport header.
+ */
+#define RXE_ICRC_HDR_BUF_SIZE	(sizeof(struct udphdr) +	\
+				 sizeof(struct ipv6hdr) +	\
+				 RXE_MAX_HDR_LENGTH)
+
+/*
+ * Copy the IP, UDP and IB transport headers into buf with all the
+ * variant fields masked, so that the whole header can be folded into
+ * the CRC with a single update. Returns the number of bytes used.
+ */
+static int rxe_icrc_hdr_buf(struct rxe_pkt_info *pkt, struct sk_buff *skb,
+			    u8 *buf)
 {
-	unsigned int bth_offset = 0;
-	struct iphdr *ip4h = NULL;
-	struct ipv6hdr *ip6h = NULL;
+	struct iphdr *ip4h;
+	struct ipv6hdr *ip6h;
 	struct udphdr *udph;
 	struct rxe_bth *bth;
-	int crc;
-	int length;
 	int hdr_size = sizeof(struct udphdr) +
 		(skb->protocol == htons(ETH_P_IP) ?
 		sizeof(struct iphdr) : sizeof(struct ipv6hdr));
-	/* pseudo header buffer size is calculate using ipv6 header size since
-	 * it is bigger than ipv4
-	 */
-	u8 pshdr[sizeof(struct udphdr) +
-		sizeof(struct ipv6hdr) +
-		RXE_BTH_BYTES];
-
-	/* This seed is the result of computing a CRC with a seed of
-	 * 0xfffffff and 8 bytes of 0xff representing a masked LRH.
-	 */
-	crc = 0xdebb20e3;
+	int ib_hdr_size = rxe_opcode[pkt->opcode].length;
 
 	if (skb->protocol == htons(ETH_P_IP)) { /* IPv4 */
-		memcpy(pshdr, ip_hdr(skb), hdr_size);
-		ip4h = (struct iphdr *)pshdr;
+		memcpy(buf, ip_hdr(skb), hdr_size);
+		ip4h = (struct iphdr *)buf;
 		udph = (struct udphdr *)(ip4h + 1);
 
 		ip4h->ttl = 0xff;
 		ip4h->check = CSUM_MANGLED_0;
 		ip4h->tos = 0xff;
 	} else {				/* IPv6 */
-		memcpy(pshdr, ipv6_hdr(skb), hdr_size);
-		ip6h = (struct ipv6hdr *)pshdr;
+		memcpy(buf, ipv6_hdr(skb), hdr_size);
+		ip6h = (struct ipv6hdr *)buf;
 		udph = (struct udphdr *)(ip6h + 1);
 
 		memset(ip6h->flow_lbl, 0xff, sizeof(ip6h->flow_lbl));
@@ -51,19 +60,112 @@ u32 rxe_icrc_hdr(struct rxe_pkt_info *pkt, struct sk_buff *skb)
 	}
 	udph->check = CSUM_MANGLED_0;
 
-	bth_offset += hdr_size;
-
-	memcpy(&pshdr[bth_offset], pkt->hdr, RXE_BTH_BYTES);
-	bth = (struct rxe_bth *)&pshdr[bth_offset];
+	memcpy(&buf[hdr_size], pkt->hdr, ib_hdr_size);
+	bth = (struct rxe_bth *)&buf[hdr_size];
 
 	/* exclude bth.resv8a */
 	bth->qpn |= cpu_to_be32(~BTH_QPN_MASK);
 
-	length = hdr_size + RXE_BTH_BYTES;
-	crc = rxe_crc32(pkt->rxe, crc, pshdr, length);
+	return hdr_size + ib_hdr_size;
+}
+
+/* Compute a partial ICRC for all the IB transport headers. */
+u32 rxe_icrc_hdr(struct rxe_pkt_info *pkt, struct sk_buff *skb)
+{
+	u8 buf[RXE_ICRC_HDR_BUF_SIZE];
+	int length;
+
+	length = rxe_icrc_hdr_buf(pkt, skb, buf);
+
+	return rxe_crc32(pkt->rxe, RXE_ICRC_SEED, buf, length);
+}
+
+/*
+ * Packets looped back inside rxe never leave host memory, and packets
+ * received over a veth pair only crossed a software link, so when the
+ * administrator opts in the ICRC check on those adds nothing.
+ */
+static bool rxe_icrc_trusted(struct rxe_pkt_info *pkt, struct sk_buff *skb)
+{
+	struct net_device *ndev = skb->dev;
+
+	if (!READ_ONCE(skip_icrc_trusted))
+		return false;
+
+	if (pkt->mask & RXE_LOOPBACK_MASK)
+		return true;
+
+	if (!ndev)
+		return false;
+
+	if (ndev->flags & IFF_LOOPBACK)
+		return true;
+
+	return ndev->rtnl_link_ops &&
+	       !strcmp(ndev->rtnl_link_ops->kind, "veth");
+}
+
+/**
+ * rxe_icrc_check() - Compute the ICRC of a received packet and compare
+ *		      it to the ICRC carried in the packet.
+ * @pkt: packet information
+ * @skb: packet buffer
+ *
+ * The masked headers and the payload are folded into one crc32 shash
+ * descriptor so the (possibly accelerated) transform is only set up once
+ * per packet.
+ *
+ * Return: 0 if the values match else -EINVAL
+ */
+int rxe_icrc_check(struct rxe_pkt_info *pkt, struct sk_buff *skb)
+{
+	struct rxe_dev *rxe = pkt->rxe;
+	u8 buf[RXE_ICRC_HDR_BUF_SIZE];
+	__be32 *icrcp;
+	u32 pack_icrc;
+	u32 calc_icrc;
+	int length;
+	int err;
+
+	SHASH_DESC_ON_STACK(shash, rxe->tfm);
+
+	if (rxe_icrc_trusted(pkt, skb))
+		return 0;
+
+	icrcp = (__be32 *)(pkt->hdr + pkt->paylen - RXE_ICRC_SIZE);
+	pack_icrc = be32_to_cpu(*icrcp);
+
+	length = rxe_icrc_hdr_buf(pkt, skb, buf);
+
+	shash->tfm = rxe->tfm;
+	*(u32 *)shash_desc_ctx(shash) = RXE_ICRC_SEED;
+	err = crypto_shash_update(shash, buf, length);
+	if (likely(!err))
+		err = crypto_shash_update(shash, payload_addr(pkt),
+					  payload_size(pkt) + bth_pad(pkt));
+	if (likely(!err)) {
+		calc_icrc = *(u32 *)shash_desc_ctx(shash);
+	} else {
+		pr_warn_ratelimited("failed crc calculation, err: %d\n", err);
+		calc_icrc = crc32_le(RXE_ICRC_SEED, buf, length);
+		calc_icrc = crc32_le(calc_icrc, payload_addr(pkt),
+				     payload_size(pkt) + bth_pad(pkt));
+	}
+	barrier_data(shash_desc_ctx(shash));
+
+	calc_icrc = (__force u32)cpu_to_be32(~calc_icrc);
+	if (unlikely(calc_icrc != pack_icrc)) {
+		if (skb->protocol == htons(ETH_P_IPV6))
+			pr_warn_ratelimited("bad ICRC from %pI6c\n",
+					    &ipv6_hdr(skb)->saddr);
+		else if (skb->protocol == htons(ETH_P_IP))
+			pr_warn_ratelimited("bad ICRC from %pI4\n",
+					    &ip_hdr(skb)->saddr);
+		else
+			pr_warn_ratelimited("bad ICRC from unknown\n");
+
+		return -EINVAL;
+	}
 
-	/* And finish to compute the CRC on the remainder of the headers. */
-	crc = rxe_crc32(pkt->rxe, crc, pkt->hdr + RXE_BTH_BYTES,
-			rxe_opcode[pkt->opcode].length - RXE_BTH_BYTES);
-	return crc;
+	return 0;
 }
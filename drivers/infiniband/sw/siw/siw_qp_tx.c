@@ -419,15 +419,18 @@ static void siw_unmap_pages(struct page **pp, unsigned long kmap_mask)
 
 /*
  * Write out iov referencing hdr, data and trailer of current FPDU.
- * Update transmit state dependent on write return status
+ * Update transmit state dependent on write return status.
+ * @flags are the socket flags used to push the FPDU trailer; with
+ * MSG_MORE set, TCP may coalesce the FPDU with the ones that follow.
  */
-static int siw_tx_hdt(struct siw_iwarp_tx *c_tx, struct socket *s)
+static int siw_tx_hdt(struct siw_iwarp_tx *c_tx, struct socket *s,
+		      int flags)
 {
 	struct siw_wqe *wqe = &c_tx->wqe_active;
 	struct siw_sge *sge = &wqe->sqe.sge[c_tx->sge_idx];
 	struct kvec iov[MAX_ARRAY];
 	struct page *page_array[MAX_ARRAY];
-	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_EOR };
+	struct msghdr msg = { .msg_flags = flags };
 
 	int seg = 0, do_crc = c_tx->do_crc, is_kva = 0, rv;
 	unsigned int data_len = c_tx->bytes_unsent, hdr_len = 0, trl_len = 0,
@@ -874,7 +877,24 @@ static int siw_qp_sq_proc_tx(struct siw_qp *qp, struct siw_wqe *wqe)
 		goto tx_done;
 
 	} else {
-		rv = siw_tx_hdt(c_tx, s);
+		unsigned int msg_flags;
+
+		/*
+		 * Let TCP coalesce consecutive FPDUs into large, TSO
+		 * friendly skb's. The TCP segment is only pushed with
+		 * the last FPDU of a WQE, if the SQ runs empty or
+		 * siw_tcp_nagle is not set, or if we bail out soon due
+		 * to no burst credit left. TCP itself pushes pending
+		 * data if it has to wait for send space.
+		 */
+		if (burst_len == 1 ||
+		    ((c_tx->pkt.ctrl.ddp_rdmap_ctrl & DDP_FLAG_LAST) &&
+		     (siw_sq_empty(qp) || !siw_tcp_nagle)))
+			msg_flags = MSG_DONTWAIT | MSG_EOR;
+		else
+			msg_flags = MSG_DONTWAIT | MSG_MORE;
+
+		rv = siw_tx_hdt(c_tx, s, msg_flags);
 	}
 	if (!rv) {
 		/*
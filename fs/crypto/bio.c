@@ -24,19 +24,188 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/namei.h>
+#include <crypto/skcipher.h>
 #include "fscrypt_private.h"
 
+/*
+ * Maximum number of blocks of a bio that are decrypted concurrently when the
+ * inode's skcipher is asynchronous.  Synchronous skciphers only need one.
+ */
+#define FSCRYPT_MAX_INFLIGHT_BLOCKS	8
+
+struct fscrypt_decrypt_slot {
+	struct skcipher_request *req;
+	struct page *page;
+	u64 lblk_num;
+	union fscrypt_iv iv;
+	struct scatterlist sg;
+	struct crypto_wait wait;
+	int err;
+	bool busy;
+};
+
+/*
+ * State for decrypting all blocks of a bio with a few preallocated requests,
+ * rather than allocating and freeing a request for every single block.
+ *
+ * The requests are tied to the key's tfm, so the inode's ->ci_enc_key caches
+ * one context between bios.  Concurrent readers of the inode that find the
+ * cache empty allocate their own context, and only one of them is kept.
+ */
+struct fscrypt_decrypt_ctx {
+	const struct inode *inode;
+	unsigned int nr_slots;
+	unsigned int next_slot;
+	struct fscrypt_decrypt_slot slots[];
+};
+
+void fscrypt_free_decrypt_ctx(struct fscrypt_decrypt_ctx *ctx)
+{
+	unsigned int i;
+
+	if (!ctx)
+		return;
+	for (i = 0; i < ctx->nr_slots; i++)
+		skcipher_request_free(ctx->slots[i].req);
+	kfree(ctx);
+}
+
+static struct fscrypt_decrypt_ctx *
+fscrypt_alloc_decrypt_ctx(struct crypto_skcipher *tfm)
+{
+	unsigned int nr_slots = 1;
+	struct fscrypt_decrypt_ctx *ctx;
+
+	if (crypto_skcipher_alg(tfm)->base.cra_flags & CRYPTO_ALG_ASYNC)
+		nr_slots = FSCRYPT_MAX_INFLIGHT_BLOCKS;
+
+	ctx = kzalloc(struct_size(ctx, slots, nr_slots), GFP_NOFS);
+	if (!ctx)
+		return NULL;
+
+	for (; ctx->nr_slots < nr_slots; ctx->nr_slots++) {
+		struct fscrypt_decrypt_slot *slot = &ctx->slots[ctx->nr_slots];
+
+		slot->req = skcipher_request_alloc(tfm, GFP_NOFS);
+		if (!slot->req)
+			break;
+		crypto_init_wait(&slot->wait);
+		skcipher_request_set_callback(slot->req,
+				CRYPTO_TFM_REQ_MAY_BACKLOG |
+				CRYPTO_TFM_REQ_MAY_SLEEP,
+				crypto_req_done, &slot->wait);
+	}
+
+	if (!ctx->nr_slots) {
+		kfree(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+/* Take the key's cached decryption context, or allocate a new one */
+static struct fscrypt_decrypt_ctx *
+fscrypt_get_decrypt_ctx(const struct inode *inode)
+{
+	struct fscrypt_prepared_key *key = &inode->i_crypt_info->ci_enc_key;
+	struct fscrypt_decrypt_ctx *ctx;
+
+	ctx = xchg(&key->decrypt_ctx, NULL);
+	if (!ctx)
+		ctx = fscrypt_alloc_decrypt_ctx(key->tfm);
+	if (ctx) {
+		ctx->inode = inode;
+		ctx->next_slot = 0;
+	}
+	return ctx;
+}
+
+/* Give the context back to the key, unless it already caches another one */
+static void fscrypt_put_decrypt_ctx(struct fscrypt_decrypt_ctx *ctx)
+{
+	struct fscrypt_prepared_key *key = &ctx->inode->i_crypt_info->ci_enc_key;
+
+	if (cmpxchg(&key->decrypt_ctx, NULL, ctx))
+		fscrypt_free_decrypt_ctx(ctx);
+}
+
+static void fscrypt_finish_decrypt_slot(struct fscrypt_decrypt_ctx *ctx,
+					struct fscrypt_decrypt_slot *slot)
+{
+	int err;
+
+	if (!slot->busy)
+		return;
+	slot->busy = false;
+
+	err = crypto_wait_req(slot->err, &slot->wait);
+	if (err) {
+		fscrypt_err(ctx->inode, "Decryption failed for block %llu: %d",
+			    slot->lblk_num, err);
+		SetPageError(slot->page);
+	}
+}
+
+/* Queue up in-place decryption of one filesystem block */
+static void fscrypt_decrypt_block_async(struct fscrypt_decrypt_ctx *ctx,
+					struct page *page, unsigned int len,
+					unsigned int offs, u64 lblk_num)
+{
+	struct fscrypt_decrypt_slot *slot = &ctx->slots[ctx->next_slot];
+
+	if (++ctx->next_slot == ctx->nr_slots)
+		ctx->next_slot = 0;
+	fscrypt_finish_decrypt_slot(ctx, slot);
+
+	fscrypt_generate_iv(&slot->iv, lblk_num, ctx->inode->i_crypt_info);
+	sg_init_table(&slot->sg, 1);
+	sg_set_page(&slot->sg, page, len, offs);
+	skcipher_request_set_crypt(slot->req, &slot->sg, &slot->sg, len,
+				   &slot->iv);
+	slot->page = page;
+	slot->lblk_num = lblk_num;
+	slot->busy = true;
+	slot->err = crypto_skcipher_decrypt(slot->req);
+}
+
 void fscrypt_decrypt_bio(struct bio *bio)
 {
+	const struct inode *inode = bio_first_page_all(bio)->mapping->host;
+	const unsigned int blockbits = inode->i_blkbits;
+	const unsigned int blocksize = 1 << blockbits;
+	struct fscrypt_decrypt_ctx *ctx;
 	struct bio_vec *bv;
 	struct bvec_iter_all iter_all;
+	unsigned int i;
+
+	ctx = fscrypt_get_decrypt_ctx(inode);
 
 	bio_for_each_segment_all(bv, bio, iter_all) {
 		struct page *page = bv->bv_page;
-		int ret = fscrypt_decrypt_pagecache_blocks(page, bv->bv_len,
-							   bv->bv_offset);
-		if (ret)
-			SetPageError(page);
+		u64 lblk_num;
+
+		/* Fall back to one request per block if needed */
+		if (!ctx || page->mapping->host != inode ||
+		    WARN_ON_ONCE(!IS_ALIGNED(bv->bv_len | bv->bv_offset,
+					     blocksize))) {
+			if (fscrypt_decrypt_pagecache_blocks(page, bv->bv_len,
+							     bv->bv_offset))
+				SetPageError(page);
+			continue;
+		}
+
+		lblk_num = ((u64)page->index << (PAGE_SHIFT - blockbits)) +
+			   (bv->bv_offset >> blockbits);
+		for (i = bv->bv_offset; i < bv->bv_offset + bv->bv_len;
+		     i += blocksize, lblk_num++)
+			fscrypt_decrypt_block_async(ctx, page, blocksize, i,
+						    lblk_num);
+	}
+
+	if (ctx) {
+		for (i = 0; i < ctx->nr_slots; i++)
+			fscrypt_finish_decrypt_slot(ctx, &ctx->slots[i]);
+		fscrypt_put_decrypt_ctx(ctx);
 	}
 }
 EXPORT_SYMBOL(fscrypt_decrypt_bio);
@@ -170,11 +170,14 @@ struct fscrypt_symlink_data {
  * struct fscrypt_prepared_key - a key prepared for actual encryption/decryption
  * @tfm: crypto API transform object
  * @blk_key: key for blk-crypto
+ * @decrypt_ctx: cached requests for decrypting bios with @tfm.  Only ever set
+ *	in an inode's ->ci_enc_key, so it is per inode even for shared keys.
  *
- * Normally only one of the fields will be non-NULL.
+ * Normally only one of @tfm and @blk_key will be non-NULL.
  */
 struct fscrypt_prepared_key {
 	struct crypto_skcipher *tfm;
+	struct fscrypt_decrypt_ctx *decrypt_ctx;
 #ifdef CONFIG_FS_ENCRYPTION_INLINE_CRYPT
 	struct fscrypt_blk_crypto_key *blk_key;
 #endif
@@ -254,6 +257,9 @@ typedef enum {
 	FS_ENCRYPT,
 } fscrypt_direction_t;
 
+/* bio.c */
+void fscrypt_free_decrypt_ctx(struct fscrypt_decrypt_ctx *ctx);
+
 /* crypto.c */
 extern struct kmem_cache *fscrypt_info_cachep;
 int fscrypt_initialize(unsigned int cop_flags);
@@ -142,6 +142,7 @@ int fscrypt_prepare_key(struct fscrypt_prepared_key *prep_key,
 /* Destroy a crypto transform object and/or blk-crypto key. */
 void fscrypt_destroy_prepared_key(struct fscrypt_prepared_key *prep_key)
 {
+	fscrypt_free_decrypt_ctx(prep_key->decrypt_ctx);
 	crypto_free_skcipher(prep_key->tfm);
 	fscrypt_destroy_inline_crypt_key(prep_key);
 }
@@ -449,6 +450,9 @@ static void put_crypt_info(struct fscrypt_info *ci)
 		fscrypt_put_direct_key(ci->ci_direct_key);
 	else if (ci->ci_owns_key)
 		fscrypt_destroy_prepared_key(&ci->ci_enc_key);
+	/* A borrowed key is copied into ->ci_enc_key along with its cache */
+	if (!ci->ci_owns_key)
+		fscrypt_free_decrypt_ctx(ci->ci_enc_key.decrypt_ctx);
 
 	key = ci->ci_master_key;
 	if (key) {
@@ -53,8 +53,39 @@ static inline bool z_erofs_put_stagingpage(struct list_head *pagepool,
 	return true;
 }
 
+/*
+ * map pages into a virtually contiguous area, it might sleep since lazily
+ * freed vmap areas are purged before retrying.
+ */
+static inline void *erofs_vm_map_ram(struct page **pages, unsigned int count)
+{
+	int i = 0;
+
+	while (1) {
+		void *addr = vm_map_ram(pages, count, -1);
+
+		/* retry two more times (totally 3 times) */
+		if (addr || ++i >= 3)
+			return addr;
+		vm_unmap_aliases();
+	}
+}
+
 int z_erofs_decompress(struct z_erofs_decompress_req *rq,
 		       struct list_head *pagepool);
 
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+void z_erofs_lzma_exit(void);
+int z_erofs_lzma_decompress(struct z_erofs_decompress_req *rq,
+			    struct list_head *pagepool);
+#else
+static inline void z_erofs_lzma_exit(void) {}
+static inline int z_erofs_lzma_decompress(struct z_erofs_decompress_req *rq,
+					  struct list_head *pagepool)
+{
+	return -EOPNOTSUPP;
+}
+#endif	/* !CONFIG_EROFS_FS_ZIP_LZMA */
+
 #endif
 
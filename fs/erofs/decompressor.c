@@ -17,6 +17,33 @@
 #define LZ4_DECOMPRESS_INPLACE_MARGIN(srcsize)  (((srcsize) >> 8) + 32)
 #endif
 
+/*
+ * A customized lz4 max_distance can only shrink the sliding window, which
+ * LZ4_MAX_DISTANCE_PAGES already covers, so only the pcluster size matters.
+ */
+int z_erofs_load_lz4_config(struct super_block *sb,
+			    struct erofs_super_block *dsb,
+			    struct z_erofs_lz4_cfgs *lz4, int size)
+{
+	unsigned int max_pclusterblks;
+
+	if (!lz4)
+		return 0;
+
+	if (size < sizeof(struct z_erofs_lz4_cfgs)) {
+		erofs_err(sb, "invalid lz4 cfgs, size=%u", size);
+		return -EINVAL;
+	}
+
+	max_pclusterblks = le16_to_cpu(lz4->max_pclusterblks);
+	if (max_pclusterblks > Z_EROFS_CLUSTER_MAX_PAGES) {
+		erofs_err(sb, "too large lz4 pclusterblks %u, the limit is %u",
+			  max_pclusterblks, Z_EROFS_CLUSTER_MAX_PAGES);
+		return -EINVAL;
+	}
+	return 0;
+}
+
 struct z_erofs_decompressor {
 	/*
 	 * if destpages have sparsed pages, fill them with bounce pages.
@@ -24,7 +51,8 @@ struct z_erofs_decompressor {
 	 */
 	int (*prepare_destpages)(struct z_erofs_decompress_req *rq,
 				 struct list_head *pagepool);
-	int (*decompress)(struct z_erofs_decompress_req *rq, u8 *out);
+	/* @in is the mapped input if it spans several pages, or NULL */
+	int (*decompress)(struct z_erofs_decompress_req *rq, u8 *in, u8 *out);
 	char *name;
 };
 
@@ -110,17 +138,15 @@ static void *generic_copy_inplace_data(struct z_erofs_decompress_req *rq,
 	return tmp;
 }
 
-static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
+static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq,
+				  u8 *in, u8 *out)
 {
 	unsigned int inputmargin, inlen;
 	u8 *src;
 	bool copied, support_0padding;
 	int ret;
 
-	if (rq->inputsize > PAGE_SIZE)
-		return -EOPNOTSUPP;
-
-	src = kmap_atomic(*rq->in);
+	src = in ? in : kmap_atomic(*rq->in);
 	inputmargin = 0;
 	support_0padding = false;
 
@@ -129,12 +155,14 @@ static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
 	    EROFS_FEATURE_INCOMPAT_LZ4_0PADDING) {
 		support_0padding = true;
 
-		while (!src[inputmargin & ~PAGE_MASK])
-			if (!(++inputmargin & ~PAGE_MASK))
+		/* the padding of a big pcluster can span several pages */
+		while (!src[inputmargin])
+			if (++inputmargin >= rq->inputsize)
 				break;
 
 		if (inputmargin >= rq->inputsize) {
-			kunmap_atomic(src);
+			if (!in)
+				kunmap_atomic(src);
 			return -EIO;
 		}
 	}
@@ -147,10 +175,22 @@ static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
 		const uint nr = PAGE_ALIGN(rq->pageofs_out +
 					   rq->outputsize) >> PAGE_SHIFT;
 
-		if (rq->partial_decoding || !support_0padding ||
-		    rq->out[nr - 1] != rq->in[0] ||
-		    rq->inputsize - oend <
-		      LZ4_DECOMPRESS_INPLACE_MARGIN(inlen)) {
+		/*
+		 * multi-page pclusters are always copied out rather than
+		 * checking that every compressed page sits at the very end
+		 * of the output in order.
+		 */
+		if (in) {
+			u8 *const tmp = erofs_get_pcpubuf(0);
+
+			memcpy(tmp, src + inputmargin, inlen);
+			src = tmp;
+			inputmargin = 0;
+			copied = true;
+		} else if (rq->partial_decoding || !support_0padding ||
+			   rq->out[nr - 1] != rq->in[0] ||
+			   rq->inputsize - oend <
+			     LZ4_DECOMPRESS_INPLACE_MARGIN(inlen)) {
 			src = generic_copy_inplace_data(rq, src, inputmargin);
 			inputmargin = 0;
 			copied = true;
@@ -183,7 +223,7 @@ static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
 
 	if (copied)
 		erofs_put_pcpubuf(src);
-	else
+	else if (!in)
 		kunmap_atomic(src);
 	return ret;
 }
@@ -231,10 +271,19 @@ static int z_erofs_decompress_generic(struct z_erofs_decompress_req *rq,
 {
 	const unsigned int nrpages_out =
 		PAGE_ALIGN(rq->pageofs_out + rq->outputsize) >> PAGE_SHIFT;
+	const unsigned int nrpages_in =
+		PAGE_ALIGN(rq->inputsize) >> PAGE_SHIFT;
 	const struct z_erofs_decompressor *alg = decompressors + rq->alg;
 	unsigned int dst_maptype;
-	void *dst;
-	int ret, i;
+	void *src = NULL, *dst;
+	int ret;
+
+	/* map big pclusters here since it can't be done atomically */
+	if (nrpages_in > 1) {
+		src = erofs_vm_map_ram(rq->in, nrpages_in);
+		if (!src)
+			return -ENOMEM;
+	}
 
 	if (nrpages_out == 1 && !rq->inplace_io) {
 		DBG_BUGON(!*rq->out);
@@ -250,50 +299,47 @@ static int z_erofs_decompress_generic(struct z_erofs_decompress_req *rq,
 	 */
 	if (rq->outputsize <= PAGE_SIZE * 7 / 8) {
 		dst = erofs_get_pcpubuf(0);
-		if (IS_ERR(dst))
-			return PTR_ERR(dst);
+		if (IS_ERR(dst)) {
+			ret = PTR_ERR(dst);
+			goto out;
+		}
 
 		rq->inplace_io = false;
-		ret = alg->decompress(rq, dst);
+		ret = alg->decompress(rq, src, dst);
 		if (!ret)
 			copy_from_pcpubuf(rq->out, dst, rq->pageofs_out,
 					  rq->outputsize);
 
 		erofs_put_pcpubuf(dst);
-		return ret;
+		goto out;
 	}
 
 	ret = alg->prepare_destpages(rq, pagepool);
 	if (ret < 0) {
-		return ret;
+		goto out;
 	} else if (ret) {
 		dst = page_address(*rq->out);
 		dst_maptype = 1;
 		goto dstmap_out;
 	}
 
-	i = 0;
-	while (1) {
-		dst = vm_map_ram(rq->out, nrpages_out, -1);
-
-		/* retry two more times (totally 3 times) */
-		if (dst || ++i >= 3)
-			break;
-		vm_unmap_aliases();
+	dst = erofs_vm_map_ram(rq->out, nrpages_out);
+	if (!dst) {
+		ret = -ENOMEM;
+		goto out;
 	}
-
-	if (!dst)
-		return -ENOMEM;
-
 	dst_maptype = 2;
 
 dstmap_out:
-	ret = alg->decompress(rq, dst + rq->pageofs_out);
+	ret = alg->decompress(rq, src, dst + rq->pageofs_out);
 
 	if (!dst_maptype)
 		kunmap_atomic(dst);
 	else if (dst_maptype == 2)
 		vm_unmap_ram(dst, nrpages_out);
+out:
+	if (src)
+		vm_unmap_ram(src, nrpages_in);
 	return ret;
 }
 
@@ -341,6 +387,8 @@ int z_erofs_decompress(struct z_erofs_decompress_req *rq,
 {
 	if (rq->alg == Z_EROFS_COMPRESSION_SHIFTED)
 		return z_erofs_shifted_transform(rq, pagepool);
+	if (rq->alg == Z_EROFS_COMPRESSION_LZMA)
+		return z_erofs_lzma_decompress(rq, pagepool);
 	return z_erofs_decompress_generic(rq, pagepool);
 }
 
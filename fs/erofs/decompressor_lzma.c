@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * MicroLZMA decompression support for EROFS, built on the in-kernel
+ * XZ embedded decoder (lib/xz) in single-call mode.
+ */
+#include <linux/xz.h>
+#include "compress.h"
+
+struct z_erofs_lzma {
+	struct z_erofs_lzma *next;
+	struct xz_dec_microlzma *state;
+	/* compressed data is copied here for in-place decompression */
+	u8 bounce[];
+};
+
+/*
+ * one decoder per possible CPU since decompression is CPU-bound anyway.
+ * The pool is only set up once a filesystem with MicroLZMA pclusters is
+ * mounted, so that kernels which never see such images don't pay for it.
+ */
+static struct z_erofs_lzma *z_erofs_lzma_head;
+static DEFINE_SPINLOCK(z_erofs_lzma_lock);
+static DECLARE_WAIT_QUEUE_HEAD(z_erofs_lzma_wq);
+static DEFINE_MUTEX(z_erofs_lzma_prepare_lock);
+static bool z_erofs_lzma_ready;
+
+void z_erofs_lzma_exit(void)
+{
+	while (z_erofs_lzma_head) {
+		struct z_erofs_lzma *strm = z_erofs_lzma_head;
+
+		z_erofs_lzma_head = strm->next;
+		xz_dec_microlzma_end(strm->state);
+		kvfree(strm);
+	}
+	z_erofs_lzma_ready = false;
+}
+
+static int z_erofs_lzma_prepare(void)
+{
+	unsigned int i;
+	int err = 0;
+
+	if (smp_load_acquire(&z_erofs_lzma_ready))
+		return 0;
+
+	mutex_lock(&z_erofs_lzma_prepare_lock);
+	if (z_erofs_lzma_ready)
+		goto out_unlock;
+
+	for (i = 0; i < num_possible_cpus(); ++i) {
+		struct z_erofs_lzma *strm;
+
+		strm = kvmalloc(struct_size(strm, bounce,
+					    Z_EROFS_CLUSTER_MAX_PAGES * PAGE_SIZE),
+				GFP_KERNEL);
+		if (!strm)
+			goto err_out;
+
+		/* the output buffer is the dictionary in single-call mode */
+		strm->state = xz_dec_microlzma_alloc(XZ_SINGLE,
+						     Z_EROFS_LZMA_MAX_DICT_SIZE);
+		if (!strm->state) {
+			kvfree(strm);
+			goto err_out;
+		}
+		strm->next = z_erofs_lzma_head;
+		z_erofs_lzma_head = strm;
+	}
+	/* nobody uses the pool before this, so no need for the spinlock */
+	smp_store_release(&z_erofs_lzma_ready, true);
+	goto out_unlock;
+
+err_out:
+	z_erofs_lzma_exit();
+	err = -ENOMEM;
+out_unlock:
+	mutex_unlock(&z_erofs_lzma_prepare_lock);
+	return err;
+}
+
+int z_erofs_load_lzma_config(struct super_block *sb,
+			     struct erofs_super_block *dsb,
+			     struct z_erofs_lzma_cfgs *lzma, int size)
+{
+	unsigned int dict_size;
+
+	if (!lzma || size < sizeof(*lzma)) {
+		erofs_err(sb, "invalid lzma cfgs, size=%u", size);
+		return -EINVAL;
+	}
+	if (lzma->format) {
+		erofs_err(sb, "unidentified lzma format %x, please check kernel version",
+			  le16_to_cpu(lzma->format));
+		return -EINVAL;
+	}
+	dict_size = le32_to_cpu(lzma->dict_size);
+	if (dict_size > Z_EROFS_LZMA_MAX_DICT_SIZE || dict_size < 4096) {
+		erofs_err(sb, "unsupported lzma dictionary size %u",
+			  dict_size);
+		return -EINVAL;
+	}
+	return z_erofs_lzma_prepare();
+}
+
+static struct z_erofs_lzma *z_erofs_lzma_get(void)
+{
+	struct z_erofs_lzma *strm;
+
+again:
+	spin_lock(&z_erofs_lzma_lock);
+	strm = z_erofs_lzma_head;
+	if (!strm) {
+		spin_unlock(&z_erofs_lzma_lock);
+		wait_event(z_erofs_lzma_wq, READ_ONCE(z_erofs_lzma_head));
+		goto again;
+	}
+	z_erofs_lzma_head = strm->next;
+	spin_unlock(&z_erofs_lzma_lock);
+	return strm;
+}
+
+static void z_erofs_lzma_put(struct z_erofs_lzma *strm)
+{
+	spin_lock(&z_erofs_lzma_lock);
+	strm->next = z_erofs_lzma_head;
+	z_erofs_lzma_head = strm;
+	spin_unlock(&z_erofs_lzma_lock);
+	wake_up(&z_erofs_lzma_wq);
+}
+
+static void *z_erofs_lzma_map(struct page **pages, unsigned int nr)
+{
+	if (nr == 1)
+		return kmap(*pages);
+	return erofs_vm_map_ram(pages, nr);
+}
+
+static void z_erofs_lzma_unmap(struct page **pages, void *addr,
+			       unsigned int nr)
+{
+	if (nr == 1)
+		kunmap(*pages);
+	else
+		vm_unmap_ram(addr, nr);
+}
+
+int z_erofs_lzma_decompress(struct z_erofs_decompress_req *rq,
+			    struct list_head *pagepool)
+{
+	const unsigned int nrpages_out =
+		PAGE_ALIGN(rq->pageofs_out + rq->outputsize) >> PAGE_SHIFT;
+	const unsigned int nrpages_in =
+		PAGE_ALIGN(rq->inputsize) >> PAGE_SHIFT;
+	unsigned int inputmargin, i;
+	struct z_erofs_lzma *strm;
+	struct xz_buf buf;
+	enum xz_ret xz_err;
+	u8 *src, *dst;
+	int err = 0;
+
+	/* the decoder needs all output pages mapped contiguously */
+	for (i = 0; i < nrpages_out; ++i) {
+		struct page *victim;
+
+		if (rq->out[i])
+			continue;
+
+		victim = erofs_allocpage(pagepool, GFP_KERNEL);
+		if (!victim)
+			return -ENOMEM;
+		victim->mapping = Z_EROFS_MAPPING_STAGING;
+		rq->out[i] = victim;
+	}
+
+	strm = z_erofs_lzma_get();
+
+	if (rq->inplace_io) {
+		/* compressed pages are also output pages, copy them out */
+		for (i = 0; i < nrpages_in; ++i) {
+			void *kaddr = kmap_atomic(rq->in[i]);
+
+			memcpy(strm->bounce + i * PAGE_SIZE, kaddr, PAGE_SIZE);
+			kunmap_atomic(kaddr);
+		}
+		src = strm->bounce;
+	} else {
+		src = z_erofs_lzma_map(rq->in, nrpages_in);
+		if (!src) {
+			err = -ENOMEM;
+			goto out_put;
+		}
+	}
+
+	/*
+	 * MicroLZMA data is stored at the end of the pcluster, the first
+	 * byte (the negated lc/lp/pb properties) is never zero.
+	 */
+	inputmargin = 0;
+	while (!src[inputmargin])
+		if (++inputmargin >= PAGE_SIZE)
+			break;
+	if (inputmargin >= PAGE_SIZE || inputmargin >= rq->inputsize) {
+		err = -EFSCORRUPTED;
+		goto out_unmap_src;
+	}
+
+	dst = z_erofs_lzma_map(rq->out, nrpages_out);
+	if (!dst) {
+		err = -ENOMEM;
+		goto out_unmap_src;
+	}
+
+	xz_dec_microlzma_reset(strm->state, rq->inputsize - inputmargin,
+			       rq->outputsize, !rq->partial_decoding);
+	buf.in = src + inputmargin;
+	buf.in_pos = 0;
+	buf.in_size = rq->inputsize - inputmargin;
+	buf.out = dst + rq->pageofs_out;
+	buf.out_pos = 0;
+	buf.out_size = rq->outputsize;
+
+	xz_err = xz_dec_microlzma_run(strm->state, &buf);
+	if (xz_err != XZ_STREAM_END || buf.out_pos != rq->outputsize) {
+		erofs_err(rq->sb, "failed to decompress %d in[%u, %zu] out[%u, %zu]",
+			  xz_err, rq->inputsize - inputmargin, buf.in_pos,
+			  rq->outputsize, buf.out_pos);
+		err = -EIO;
+	}
+
+	z_erofs_lzma_unmap(rq->out, dst, nrpages_out);
+out_unmap_src:
+	if (!rq->inplace_io)
+		z_erofs_lzma_unmap(rq->in, src, nrpages_in);
+out_put:
+	z_erofs_lzma_put(strm);
+	return err;
+}
@@ -51,6 +51,9 @@ struct erofs_fs_context {
 	/* current strategy of how to use managed cache */
 	unsigned char cache_strategy;
 
+	/* where asynchronous decompression is done */
+	unsigned char decompress_threads;
+
 	/* threshold for decompression synchronously */
 	unsigned int max_sync_decompress_pages;
 #endif
@@ -93,6 +96,9 @@ struct erofs_sb_info {
 	u32 feature_compat;
 	u32 feature_incompat;
 
+	/* bitmap of on-disk compression algorithms (Z_EROFS_COMPRESSION_*) */
+	u16 available_compr_algs;
+
 	struct erofs_fs_context ctx;	/* options */
 };
 
@@ -113,6 +119,11 @@ enum {
 	EROFS_ZIP_CACHE_READAROUND
 };
 
+enum {
+	EROFS_DECOMPRESS_THREADS_UNBOUND,
+	EROFS_DECOMPRESS_THREADS_PERCPU,
+};
+
 #ifdef CONFIG_EROFS_FS_ZIP
 #define EROFS_LOCKED_MAGIC     (INT_MIN | 0xE0F510CCL)
 
@@ -244,7 +255,6 @@ struct erofs_inode {
 			unsigned short z_advise;
 			unsigned char  z_algorithmtype[2];
 			unsigned char  z_logical_clusterbits;
-			unsigned char  z_physical_clusterbits[2];
 		};
 #endif	/* CONFIG_EROFS_FS_ZIP */
 	};
@@ -330,6 +340,8 @@ struct erofs_map_blocks {
 	u64 m_plen, m_llen;
 
 	unsigned int m_flags;
+	/* algorithm of the mapped pcluster, only valid if EROFS_MAP_ZIPPED */
+	unsigned char m_algorithmformat;
 
 	struct page *mpage;
 };
@@ -416,10 +428,14 @@ int __init erofs_init_shrinker(void);
 void erofs_exit_shrinker(void);
 int __init z_erofs_init_zip_subsystem(void);
 void z_erofs_exit_zip_subsystem(void);
+int z_erofs_init_pcpu_workers(void);
 int erofs_try_to_free_all_cached_pages(struct erofs_sb_info *sbi,
 				       struct erofs_workgroup *egrp);
 int erofs_try_to_free_cached_page(struct address_space *mapping,
 				  struct page *page);
+int z_erofs_load_lz4_config(struct super_block *sb,
+			    struct erofs_super_block *dsb,
+			    struct z_erofs_lz4_cfgs *lz4, int len);
 #else
 static inline void erofs_shrinker_register(struct super_block *sb) {}
 static inline void erofs_shrinker_unregister(struct super_block *sb) {}
@@ -427,8 +443,36 @@ static inline int erofs_init_shrinker(void) { return 0; }
 static inline void erofs_exit_shrinker(void) {}
 static inline int z_erofs_init_zip_subsystem(void) { return 0; }
 static inline void z_erofs_exit_zip_subsystem(void) {}
+static inline int z_erofs_load_lz4_config(struct super_block *sb,
+					  struct erofs_super_block *dsb,
+					  struct z_erofs_lz4_cfgs *lz4, int len)
+{
+	if (lz4 || dsb->u1.lz4_max_distance) {
+		erofs_err(sb, "lz4 algorithm isn't enabled");
+		return -EINVAL;
+	}
+	return 0;
+}
 #endif	/* !CONFIG_EROFS_FS_ZIP */
 
+#ifdef CONFIG_EROFS_FS_ZIP_LZMA
+int z_erofs_load_lzma_config(struct super_block *sb,
+			     struct erofs_super_block *dsb,
+			     struct z_erofs_lzma_cfgs *lzma, int size);
+#else
+static inline int z_erofs_load_lzma_config(struct super_block *sb,
+					   struct erofs_super_block *dsb,
+					   struct z_erofs_lzma_cfgs *lzma,
+					   int size)
+{
+	if (lzma) {
+		erofs_err(sb, "lzma algorithm isn't enabled");
+		return -EINVAL;
+	}
+	return 0;
+}
+#endif	/* !CONFIG_EROFS_FS_ZIP_LZMA */
+
 #define EFSCORRUPTED    EUCLEAN         /* Filesystem is corrupted */
 
 #endif	/* __EROFS_INTERNAL_H */
@@ -7,6 +7,7 @@
 #include "zdata.h"
 #include "compress.h"
 #include <linux/prefetch.h>
+#include <linux/cpuhotplug.h>
 
 #include <trace/events/erofs.h>
 
@@ -34,10 +35,112 @@ typedef tagptr1_t compressed_page_t;
 static struct workqueue_struct *z_erofs_workqueue __read_mostly;
 static struct kmem_cache *pcluster_cachep __read_mostly;
 
+/*
+ * per-CPU decompression kthreads for "decompress_threads=percpu" mounts,
+ * spawned on the first such mount and kept until the module goes away.
+ */
+static struct kthread_worker __rcu **z_erofs_pcpu_workers;
+static DEFINE_MUTEX(z_erofs_pcpu_mutex);
+static DEFINE_SPINLOCK(z_erofs_pcpu_worker_lock);
+static enum cpuhp_state z_erofs_cpuhp_state;
+
+static struct kthread_worker *z_erofs_init_pcpu_worker(unsigned int cpu)
+{
+	struct kthread_worker *worker =
+		kthread_create_worker_on_cpu(cpu, 0, "erofs_worker/%u", cpu);
+
+	if (IS_ERR(worker))
+		return worker;
+	if (IS_ENABLED(CONFIG_EROFS_FS_PCPU_KTHREAD_HIPRI))
+		sched_set_fifo_low(worker->task);
+	else
+		set_user_nice(worker->task, MIN_NICE);
+	return worker;
+}
+
+static int z_erofs_cpu_online(unsigned int cpu)
+{
+	struct kthread_worker *worker, *old;
+
+	worker = z_erofs_init_pcpu_worker(cpu);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	spin_lock(&z_erofs_pcpu_worker_lock);
+	old = rcu_dereference_protected(z_erofs_pcpu_workers[cpu],
+			lockdep_is_held(&z_erofs_pcpu_worker_lock));
+	if (!old)
+		rcu_assign_pointer(z_erofs_pcpu_workers[cpu], worker);
+	spin_unlock(&z_erofs_pcpu_worker_lock);
+	if (old)
+		kthread_destroy_worker(worker);
+	return 0;
+}
+
+static int z_erofs_cpu_offline(unsigned int cpu)
+{
+	struct kthread_worker *worker;
+
+	spin_lock(&z_erofs_pcpu_worker_lock);
+	worker = rcu_dereference_protected(z_erofs_pcpu_workers[cpu],
+			lockdep_is_held(&z_erofs_pcpu_worker_lock));
+	rcu_assign_pointer(z_erofs_pcpu_workers[cpu], NULL);
+	spin_unlock(&z_erofs_pcpu_worker_lock);
+
+	/* wait for in-flight kickoffs still looking at this worker */
+	synchronize_rcu();
+	if (worker)
+		kthread_destroy_worker(worker);
+	return 0;
+}
+
+int z_erofs_init_pcpu_workers(void)
+{
+	struct kthread_worker __rcu **workers;
+	int err = 0;
+
+	mutex_lock(&z_erofs_pcpu_mutex);
+	if (z_erofs_pcpu_workers)
+		goto out_unlock;
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+	WRITE_ONCE(z_erofs_pcpu_workers, workers);
+
+	err = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "fs/erofs:online",
+				z_erofs_cpu_online, z_erofs_cpu_offline);
+	if (err < 0) {
+		WRITE_ONCE(z_erofs_pcpu_workers, NULL);
+		synchronize_rcu();
+		kfree(workers);
+		goto out_unlock;
+	}
+	z_erofs_cpuhp_state = err;
+	err = 0;
+out_unlock:
+	mutex_unlock(&z_erofs_pcpu_mutex);
+	return err;
+}
+
+static void z_erofs_destroy_pcpu_workers(void)
+{
+	if (!z_erofs_pcpu_workers)
+		return;
+	/* tears down the worker of each online CPU via z_erofs_cpu_offline */
+	cpuhp_remove_state(z_erofs_cpuhp_state);
+	kfree(z_erofs_pcpu_workers);
+	z_erofs_pcpu_workers = NULL;
+}
+
 void z_erofs_exit_zip_subsystem(void)
 {
+	z_erofs_destroy_pcpu_workers();
 	destroy_workqueue(z_erofs_workqueue);
 	kmem_cache_destroy(pcluster_cachep);
+	z_erofs_lzma_exit();
 }
 
 static inline int z_erofs_init_workqueue(void)
@@ -157,7 +260,7 @@ static void preload_compressed_pages(struct z_erofs_collector *clt,
 				     enum z_erofs_cache_alloctype type)
 {
 	const struct z_erofs_pcluster *pcl = clt->pcl;
-	const unsigned int clusterpages = BIT(pcl->clusterbits);
+	const unsigned int clusterpages = pcl->pclusterpages;
 	struct page **pages = clt->compressedpages;
 	pgoff_t index = pcl->obj.index + (pages - pcl->compressed_pages);
 	bool standalone = true;
@@ -204,7 +307,7 @@ int erofs_try_to_free_all_cached_pages(struct erofs_sb_info *sbi,
 	struct z_erofs_pcluster *const pcl =
 		container_of(grp, struct z_erofs_pcluster, obj);
 	struct address_space *const mapping = MNGD_MAPPING(sbi);
-	const unsigned int clusterpages = BIT(pcl->clusterbits);
+	const unsigned int clusterpages = pcl->pclusterpages;
 	int i;
 
 	/*
@@ -239,7 +342,7 @@ int erofs_try_to_free_cached_page(struct address_space *mapping,
 				  struct page *page)
 {
 	struct z_erofs_pcluster *const pcl = (void *)page_private(page);
-	const unsigned int clusterpages = BIT(pcl->clusterbits);
+	const unsigned int clusterpages = pcl->pclusterpages;
 	int ret = 0;	/* 0 - busy */
 
 	if (erofs_workgroup_try_to_freeze(&pcl->obj, 1)) {
@@ -267,7 +370,7 @@ static inline bool z_erofs_try_inplace_io(struct z_erofs_collector *clt,
 					  struct page *page)
 {
 	struct z_erofs_pcluster *const pcl = clt->pcl;
-	const unsigned int clusterpages = BIT(pcl->clusterbits);
+	const unsigned int clusterpages = pcl->pclusterpages;
 
 	while (clt->compressedpages < pcl->compressed_pages + clusterpages) {
 		if (!cmpxchg(clt->compressedpages++, NULL, page))
@@ -342,7 +445,8 @@ static int z_erofs_lookup_collection(struct z_erofs_collector *clt,
 	}
 
 	cl = z_erofs_primarycollection(pcl);
-	if (cl->pageofs != (map->m_la & ~PAGE_MASK)) {
+	if (cl->pageofs != (map->m_la & ~PAGE_MASK) ||
+	    pcl->pclusterpages != map->m_plen >> PAGE_SHIFT) {
 		DBG_BUGON(1);
 		return -EFSCORRUPTED;
 	}
@@ -399,12 +503,11 @@ static int z_erofs_register_collection(struct z_erofs_collector *clt,
 			Z_EROFS_PCLUSTER_FULL_LENGTH : 0);
 
 	if (map->m_flags & EROFS_MAP_ZIPPED)
-		pcl->algorithmformat = Z_EROFS_COMPRESSION_LZ4;
+		pcl->algorithmformat = map->m_algorithmformat;
 	else
 		pcl->algorithmformat = Z_EROFS_COMPRESSION_SHIFTED;
 
-	pcl->clusterbits = EROFS_I(inode)->z_physical_clusterbits[0];
-	pcl->clusterbits -= PAGE_SHIFT;
+	pcl->pclusterpages = map->m_plen >> PAGE_SHIFT;
 
 	/* new pclusters should be claimed as type 1, primary and followed */
 	pcl->next = clt->owned_head;
@@ -462,7 +565,9 @@ static int z_erofs_collector_begin(struct z_erofs_collector *clt,
 	DBG_BUGON(clt->owned_head == Z_EROFS_PCLUSTER_NIL);
 	DBG_BUGON(clt->owned_head == Z_EROFS_PCLUSTER_TAIL_CLOSED);
 
-	if (!PAGE_ALIGNED(map->m_pa)) {
+	if (!PAGE_ALIGNED(map->m_pa) || !PAGE_ALIGNED(map->m_plen) ||
+	    map->m_plen < PAGE_SIZE ||
+	    map->m_plen > Z_EROFS_CLUSTER_MAX_PAGES * PAGE_SIZE) {
 		DBG_BUGON(1);
 		return -EINVAL;
 	}
@@ -692,9 +797,35 @@ static int z_erofs_do_read_page(struct z_erofs_decompress_frontend *fe,
 	goto out;
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work);
+static void z_erofs_decompressqueue_kthread_work(struct kthread_work *work);
+
+/* try to hand @io over to the decompression kthread of the current CPU */
+static bool z_erofs_queue_pcpu_work(struct z_erofs_decompressqueue *io)
+{
+	struct kthread_worker __rcu **workers = READ_ONCE(z_erofs_pcpu_workers);
+	struct kthread_worker *worker;
+	bool queued = false;
+
+	if (!workers)
+		return false;
+
+	rcu_read_lock();
+	worker = rcu_dereference(workers[raw_smp_processor_id()]);
+	if (worker) {
+		kthread_init_work(&io->u.kthread_work,
+				  z_erofs_decompressqueue_kthread_work);
+		queued = kthread_queue_work(worker, &io->u.kthread_work);
+	}
+	rcu_read_unlock();
+	return queued;
+}
+
 static void z_erofs_decompress_kickoff(struct z_erofs_decompressqueue *io,
 				       bool sync, int bios)
 {
+	struct erofs_sb_info *const sbi = EROFS_SB(io->sb);
+
 	/* wake up the caller thread for sync decompression */
 	if (sync) {
 		unsigned long flags;
@@ -706,8 +837,26 @@ static void z_erofs_decompress_kickoff(struct z_erofs_decompressqueue *io,
 		return;
 	}
 
-	if (!atomic_add_return(bios, &io->pending_bios))
-		queue_work(z_erofs_workqueue, &io->u.work);
+	if (atomic_add_return(bios, &io->pending_bios))
+		return;
+
+	/*
+	 * Decompression sleeps (pcluster mutex, page allocation, vmap), so
+	 * it can only be done here if the last bio completed in a context
+	 * which is allowed to sleep; that saves a pointless context switch.
+	 */
+	if (in_task() && !in_atomic() && !irqs_disabled() &&
+	    !rcu_read_lock_any_held()) {
+		z_erofs_decompressqueue_work(&io->u.work);
+		return;
+	}
+
+	if (sbi->ctx.decompress_threads == EROFS_DECOMPRESS_THREADS_PERCPU &&
+	    z_erofs_queue_pcpu_work(io))
+		return;
+
+	INIT_WORK(&io->u.work, z_erofs_decompressqueue_work);
+	queue_work(z_erofs_workqueue, &io->u.work);
 }
 
 static void z_erofs_decompressqueue_endio(struct bio *bio)
@@ -742,7 +891,7 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 				       struct list_head *pagepool)
 {
 	struct erofs_sb_info *const sbi = EROFS_SB(sb);
-	const unsigned int clusterpages = BIT(pcl->clusterbits);
+	const unsigned int clusterpages = pcl->pclusterpages;
 	struct z_erofs_pagevec_ctor ctor;
 	unsigned int i, outputsize, llen, nr_pages;
 	struct page *pages_onstack[Z_EROFS_VMAP_ONSTACK_PAGES];
@@ -882,7 +1031,7 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 					.in = compressed_pages,
 					.out = pages,
 					.pageofs_out = cl->pageofs,
-					.inputsize = PAGE_SIZE,
+					.inputsize = clusterpages * PAGE_SIZE,
 					.outputsize = outputsize,
 					.alg = pcl->algorithmformat,
 					.inplace_io = overlapped,
@@ -959,10 +1108,8 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 	}
 }
 
-static void z_erofs_decompressqueue_work(struct work_struct *work)
+static void z_erofs_decompress_bgqueue(struct z_erofs_decompressqueue *bgq)
 {
-	struct z_erofs_decompressqueue *bgq =
-		container_of(work, struct z_erofs_decompressqueue, u.work);
 	LIST_HEAD(pagepool);
 
 	DBG_BUGON(bgq->head == Z_EROFS_PCLUSTER_TAIL_CLOSED);
@@ -972,6 +1119,18 @@ static void z_erofs_decompressqueue_work(struct work_struct *work)
 	kvfree(bgq);
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work)
+{
+	z_erofs_decompress_bgqueue(container_of(work,
+			struct z_erofs_decompressqueue, u.work));
+}
+
+static void z_erofs_decompressqueue_kthread_work(struct kthread_work *work)
+{
+	z_erofs_decompress_bgqueue(container_of(work,
+			struct z_erofs_decompressqueue, u.kthread_work));
+}
+
 static struct page *pickup_page_for_submission(struct z_erofs_pcluster *pcl,
 					       unsigned int nr,
 					       struct list_head *pagepool,
@@ -1096,7 +1255,6 @@ jobqueue_init(struct super_block *sb,
 			*fg = true;
 			goto fg_out;
 		}
-		INIT_WORK(&q->u.work, z_erofs_decompressqueue_work);
 	} else {
 fg_out:
 		q = fgq;
@@ -1184,7 +1342,7 @@ static void z_erofs_submit_queue(struct super_block *sb,
 		pcl = container_of(owned_head, struct z_erofs_pcluster, next);
 
 		cur = pcl->obj.index;
-		end = cur + BIT(pcl->clusterbits);
+		end = cur + pcl->pclusterpages;
 
 		/* close the main owned chain at first */
 		owned_head = cmpxchg(&pcl->next, Z_EROFS_PCLUSTER_TAIL,
@@ -7,6 +7,7 @@
 #ifndef __EROFS_FS_ZDATA_H
 #define __EROFS_FS_ZDATA_H
 
+#include <linux/kthread.h>
 #include "internal.h"
 #include "zpvec.h"
 
@@ -67,8 +68,8 @@ struct z_erofs_pcluster {
 
 	/* I: compression algorithm format */
 	unsigned char algorithmformat;
-	/* I: bit shift of physical cluster size */
-	unsigned char clusterbits;
+	/* I: number of compressed pages, up to Z_EROFS_CLUSTER_MAX_PAGES */
+	unsigned short pclusterpages;
 };
 
 #define z_erofs_primarycollection(pcluster) (&(pcluster)->primary_collection)
@@ -92,6 +93,7 @@ struct z_erofs_decompressqueue {
 	union {
 		wait_queue_head_t wait;
 		struct work_struct work;
+		struct kthread_work kthread_work;
 	} u;
 };
 
@@ -23,13 +23,17 @@
 
 /*
  * Structure allocated for each page or THP when block size < page size
- * to track sub-page uptodate status and I/O completions.
+ * to track sub-page uptodate and dirty status and I/O completions.
+ *
+ * The first i_blocks_per_page() bits of state are the uptodate bits, and
+ * the next i_blocks_per_page() bits the dirty bits, so that writeback can
+ * skip the blocks of a large page that were never written to.
  */
 struct iomap_page {
 	atomic_t		read_bytes_pending;
 	atomic_t		write_bytes_pending;
-	spinlock_t		uptodate_lock;
-	unsigned long		uptodate[];
+	spinlock_t		state_lock;
+	unsigned long		state[];
 };
 
 static inline struct iomap_page *to_iomap_page(struct page *page)
@@ -48,6 +52,40 @@ static inline struct iomap_page *to_iomap_page(struct page *page)
 
 static struct bio_set iomap_ioend_bioset;
 
+/*
+ * bio_for_each_segment_all() walks a THP one base page at a time, whereas
+ * all the per-page state lives in the head page.  Return the head page and
+ * the offset of the segment inside it.
+ */
+static inline struct page *iomap_bvec_page(struct bio_vec *bvec, size_t *offp)
+{
+	struct page *head = thp_head(bvec->bv_page);
+
+	*offp = ((size_t)(bvec->bv_page - head) << PAGE_SHIFT) +
+		bvec->bv_offset;
+	return head;
+}
+
+/* zero_user() and friends only ever kmap a single base page */
+static void iomap_zero_segment(struct page *page, size_t start, size_t end)
+{
+	while (start < end) {
+		size_t poff = offset_in_page(start);
+		size_t len = min_t(size_t, end - start, PAGE_SIZE - poff);
+
+		zero_user(page + (start >> PAGE_SHIFT), poff, len);
+		start += len;
+	}
+}
+
+static void iomap_flush_dcache_page(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < thp_nr_pages(page); i++)
+		flush_dcache_page(page + i);
+}
+
 static struct iomap_page *
 iomap_page_create(struct inode *inode, struct page *page)
 {
@@ -57,11 +95,13 @@ iomap_page_create(struct inode *inode, struct page *page)
 	if (iop || nr_blocks <= 1)
 		return iop;
 
-	iop = kzalloc(struct_size(iop, uptodate, BITS_TO_LONGS(nr_blocks)),
+	iop = kzalloc(struct_size(iop, state, BITS_TO_LONGS(2 * nr_blocks)),
 			GFP_NOFS | __GFP_NOFAIL);
-	spin_lock_init(&iop->uptodate_lock);
+	spin_lock_init(&iop->state_lock);
 	if (PageUptodate(page))
-		bitmap_fill(iop->uptodate, nr_blocks);
+		bitmap_set(iop->state, 0, nr_blocks);
+	if (PageDirty(page))
+		bitmap_set(iop->state, nr_blocks, nr_blocks);
 	attach_page_private(page, iop);
 	return iop;
 }
@@ -76,7 +116,7 @@ iomap_page_release(struct page *page)
 		return;
 	WARN_ON_ONCE(atomic_read(&iop->read_bytes_pending));
 	WARN_ON_ONCE(atomic_read(&iop->write_bytes_pending));
-	WARN_ON_ONCE(bitmap_full(iop->uptodate, nr_blocks) !=
+	WARN_ON_ONCE(bitmap_full(iop->state, nr_blocks) !=
 			PageUptodate(page));
 	kfree(iop);
 }
@@ -85,15 +125,16 @@ iomap_page_release(struct page *page)
  * Calculate the range inside the page that we actually need to read.
  */
 static void
-iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
+iomap_adjust_read_range(struct inode *inode, struct page *page,
 		loff_t *pos, loff_t length, unsigned *offp, unsigned *lenp)
 {
+	struct iomap_page *iop = to_iomap_page(page);
 	loff_t orig_pos = *pos;
 	loff_t isize = i_size_read(inode);
 	unsigned block_bits = inode->i_blkbits;
 	unsigned block_size = (1 << block_bits);
-	unsigned poff = offset_in_page(*pos);
-	unsigned plen = min_t(loff_t, PAGE_SIZE - poff, length);
+	unsigned poff = offset_in_thp(page, *pos);
+	unsigned plen = min_t(loff_t, thp_size(page) - poff, length);
 	unsigned first = poff >> block_bits;
 	unsigned last = (poff + plen - 1) >> block_bits;
 
@@ -107,7 +148,7 @@ iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
 
 		/* move forward for each leading block marked uptodate */
 		for (i = first; i <= last; i++) {
-			if (!test_bit(i, iop->uptodate))
+			if (!test_bit(i, iop->state))
 				break;
 			*pos += block_size;
 			poff += block_size;
@@ -117,7 +158,7 @@ iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
 
 		/* truncate len if we find any trailing uptodate block(s) */
 		for ( ; i <= last; i++) {
-			if (test_bit(i, iop->uptodate)) {
+			if (test_bit(i, iop->state)) {
 				plen -= (last - i + 1) * block_size;
 				last = i - 1;
 				break;
@@ -131,7 +172,7 @@ iomap_adjust_read_range(struct inode *inode, struct iomap_page *iop,
 	 * page cache for blocks that are entirely outside of i_size.
 	 */
 	if (orig_pos <= isize && orig_pos + length > isize) {
-		unsigned end = offset_in_page(isize - 1) >> block_bits;
+		unsigned end = offset_in_thp(page, isize - 1) >> block_bits;
 
 		if (first <= end && last > end)
 			plen -= (last - end) * block_size;
@@ -150,11 +191,11 @@ iomap_iop_set_range_uptodate(struct page *page, unsigned off, unsigned len)
 	unsigned last = (off + len - 1) >> inode->i_blkbits;
 	unsigned long flags;
 
-	spin_lock_irqsave(&iop->uptodate_lock, flags);
-	bitmap_set(iop->uptodate, first, last - first + 1);
-	if (bitmap_full(iop->uptodate, i_blocks_per_page(inode, page)))
+	spin_lock_irqsave(&iop->state_lock, flags);
+	bitmap_set(iop->state, first, last - first + 1);
+	if (bitmap_full(iop->state, i_blocks_per_page(inode, page)))
 		SetPageUptodate(page);
-	spin_unlock_irqrestore(&iop->uptodate_lock, flags);
+	spin_unlock_irqrestore(&iop->state_lock, flags);
 }
 
 static void
@@ -169,17 +210,61 @@ iomap_set_range_uptodate(struct page *page, unsigned off, unsigned len)
 		SetPageUptodate(page);
 }
 
+static void
+iomap_set_range_dirty(struct page *page, unsigned off, unsigned len)
+{
+	struct iomap_page *iop = to_iomap_page(page);
+	struct inode *inode = page->mapping->host;
+	unsigned int nr_blocks = i_blocks_per_page(inode, page);
+	unsigned first = off >> inode->i_blkbits;
+	unsigned last = (off + len - 1) >> inode->i_blkbits;
+	unsigned long flags;
+
+	if (!iop || !len)
+		return;
+
+	spin_lock_irqsave(&iop->state_lock, flags);
+	bitmap_set(iop->state, nr_blocks + first, last - first + 1);
+	spin_unlock_irqrestore(&iop->state_lock, flags);
+}
+
+static void
+iomap_clear_range_dirty(struct page *page, unsigned off, unsigned len)
+{
+	struct iomap_page *iop = to_iomap_page(page);
+	struct inode *inode = page->mapping->host;
+	unsigned int nr_blocks = i_blocks_per_page(inode, page);
+	unsigned first = off >> inode->i_blkbits;
+	unsigned last = (off + len - 1) >> inode->i_blkbits;
+	unsigned long flags;
+
+	if (!iop || !len)
+		return;
+
+	spin_lock_irqsave(&iop->state_lock, flags);
+	bitmap_clear(iop->state, nr_blocks + first, last - first + 1);
+	spin_unlock_irqrestore(&iop->state_lock, flags);
+}
+
+static inline bool
+iomap_block_is_dirty(struct inode *inode, struct page *page,
+		struct iomap_page *iop, unsigned int block)
+{
+	return test_bit(i_blocks_per_page(inode, page) + block, iop->state);
+}
+
 static void
 iomap_read_page_end_io(struct bio_vec *bvec, int error)
 {
-	struct page *page = bvec->bv_page;
+	size_t off;
+	struct page *page = iomap_bvec_page(bvec, &off);
 	struct iomap_page *iop = to_iomap_page(page);
 
 	if (unlikely(error)) {
 		ClearPageUptodate(page);
 		SetPageError(page);
 	} else {
-		iomap_set_range_uptodate(page, bvec->bv_offset, bvec->bv_len);
+		iomap_set_range_uptodate(page, off, bvec->bv_len);
 	}
 
 	if (!iop || atomic_sub_and_test(bvec->bv_len, &iop->read_bytes_pending))
@@ -220,8 +305,8 @@ iomap_read_inline_data(struct inode *inode, struct page *page,
 
 	addr = kmap_atomic(page);
 	memcpy(addr, iomap->inline_data, size);
-	memset(addr + size, 0, PAGE_SIZE - size);
 	kunmap_atomic(addr);
+	iomap_zero_segment(page, size, thp_size(page));
 	SetPageUptodate(page);
 }
 
@@ -248,16 +333,16 @@ iomap_readpage_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 	if (iomap->type == IOMAP_INLINE) {
 		WARN_ON_ONCE(pos);
 		iomap_read_inline_data(inode, page, iomap);
-		return PAGE_SIZE;
+		return thp_size(page);
 	}
 
 	/* zero post-eof blocks as the page may be mapped */
-	iomap_adjust_read_range(inode, iop, &pos, length, &poff, &plen);
+	iomap_adjust_read_range(inode, page, &pos, length, &poff, &plen);
 	if (plen == 0)
 		goto done;
 
 	if (iomap_block_needs_zeroing(inode, iomap, pos)) {
-		zero_user(page, poff, plen);
+		iomap_zero_segment(page, poff, poff + plen);
 		iomap_set_range_uptodate(page, poff, plen);
 		goto done;
 	}
@@ -317,14 +402,15 @@ iomap_readpage(struct page *page, const struct iomap_ops *ops)
 {
 	struct iomap_readpage_ctx ctx = { .cur_page = page };
 	struct inode *inode = page->mapping->host;
+	size_t size = thp_size(page);
 	unsigned poff;
 	loff_t ret;
 
-	trace_iomap_readpage(page->mapping->host, 1);
+	trace_iomap_readpage(page->mapping->host, thp_nr_pages(page));
 
-	for (poff = 0; poff < PAGE_SIZE; poff += ret) {
+	for (poff = 0; poff < size; poff += ret) {
 		ret = iomap_apply(inode, page_offset(page) + poff,
-				PAGE_SIZE - poff, 0, ops, &ctx,
+				size - poff, 0, ops, &ctx,
 				iomap_readpage_actor);
 		if (ret <= 0) {
 			WARN_ON_ONCE(ret == 0);
@@ -358,7 +444,8 @@ iomap_readahead_actor(struct inode *inode, loff_t pos, loff_t length,
 	loff_t done, ret;
 
 	for (done = 0; done < length; done += ret) {
-		if (ctx->cur_page && offset_in_page(pos + done) == 0) {
+		if (ctx->cur_page &&
+		    offset_in_thp(ctx->cur_page, pos + done) == 0) {
 			if (!ctx->cur_page_in_bio)
 				unlock_page(ctx->cur_page);
 			put_page(ctx->cur_page);
@@ -433,13 +520,17 @@ int
 iomap_is_partially_uptodate(struct page *page, unsigned long from,
 		unsigned long count)
 {
-	struct iomap_page *iop = to_iomap_page(page);
+	struct page *head = thp_head(page);
+	struct iomap_page *iop = to_iomap_page(head);
 	struct inode *inode = page->mapping->host;
 	unsigned len, first, last;
 	unsigned i;
 
-	/* Limit range to one page */
-	len = min_t(unsigned, PAGE_SIZE - from, count);
+	/* @from is relative to @page, which may be a tail page of a THP */
+	from += (unsigned long)(page - head) << PAGE_SHIFT;
+
+	/* Limit range to one (possibly huge) page */
+	len = min_t(unsigned long, thp_size(head) - from, count);
 
 	/* First and last blocks in range within page */
 	first = from >> inode->i_blkbits;
@@ -447,7 +538,7 @@ iomap_is_partially_uptodate(struct page *page, unsigned long from,
 
 	if (iop) {
 		for (i = first; i <= last; i++)
-			if (!test_bit(i, iop->uptodate))
+			if (!test_bit(i, iop->state))
 				return 0;
 		return 1;
 	}
@@ -460,7 +551,7 @@ int
 iomap_releasepage(struct page *page, gfp_t gfp_mask)
 {
 	trace_iomap_releasepage(page->mapping->host, page_offset(page),
-			PAGE_SIZE);
+			thp_size(page));
 
 	/*
 	 * mm accommodates an old ext3 case where clean pages might not have had
@@ -483,7 +574,7 @@ iomap_invalidatepage(struct page *page, unsigned int offset, unsigned int len)
 	 * If we are invalidating the entire page, clear the dirty state from it
 	 * and release it to avoid unnecessary buildup of the LRU.
 	 */
-	if (offset == 0 && len == PAGE_SIZE) {
+	if (offset == 0 && len == thp_size(page)) {
 		WARN_ON_ONCE(PageWriteback(page));
 		cancel_dirty_page(page);
 		iomap_page_release(page);
@@ -554,14 +645,14 @@ __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, int flags,
 	loff_t block_size = i_blocksize(inode);
 	loff_t block_start = round_down(pos, block_size);
 	loff_t block_end = round_up(pos + len, block_size);
-	unsigned from = offset_in_page(pos), to = from + len, poff, plen;
+	unsigned from = offset_in_thp(page, pos), to = from + len, poff, plen;
 
 	if (PageUptodate(page))
 		return 0;
 	ClearPageError(page);
 
 	do {
-		iomap_adjust_read_range(inode, iop, &block_start,
+		iomap_adjust_read_range(inode, page, &block_start,
 				block_end - block_start, &poff, &plen);
 		if (plen == 0)
 			break;
@@ -574,7 +665,8 @@ __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, int flags,
 		if (iomap_block_needs_zeroing(inode, srcmap, block_start)) {
 			if (WARN_ON_ONCE(flags & IOMAP_WRITE_F_UNSHARE))
 				return -EIO;
-			zero_user_segments(page, poff, from, to, poff + plen);
+			iomap_zero_segment(page, poff, from);
+			iomap_zero_segment(page, to, poff + plen);
 		} else {
 			int status = iomap_read_page_sync(block_start, page,
 					poff, plen, srcmap);
@@ -608,12 +700,17 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 			return status;
 	}
 
-	page = grab_cache_page_write_begin(inode->i_mapping, pos >> PAGE_SHIFT,
-			AOP_FLAG_NOFS);
+	page = pagecache_get_page(inode->i_mapping, pos >> PAGE_SHIFT,
+			FGP_LOCK | FGP_WRITE | FGP_CREAT | FGP_NOFS | FGP_HEAD,
+			mapping_gfp_mask(inode->i_mapping));
 	if (!page) {
 		status = -ENOMEM;
 		goto out_no_page;
 	}
+	wait_for_stable_page(page);
+
+	/* the callers trim their copy to the end of the page in the same way */
+	len = min_t(size_t, len, thp_size(page) - offset_in_thp(page, pos));
 
 	if (srcmap->type == IOMAP_INLINE)
 		iomap_read_inline_data(inode, page, srcmap);
@@ -640,8 +737,8 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 	return status;
 }
 
-int
-iomap_set_page_dirty(struct page *page)
+static int
+__iomap_set_page_dirty(struct page *page)
 {
 	struct address_space *mapping = page_mapping(page);
 	int newly_dirty;
@@ -663,12 +760,24 @@ iomap_set_page_dirty(struct page *page)
 		__mark_inode_dirty(mapping->host, I_DIRTY_PAGES);
 	return newly_dirty;
 }
+
+/*
+ * Dirtying a page through ->set_page_dirty, e.g. from page_mkwrite, can
+ * modify any byte of it, so all of its blocks become dirty.
+ */
+int
+iomap_set_page_dirty(struct page *page)
+{
+	if (page->mapping)
+		iomap_set_range_dirty(page, 0, thp_size(page));
+	return __iomap_set_page_dirty(page);
+}
 EXPORT_SYMBOL_GPL(iomap_set_page_dirty);
 
 static size_t __iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 		size_t copied, struct page *page)
 {
-	flush_dcache_page(page);
+	iomap_flush_dcache_page(page);
 
 	/*
 	 * The blocks that were entirely written will now be uptodate, so we
@@ -683,8 +792,9 @@ static size_t __iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 	 */
 	if (unlikely(copied < len && !PageUptodate(page)))
 		return 0;
-	iomap_set_range_uptodate(page, offset_in_page(pos), len);
-	iomap_set_page_dirty(page);
+	iomap_set_range_uptodate(page, offset_in_thp(page, pos), len);
+	iomap_set_range_dirty(page, offset_in_thp(page, pos), copied);
+	__iomap_set_page_dirty(page);
 	return copied;
 }
 
@@ -745,6 +855,48 @@ static size_t iomap_write_end(struct inode *inode, loff_t pos, size_t len,
 	return ret;
 }
 
+/*
+ * How much to try and cover with a single ->write_begin at @pos.  Mappings
+ * that can hold THPs in the page cache are offered up to a PMD worth; the
+ * page found at @pos then decides how much of that is actually used.
+ */
+static size_t iomap_write_chunk(struct inode *inode, loff_t pos)
+{
+	size_t chunk = PAGE_SIZE;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (mapping_thp_support(inode->i_mapping))
+		chunk = HPAGE_PMD_SIZE;
+#endif
+	return chunk - (pos & (chunk - 1));
+}
+
+/*
+ * Like iov_iter_copy_from_user_atomic(), but maps a THP one base page at a
+ * time.  Does not advance @i.
+ */
+static size_t iomap_copy_from_user_atomic(struct page *page,
+		struct iov_iter *i, size_t offset, size_t bytes)
+{
+	struct iov_iter tmp = *i;
+	size_t copied = 0;
+
+	while (copied < bytes) {
+		size_t poff = offset_in_page(offset + copied);
+		size_t len = min_t(size_t, bytes - copied, PAGE_SIZE - poff);
+		size_t ret;
+
+		ret = iov_iter_copy_from_user_atomic(
+				page + ((offset + copied) >> PAGE_SHIFT),
+				&tmp, poff, len);
+		copied += ret;
+		if (ret < len || copied == bytes)
+			break;
+		iov_iter_advance(&tmp, ret);
+	}
+	return copied;
+}
+
 static loff_t
 iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		struct iomap *iomap, struct iomap *srcmap)
@@ -759,8 +911,7 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		unsigned long bytes;	/* Bytes to write to page */
 		size_t copied;		/* Bytes copied from user */
 
-		offset = offset_in_page(pos);
-		bytes = min_t(unsigned long, PAGE_SIZE - offset,
+		bytes = min_t(unsigned long, iomap_write_chunk(inode, pos),
 						iov_iter_count(i));
 again:
 		if (bytes > length)
@@ -786,10 +937,14 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		if (unlikely(status))
 			break;
 
+		offset = offset_in_thp(page, pos);
+		if (bytes > thp_size(page) - offset)
+			bytes = thp_size(page) - offset;
+
 		if (mapping_writably_mapped(inode->i_mapping))
-			flush_dcache_page(page);
+			iomap_flush_dcache_page(page);
 
-		copied = iov_iter_copy_from_user_atomic(page, i, offset, bytes);
+		copied = iomap_copy_from_user_atomic(page, i, offset, bytes);
 
 		copied = iomap_write_end(inode, pos, bytes, copied, page, iomap,
 				srcmap);
@@ -806,8 +961,9 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 			 * because not all segments in the iov can be copied at
 			 * once without a pagefault.
 			 */
-			bytes = min_t(unsigned long, PAGE_SIZE - offset,
-						iov_iter_single_seg_count(i));
+			bytes = min_t(unsigned long,
+					PAGE_SIZE - offset_in_page(pos),
+					iov_iter_single_seg_count(i));
 			goto again;
 		}
 		pos += copied;
@@ -855,14 +1011,16 @@ iomap_unshare_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		return length;
 
 	do {
-		unsigned long offset = offset_in_page(pos);
-		unsigned long bytes = min_t(loff_t, PAGE_SIZE - offset, length);
+		unsigned long bytes = min_t(loff_t,
+				iomap_write_chunk(inode, pos), length);
 		struct page *page;
 
 		status = iomap_write_begin(inode, pos, bytes,
 				IOMAP_WRITE_F_UNSHARE, &page, iomap, srcmap);
 		if (unlikely(status))
 			return status;
+		bytes = min_t(unsigned long, bytes,
+				thp_size(page) - offset_in_thp(page, pos));
 
 		status = iomap_write_end(inode, pos, bytes, bytes, page, iomap,
 				srcmap);
@@ -905,14 +1063,16 @@ static s64 iomap_zero(struct inode *inode, loff_t pos, u64 length,
 {
 	struct page *page;
 	int status;
-	unsigned offset = offset_in_page(pos);
-	unsigned bytes = min_t(u64, PAGE_SIZE - offset, length);
+	unsigned offset;
+	unsigned bytes = min_t(u64, iomap_write_chunk(inode, pos), length);
 
 	status = iomap_write_begin(inode, pos, bytes, 0, &page, iomap, srcmap);
 	if (status)
 		return status;
 
-	zero_user(page, offset, bytes);
+	offset = offset_in_thp(page, pos);
+	bytes = min_t(unsigned, bytes, thp_size(page) - offset);
+	iomap_zero_segment(page, offset, offset + bytes);
 	mark_page_accessed(page);
 
 	return iomap_write_end(inode, pos, bytes, bytes, page, iomap, srcmap);
@@ -1006,19 +1166,22 @@ iomap_page_mkwrite_actor(struct inode *inode, loff_t pos, loff_t length,
 
 vm_fault_t iomap_page_mkwrite(struct vm_fault *vmf, const struct iomap_ops *ops)
 {
-	struct page *page = vmf->page;
+	struct page *page = thp_head(vmf->page);
 	struct inode *inode = file_inode(vmf->vma->vm_file);
 	unsigned long length;
-	loff_t offset;
+	loff_t offset, size;
 	ssize_t ret;
 
 	lock_page(page);
-	ret = page_mkwrite_check_truncate(page, inode);
-	if (ret < 0)
+	/* page_mkwrite_check_truncate(), for a page that may be a THP */
+	size = i_size_read(inode);
+	offset = page_offset(page);
+	if (page->mapping != inode->i_mapping || offset >= size) {
+		ret = -EFAULT;
 		goto out_unlock;
-	length = ret;
+	}
+	length = min_t(loff_t, size - offset, thp_size(page));
 
-	offset = page_offset(page);
 	while (length > 0) {
 		ret = iomap_apply(inode, offset, length,
 				IOMAP_WRITE | IOMAP_FAULT, ops, page,
@@ -1084,9 +1247,13 @@ iomap_finish_ioend(struct iomap_ioend *ioend, int error)
 			next = bio->bi_private;
 
 		/* walk each page on bio, ending page IO on them */
-		bio_for_each_segment_all(bv, bio, iter_all)
-			iomap_finish_page_writeback(inode, bv->bv_page, error,
+		bio_for_each_segment_all(bv, bio, iter_all) {
+			size_t off;
+
+			iomap_finish_page_writeback(inode,
+					iomap_bvec_page(bv, &off), error,
 					bv->bv_len);
+		}
 		bio_put(bio);
 	}
 	/* The ioend has been freed by bio_put() */
@@ -1291,7 +1458,7 @@ iomap_add_to_ioend(struct inode *inode, loff_t offset, struct page *page,
 {
 	sector_t sector = iomap_sector(&wpc->iomap, offset);
 	unsigned len = i_blocksize(inode);
-	unsigned poff = offset & (PAGE_SIZE - 1);
+	unsigned poff = offset_in_thp(page, offset);
 	bool merged, same_page = false;
 
 	if (!wpc->ioend || !iomap_can_add_to_ioend(wpc, offset, sector)) {
@@ -1354,9 +1521,11 @@ iomap_writepage_map(struct iomap_writepage_ctx *wpc,
 	 * one.
 	 */
 	for (i = 0, file_offset = page_offset(page);
-	     i < (PAGE_SIZE >> inode->i_blkbits) && file_offset < end_offset;
+	     i < (thp_size(page) >> inode->i_blkbits) &&
+	     file_offset < end_offset;
 	     i++, file_offset += len) {
-		if (iop && !test_bit(i, iop->uptodate))
+		if (iop && (!test_bit(i, iop->state) ||
+			    !iomap_block_is_dirty(inode, page, iop, i)))
 			continue;
 
 		error = wpc->ops->map_blocks(wpc, inode, file_offset);
@@ -1368,6 +1537,8 @@ iomap_writepage_map(struct iomap_writepage_ctx *wpc,
 			continue;
 		iomap_add_to_ioend(inode, file_offset, page, iop, wpc, wbc,
 				 &submit_list);
+		iomap_clear_range_dirty(page, offset_in_thp(page, file_offset),
+				len);
 		count++;
 	}
 
@@ -1405,6 +1576,12 @@ iomap_writepage_map(struct iomap_writepage_ctx *wpc,
 		 */
 		set_page_writeback_keepwrite(page);
 	} else {
+		/*
+		 * Blocks past EOF can have been dirtied by page_mkwrite on the
+		 * last page, so clear all of the dirty bits, not just those of
+		 * the blocks that were written.
+		 */
+		iomap_clear_range_dirty(page, 0, thp_size(page));
 		clear_page_dirty_for_io(page);
 		set_page_writeback(page);
 	}
@@ -1452,7 +1629,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 	u64 end_offset;
 	loff_t offset;
 
-	trace_iomap_writepage(inode, page_offset(page), PAGE_SIZE);
+	trace_iomap_writepage(inode, page_offset(page), thp_size(page));
 
 	/*
 	 * Refuse to write the page out if we are called from reclaim context.
@@ -1490,8 +1667,8 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 	 */
 	offset = i_size_read(inode);
 	end_index = offset >> PAGE_SHIFT;
-	if (page->index < end_index)
-		end_offset = (loff_t)(page->index + 1) << PAGE_SHIFT;
+	if (page->index + thp_nr_pages(page) - 1 < end_index)
+		end_offset = page_offset(page) + thp_size(page);
 	else {
 		/*
 		 * Check whether the page to write out is beyond or straddles
@@ -1504,7 +1681,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 		 * |				    |      Straddles     |
 		 * ---------------------------------^-----------|--------|
 		 */
-		unsigned offset_into_page = offset & (PAGE_SIZE - 1);
+		unsigned offset_into_page = offset_in_thp(page, offset);
 
 		/*
 		 * Skip the page if it is fully outside i_size, e.g. due to a
@@ -1535,7 +1712,7 @@ iomap_do_writepage(struct page *page, struct writeback_control *wbc, void *data)
 		 * memory is zeroed when mapped, and writes to that region are
 		 * not written out to the file."
 		 */
-		zero_user_segment(page, offset_into_page, PAGE_SIZE);
+		iomap_zero_segment(page, offset_into_page, thp_size(page));
 
 		/* Adjust the end_offset to the end of file */
 		end_offset = offset;
@@ -20,6 +20,8 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/sort.h>
+#include <linux/sched/mm.h>
 #include <trace/events/jbd2.h>
 
 /*
@@ -174,12 +176,101 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 	}
 }
 
+/*
+ * Background checkpointing starts once less than half of the log is free
+ * and goes on until three quarters of it are free again, so that
+ * __jbd2_log_wait_for_space() only has to stall new handles when the log
+ * fills up faster than the checkpoint can write it back.
+ */
+static inline unsigned long jbd2_ckpt_start_space(journal_t *journal)
+{
+	return 2UL * journal->j_max_transaction_buffers;
+}
+
+static inline unsigned long jbd2_ckpt_stop_space(journal_t *journal)
+{
+	return 3UL * journal->j_max_transaction_buffers;
+}
+
+/*
+ * __jbd2_log_start_checkpoint: kick background checkpointing if the log is
+ * filling up.
+ *
+ * Called under j_state_lock.
+ */
+void __jbd2_log_start_checkpoint(journal_t *journal)
+{
+	if (journal->j_flags & (JBD2_CKPT_STOPPED | JBD2_ABORT))
+		return;
+	if (jbd2_log_space_left(journal) < jbd2_ckpt_start_space(journal))
+		queue_work(system_unbound_wq, &journal->j_checkpoint_work);
+}
+
+static bool jbd2_ckpt_needed(journal_t *journal)
+{
+	bool needed;
+
+	read_lock(&journal->j_state_lock);
+	needed = !(journal->j_flags & (JBD2_CKPT_STOPPED | JBD2_ABORT)) &&
+		 jbd2_log_space_left(journal) < jbd2_ckpt_stop_space(journal);
+	read_unlock(&journal->j_state_lock);
+	if (!needed)
+		return false;
+
+	spin_lock(&journal->j_list_lock);
+	needed = journal->j_checkpoint_transactions != NULL;
+	spin_unlock(&journal->j_list_lock);
+	return needed;
+}
+
+/*
+ * Background checkpoint worker. We checkpoint one transaction at a time
+ * and drop j_checkpoint_mutex in between, so that a handle which really
+ * ran out of log space gets its turn in __jbd2_log_wait_for_space() as
+ * soon as we have freed some.
+ */
+void jbd2_checkpoint_workfn(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_checkpoint_work);
+	unsigned int nofs_flags;
+	bool more;
+
+	/* Writing back checkpointed buffers must not recurse into the fs */
+	nofs_flags = memalloc_nofs_save();
+	do {
+		mutex_lock_io(&journal->j_checkpoint_mutex);
+		more = jbd2_ckpt_needed(journal) &&
+		       jbd2_log_do_checkpoint(journal) == 0;
+		mutex_unlock(&journal->j_checkpoint_mutex);
+		cond_resched();
+	} while (more);
+	memalloc_nofs_restore(nofs_flags);
+}
+
+static int jbd2_bh_cmp(const void *a, const void *b)
+{
+	const struct buffer_head *bha = *(const struct buffer_head **)a;
+	const struct buffer_head *bhb = *(const struct buffer_head **)b;
+
+	if (bha->b_blocknr < bhb->b_blocknr)
+		return -1;
+	return bha->b_blocknr > bhb->b_blocknr;
+}
+
 static void
 __flush_batch(journal_t *journal, int *batch_count)
 {
 	int i;
 	struct blk_plug plug;
 
+	/*
+	 * Buffers are queued in the order they were modified. Submit them
+	 * sorted by block number so that the plug can merge neighbouring
+	 * buffers into large requests.
+	 */
+	sort(journal->j_chkpt_bhs, *batch_count, sizeof(struct buffer_head *),
+	     jbd2_bh_cmp, NULL);
+
 	blk_start_plug(&plug);
 	for (i = 0; i < *batch_count; i++)
 		write_dirty_buffer(journal->j_chkpt_bhs[i], REQ_SYNC);
@@ -476,12 +476,12 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 					      stats.run.rs_locked);
 
 	spin_lock(&commit_transaction->t_handle_lock);
-	while (atomic_read(&commit_transaction->t_updates)) {
+	while (jbd2_journal_updates(journal, commit_transaction)) {
 		DEFINE_WAIT(wait);
 
 		prepare_to_wait(&journal->j_wait_updates, &wait,
 					TASK_UNINTERRUPTIBLE);
-		if (atomic_read(&commit_transaction->t_updates)) {
+		if (jbd2_journal_updates(journal, commit_transaction)) {
 			spin_unlock(&commit_transaction->t_handle_lock);
 			write_unlock(&journal->j_state_lock);
 			schedule();
@@ -491,6 +491,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		finish_wait(&journal->j_wait_updates, &wait);
 	}
 	spin_unlock(&commit_transaction->t_handle_lock);
+	jbd2_journal_drain_credit_cache(journal, commit_transaction);
 	commit_transaction->t_state = T_SWITCH;
 	write_unlock(&journal->j_state_lock);
 
@@ -1156,6 +1157,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	else
 		journal->j_average_commit_time = commit_time;
 
+	/* Start reclaiming log space before handles have to wait for it */
+	__jbd2_log_start_checkpoint(journal);
 	write_unlock(&journal->j_state_lock);
 
 	if (journal->j_commit_callback)
@@ -1329,6 +1329,10 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	journal->j_min_batch_time = 0;
 	journal->j_max_batch_time = 15000; /* 15ms */
 	atomic_set(&journal->j_reserved_credits, 0);
+	INIT_WORK(&journal->j_checkpoint_work, jbd2_checkpoint_workfn);
+	journal->j_credit_cache = alloc_percpu(struct jbd2_credit_cache);
+	if (!journal->j_credit_cache)
+		goto err_cleanup;
 
 	/* The journal is marked for error until we succeed with recovery! */
 	journal->j_flags = JBD2_ABORT;
@@ -1380,6 +1384,7 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	kfree(journal->j_wbuf);
 	kfree(journal->j_fc_wbuf);
 	jbd2_journal_destroy_revoke(journal);
+	free_percpu(journal->j_credit_cache);
 	kfree(journal);
 	return NULL;
 }
@@ -1532,6 +1537,10 @@ static int journal_reset(journal_t *journal)
 	journal->j_commit_request = journal->j_commit_sequence;
 
 	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
+	/* Credit caches of all CPUs hold at most a quarter of a transaction */
+	journal->j_credit_batch = min_t(int, JBD2_CREDIT_BATCH,
+			journal->j_max_transaction_buffers /
+			(8 * num_possible_cpus()));
 
 	/*
 	 * As a special case, if the on-disk copy is already marked as needing
@@ -1983,6 +1992,15 @@ int jbd2_journal_destroy(journal_t *journal)
 {
 	int err = 0;
 
+	/*
+	 * Stop background checkpointing first, it may have to wait for the
+	 * commit thread.
+	 */
+	write_lock(&journal->j_state_lock);
+	journal->j_flags |= JBD2_CKPT_STOPPED;
+	write_unlock(&journal->j_state_lock);
+	cancel_work_sync(&journal->j_checkpoint_work);
+
 	/* Wait for the commit thread to wake up and die. */
 	journal_kill_thread(journal);
 
@@ -2043,6 +2061,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_fc_wbufsize > 0)
 		kfree(journal->j_fc_wbuf);
 	kfree(journal->j_wbuf);
+	free_percpu(journal->j_credit_cache);
 	kfree(journal);
 
 	return err;
@@ -40,7 +40,8 @@ int __init jbd2_journal_init_transaction_cache(void)
 	transaction_cache = kmem_cache_create("jbd2_transaction_s",
 					sizeof(transaction_t),
 					0,
-					SLAB_HWCACHE_ALIGN|SLAB_TEMPORARY,
+					SLAB_HWCACHE_ALIGN|SLAB_TEMPORARY|
+					SLAB_TYPESAFE_BY_RCU,
 					NULL);
 	if (!transaction_cache) {
 		pr_emerg("JBD2: failed to create transaction cache\n");
@@ -216,6 +217,180 @@ static void sub_reserved_credits(journal_t *journal, int blocks)
 	wake_up(&journal->j_wait_reserved);
 }
 
+/*
+ * Take @blocks credits from this CPU's credit cache. Called with
+ * j_state_lock held for reading and the running transaction in T_RUNNING
+ * state. Returns true if the cache had enough credits.
+ */
+static bool get_cached_credits(journal_t *journal, int blocks)
+{
+	struct jbd2_credit_cache *cc;
+	bool ret = false;
+
+	cc = get_cpu_ptr(journal->j_credit_cache);
+	if (cc->cc_credits >= blocks) {
+		cc->cc_credits -= blocks;
+		ret = true;
+	}
+	put_cpu_ptr(journal->j_credit_cache);
+	return ret;
+}
+
+static void fill_cached_credits(journal_t *journal, int blocks)
+{
+	struct jbd2_credit_cache *cc;
+
+	cc = get_cpu_ptr(journal->j_credit_cache);
+	cc->cc_credits += blocks;
+	put_cpu_ptr(journal->j_credit_cache);
+}
+
+/*
+ * Return @blocks credits of a stopping handle to this CPU's credit cache.
+ * Anything above two batches goes back to the transaction so that idle CPUs
+ * don't sit on credits other CPUs could use. Returns false if the credits
+ * have to be returned to the transaction directly because it is no longer
+ * running.
+ */
+static bool put_cached_credits(journal_t *journal, transaction_t *t,
+			       int blocks)
+{
+	struct jbd2_credit_cache *cc;
+	int excess;
+
+	if (!journal->j_credit_batch)
+		return false;
+
+	cc = get_cpu_ptr(journal->j_credit_cache);
+	/*
+	 * The caches are drained only after the transaction is locked and
+	 * t_updates has dropped to zero. We still hold our update, so credits
+	 * added here are seen by the drain even if the commit has just locked
+	 * the transaction.
+	 */
+	if (READ_ONCE(t->t_state) != T_RUNNING) {
+		put_cpu_ptr(journal->j_credit_cache);
+		return false;
+	}
+	cc->cc_credits += blocks;
+	excess = cc->cc_credits - 2 * journal->j_credit_batch;
+	if (excess > 0) {
+		cc->cc_credits -= excess;
+		atomic_sub(excess, &t->t_outstanding_credits);
+	}
+	put_cpu_ptr(journal->j_credit_cache);
+	return true;
+}
+
+/**
+ * jbd2_journal_drain_credit_cache() - return cached credits to a transaction
+ * @journal: journal the transaction belongs to
+ * @transaction: transaction being committed
+ *
+ * Return the credits cached by all CPUs to @transaction and account the
+ * handles started from them. Called by the commit code with j_state_lock
+ * held for writing, after the transaction was locked and all its updates
+ * have finished, so nobody else can be using the caches.
+ */
+void jbd2_journal_drain_credit_cache(journal_t *journal,
+				     transaction_t *transaction)
+{
+	int credits = 0, handles = 0;
+	int cpu;
+
+	/* Pairs with the barriers dropping the update in stop_this_handle() */
+	smp_rmb();
+	for_each_possible_cpu(cpu) {
+		struct jbd2_credit_cache *cc;
+
+		cc = per_cpu_ptr(journal->j_credit_cache, cpu);
+		credits += cc->cc_credits;
+		handles += cc->cc_handles;
+		cc->cc_credits = 0;
+		cc->cc_handles = 0;
+	}
+	atomic_sub(credits, &transaction->t_outstanding_credits);
+	atomic_add(handles, &transaction->t_handle_count);
+}
+
+/**
+ * jbd2_journal_updates() - count the handles running on a transaction
+ * @journal: journal the transaction belongs to
+ * @transaction: the running transaction
+ *
+ * Return the number of handles attached to @transaction, including those
+ * started from the credit caches.  The caller has already stopped new
+ * handles from using the caches, by moving @transaction out of T_RUNNING
+ * or by raising j_barrier_count, so a zero result is final.
+ */
+int jbd2_journal_updates(journal_t *journal, transaction_t *transaction)
+{
+	int updates = atomic_read(&transaction->t_updates);
+	int cpu;
+
+	/* Pairs with smp_mb() in start_cached_handle() */
+	smp_mb();
+	for_each_possible_cpu(cpu)
+		updates += READ_ONCE(per_cpu_ptr(journal->j_credit_cache,
+						 cpu)->cc_updates);
+	return updates;
+}
+
+/*
+ * Start @handle on the running transaction with credits from this CPU's
+ * credit cache, without taking j_state_lock or touching t_updates.  The
+ * handle is counted in cc_updates before the transaction state is checked,
+ * and the commit code checks cc_updates after locking the transaction, so
+ * either the commit waits for the handle or the handle sees the transaction
+ * locked and backs off.  Returns false if the slow path has to be taken.
+ */
+static bool start_cached_handle(journal_t *journal, handle_t *handle,
+				int blocks)
+{
+	transaction_t *transaction;
+	struct jbd2_credit_cache *cc;
+	bool ret = false;
+
+	if (!journal->j_credit_batch)
+		return false;
+
+	/* transaction_cache is SLAB_TYPESAFE_BY_RCU, see the checks below */
+	rcu_read_lock();
+	cc = get_cpu_ptr(journal->j_credit_cache);
+	if (cc->cc_credits < blocks)
+		goto out;
+
+	this_cpu_inc(journal->j_credit_cache->cc_updates);
+	/* Pairs with smp_mb() in jbd2_journal_updates() */
+	smp_mb();
+	transaction = READ_ONCE(journal->j_running_transaction);
+	/*
+	 * The transaction may have been freed and reused since we loaded the
+	 * pointer, so only trust its state if it is still the running one.
+	 */
+	if (!transaction || READ_ONCE(transaction->t_state) != T_RUNNING ||
+	    READ_ONCE(journal->j_running_transaction) != transaction ||
+	    READ_ONCE(journal->j_barrier_count) ||
+	    is_journal_aborted(journal) ||
+	    (journal->j_errno != 0 && !(journal->j_flags & JBD2_ACK_ERR))) {
+		this_cpu_dec(journal->j_credit_cache->cc_updates);
+		/* The commit may have seen our update and gone to sleep */
+		if (wq_has_sleeper(&journal->j_wait_updates))
+			wake_up(&journal->j_wait_updates);
+		goto out;
+	}
+
+	cc->cc_credits -= blocks;
+	cc->cc_handles++;
+	handle->h_transaction = transaction;
+	handle->h_cached = 1;
+	ret = true;
+out:
+	put_cpu_ptr(journal->j_credit_cache);
+	rcu_read_unlock();
+	return ret;
+}
+
 /*
  * Wait until we can add credits for handle to the running transaction.  Called
  * with j_state_lock held for reading. Returns 0 if handle joined the running
@@ -226,8 +401,9 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 				   int rsv_blocks)
 {
 	transaction_t *t = journal->j_running_transaction;
-	int needed;
+	int needed = 0;
 	int total = blocks + rsv_blocks;
+	int batch = 0;
 
 	/*
 	 * If the current transaction is locked down for commit, wait
@@ -243,8 +419,21 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 	 * If there is not enough space left in the log to write all
 	 * potential buffers requested by this operation, we need to
 	 * stall pending a log checkpoint to free some more log space.
+	 *
+	 * Credits come from this CPU's credit cache if it has enough of
+	 * them. Otherwise we take them from the transaction, together with
+	 * a batch to refill the cache as long as the transaction has room.
 	 */
-	needed = atomic_add_return(total, &t->t_outstanding_credits);
+	if (!get_cached_credits(journal, total)) {
+		batch = journal->j_credit_batch;
+		needed = atomic_add_return(total + batch,
+					   &t->t_outstanding_credits);
+		if (batch && needed > journal->j_max_transaction_buffers) {
+			atomic_sub(batch, &t->t_outstanding_credits);
+			needed -= batch;
+			batch = 0;
+		}
+	}
 	if (needed > journal->j_max_transaction_buffers) {
 		/*
 		 * If the current transaction is already too large,
@@ -283,7 +472,7 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 	 * in the new transaction.
 	 */
 	if (jbd2_log_space_left(journal) < journal->j_max_transaction_buffers) {
-		atomic_sub(total, &t->t_outstanding_credits);
+		atomic_sub(total + batch, &t->t_outstanding_credits);
 		read_unlock(&journal->j_state_lock);
 		jbd2_might_wait_for_commit(journal);
 		write_lock(&journal->j_state_lock);
@@ -294,22 +483,24 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 		return 1;
 	}
 
-	/* No reservation? We are done... */
-	if (!rsv_blocks)
-		return 0;
-
-	needed = atomic_add_return(rsv_blocks, &journal->j_reserved_credits);
-	/* We allow at most half of a transaction to be reserved */
-	if (needed > journal->j_max_transaction_buffers / 2) {
-		sub_reserved_credits(journal, rsv_blocks);
-		atomic_sub(total, &t->t_outstanding_credits);
-		read_unlock(&journal->j_state_lock);
-		jbd2_might_wait_for_commit(journal);
-		wait_event(journal->j_wait_reserved,
-			 atomic_read(&journal->j_reserved_credits) + rsv_blocks
-			 <= journal->j_max_transaction_buffers / 2);
-		return 1;
+	if (rsv_blocks) {
+		needed = atomic_add_return(rsv_blocks,
+					   &journal->j_reserved_credits);
+		/* We allow at most half of a transaction to be reserved */
+		if (needed > journal->j_max_transaction_buffers / 2) {
+			sub_reserved_credits(journal, rsv_blocks);
+			atomic_sub(total + batch, &t->t_outstanding_credits);
+			read_unlock(&journal->j_state_lock);
+			jbd2_might_wait_for_commit(journal);
+			wait_event(journal->j_wait_reserved,
+				 atomic_read(&journal->j_reserved_credits) + rsv_blocks
+				 <= journal->j_max_transaction_buffers / 2);
+			return 1;
+		}
 	}
+
+	if (batch)
+		fill_cached_credits(journal, batch);
 	return 0;
 }
 
@@ -346,6 +537,19 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 		return -ENOSPC;
 	}
 
+	handle->h_cached = 0;
+	if (!handle->h_reserved && !rsv_blocks &&
+	    start_cached_handle(journal, handle, blocks)) {
+		transaction = handle->h_transaction;
+		update_t_max_wait(transaction, ts);
+		handle->h_requested_credits = blocks;
+		handle->h_revoke_credits_requested = handle->h_revoke_credits;
+		handle->h_start_jiffies = jiffies;
+		jbd_debug(4, "Handle %p given %d cached credits\n",
+			  handle, blocks);
+		goto started;
+	}
+
 alloc_transaction:
 	if (!journal->j_running_transaction) {
 		/*
@@ -433,12 +637,17 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 	handle->h_revoke_credits_requested = handle->h_revoke_credits;
 	handle->h_start_jiffies = jiffies;
 	atomic_inc(&transaction->t_updates);
-	atomic_inc(&transaction->t_handle_count);
+	/* Running transactions count their handles in the credit caches */
+	if (transaction->t_state == T_RUNNING)
+		this_cpu_inc(journal->j_credit_cache->cc_handles);
+	else
+		atomic_inc(&transaction->t_handle_count);
 	jbd_debug(4, "Handle %p given %d credits (total %d, free %lu)\n",
 		  handle, blocks,
 		  atomic_read(&transaction->t_outstanding_credits),
 		  jbd2_log_space_left(journal));
 	read_unlock(&journal->j_state_lock);
+started:
 	current->journal_info = handle;
 
 	rwsem_acquire_read(&journal->j_trans_commit_map, 0, 0, _THIS_IP_);
@@ -704,7 +913,8 @@ static void stop_this_handle(handle_t *handle)
 	int revokes;
 
 	J_ASSERT(journal_current_handle() == handle);
-	J_ASSERT(atomic_read(&transaction->t_updates) > 0);
+	J_ASSERT(handle->h_cached ||
+		 atomic_read(&transaction->t_updates) > 0);
 	current->journal_info = NULL;
 	/*
 	 * Subtract necessary revoke descriptor blocks from handle credits. We
@@ -726,12 +936,20 @@ static void stop_this_handle(handle_t *handle)
 			DIV_ROUND_UP(t_revokes - revokes, rr_per_blk);
 		handle->h_total_credits -= revoke_descriptors;
 	}
-	atomic_sub(handle->h_total_credits,
-		   &transaction->t_outstanding_credits);
+	if (!put_cached_credits(journal, transaction, handle->h_total_credits))
+		atomic_sub(handle->h_total_credits,
+			   &transaction->t_outstanding_credits);
 	if (handle->h_rsv_handle)
 		__jbd2_journal_unreserve_handle(handle->h_rsv_handle,
 						transaction);
-	if (atomic_dec_and_test(&transaction->t_updates))
+	if (handle->h_cached) {
+		/* Our credit cache updates must be visible to the drain */
+		smp_mb();
+		this_cpu_dec(journal->j_credit_cache->cc_updates);
+		if (wq_has_sleeper(&journal->j_wait_updates))
+			wake_up(&journal->j_wait_updates);
+		handle->h_cached = 0;
+	} else if (atomic_dec_and_test(&transaction->t_updates))
 		wake_up(&journal->j_wait_updates);
 
 	rwsem_release(&journal->j_trans_commit_map, _THIS_IP_);
@@ -849,7 +1067,7 @@ void jbd2_journal_lock_updates(journal_t *journal)
 		spin_lock(&transaction->t_handle_lock);
 		prepare_to_wait(&journal->j_wait_updates, &wait,
 				TASK_UNINTERRUPTIBLE);
-		if (!atomic_read(&transaction->t_updates)) {
+		if (!jbd2_journal_updates(journal, transaction)) {
 			spin_unlock(&transaction->t_handle_lock);
 			finish_wait(&journal->j_wait_updates, &wait);
 			break;
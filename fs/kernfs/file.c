@@ -14,6 +14,7 @@
 #include <linux/pagemap.h>
 #include <linux/sched/mm.h>
 #include <linux/fsnotify.h>
+#include <linux/hash.h>
 
 #include "kernfs-internal.h"
 
@@ -22,14 +23,43 @@
  * for each kernfs_node with one or more open files.
  *
  * kernfs_node->attr.open points to kernfs_open_node.  attr.open is
- * protected by kernfs_open_node_lock.
+ * protected by the spinlock returned by kernfs_open_node_lock(kn).
  *
  * filp->private_data points to seq_file whose ->private points to
  * kernfs_open_file.  kernfs_open_files are chained at
- * kernfs_open_node->files, which is protected by kernfs_open_file_mutex.
+ * kernfs_open_node->files, which is protected by the mutex returned by
+ * kernfs_open_file_mutex(kn).
+ *
+ * Both locks are picked from small arrays hashed by the node address, so
+ * opens and releases of different nodes rarely contend.  The hierarchy
+ * itself is protected by the kernfs_rwsem of the node's kernfs_root, which
+ * kernfs_notify_workfn() only takes for reading.
  */
-static DEFINE_SPINLOCK(kernfs_open_node_lock);
-static DEFINE_MUTEX(kernfs_open_file_mutex);
+#define KERNFS_OPEN_LOCK_BITS	6
+#define KERNFS_OPEN_LOCKS	(1 << KERNFS_OPEN_LOCK_BITS)
+
+static spinlock_t kernfs_open_node_locks[KERNFS_OPEN_LOCKS];
+static struct mutex kernfs_open_file_mutexes[KERNFS_OPEN_LOCKS];
+
+static spinlock_t *kernfs_open_node_lock(struct kernfs_node *kn)
+{
+	return &kernfs_open_node_locks[hash_ptr(kn, KERNFS_OPEN_LOCK_BITS)];
+}
+
+static struct mutex *kernfs_open_file_mutex(struct kernfs_node *kn)
+{
+	return &kernfs_open_file_mutexes[hash_ptr(kn, KERNFS_OPEN_LOCK_BITS)];
+}
+
+void __init kernfs_file_init(void)
+{
+	int i;
+
+	for (i = 0; i < KERNFS_OPEN_LOCKS; i++) {
+		spin_lock_init(&kernfs_open_node_locks[i]);
+		mutex_init(&kernfs_open_file_mutexes[i]);
+	}
+}
 
 struct kernfs_open_node {
 	atomic_t		refcnt;
@@ -543,10 +573,12 @@ static int kernfs_get_open_node(struct kernfs_node *kn,
 				struct kernfs_open_file *of)
 {
 	struct kernfs_open_node *on, *new_on = NULL;
+	struct mutex *mutex = kernfs_open_file_mutex(kn);
+	spinlock_t *lock = kernfs_open_node_lock(kn);
 
  retry:
-	mutex_lock(&kernfs_open_file_mutex);
-	spin_lock_irq(&kernfs_open_node_lock);
+	mutex_lock(mutex);
+	spin_lock_irq(lock);
 
 	if (!kn->attr.open && new_on) {
 		kn->attr.open = new_on;
@@ -559,8 +591,8 @@ static int kernfs_get_open_node(struct kernfs_node *kn,
 		list_add_tail(&of->list, &on->files);
 	}
 
-	spin_unlock_irq(&kernfs_open_node_lock);
-	mutex_unlock(&kernfs_open_file_mutex);
+	spin_unlock_irq(lock);
+	mutex_unlock(mutex);
 
 	if (on) {
 		kfree(new_on);
@@ -594,10 +626,12 @@ static void kernfs_put_open_node(struct kernfs_node *kn,
 				 struct kernfs_open_file *of)
 {
 	struct kernfs_open_node *on = kn->attr.open;
+	struct mutex *mutex = kernfs_open_file_mutex(kn);
+	spinlock_t *lock = kernfs_open_node_lock(kn);
 	unsigned long flags;
 
-	mutex_lock(&kernfs_open_file_mutex);
-	spin_lock_irqsave(&kernfs_open_node_lock, flags);
+	mutex_lock(mutex);
+	spin_lock_irqsave(lock, flags);
 
 	if (of)
 		list_del(&of->list);
@@ -607,8 +641,8 @@ static void kernfs_put_open_node(struct kernfs_node *kn,
 	else
 		on = NULL;
 
-	spin_unlock_irqrestore(&kernfs_open_node_lock, flags);
-	mutex_unlock(&kernfs_open_file_mutex);
+	spin_unlock_irqrestore(lock, flags);
+	mutex_unlock(mutex);
 
 	kfree(on);
 }
@@ -752,7 +786,7 @@ static void kernfs_release_file(struct kernfs_node *kn,
 	 * here because drain path may be called from places which can
 	 * cause circular dependency.
 	 */
-	lockdep_assert_held(&kernfs_open_file_mutex);
+	lockdep_assert_held(kernfs_open_file_mutex(kn));
 
 	if (!of->released) {
 		/*
@@ -771,9 +805,11 @@ static int kernfs_fop_release(struct inode *inode, struct file *filp)
 	struct kernfs_open_file *of = kernfs_of(filp);
 
 	if (kn->flags & KERNFS_HAS_RELEASE) {
-		mutex_lock(&kernfs_open_file_mutex);
+		struct mutex *mutex = kernfs_open_file_mutex(kn);
+
+		mutex_lock(mutex);
 		kernfs_release_file(kn, of);
-		mutex_unlock(&kernfs_open_file_mutex);
+		mutex_unlock(mutex);
 	}
 
 	kernfs_put_open_node(kn, of);
@@ -788,19 +824,23 @@ void kernfs_drain_open_files(struct kernfs_node *kn)
 {
 	struct kernfs_open_node *on;
 	struct kernfs_open_file *of;
+	struct mutex *mutex;
+	spinlock_t *lock;
 
 	if (!(kn->flags & (KERNFS_HAS_MMAP | KERNFS_HAS_RELEASE)))
 		return;
 
-	spin_lock_irq(&kernfs_open_node_lock);
+	lock = kernfs_open_node_lock(kn);
+	spin_lock_irq(lock);
 	on = kn->attr.open;
 	if (on)
 		atomic_inc(&on->refcnt);
-	spin_unlock_irq(&kernfs_open_node_lock);
+	spin_unlock_irq(lock);
 	if (!on)
 		return;
 
-	mutex_lock(&kernfs_open_file_mutex);
+	mutex = kernfs_open_file_mutex(kn);
+	mutex_lock(mutex);
 
 	list_for_each_entry(of, &on->files, list) {
 		struct inode *inode = file_inode(of->file);
@@ -812,7 +852,7 @@ void kernfs_drain_open_files(struct kernfs_node *kn)
 			kernfs_release_file(kn, of);
 	}
 
-	mutex_unlock(&kernfs_open_file_mutex);
+	mutex_unlock(mutex);
 
 	kernfs_put_open_node(kn, NULL);
 }
@@ -866,6 +906,7 @@ static void kernfs_notify_workfn(struct work_struct *work)
 {
 	struct kernfs_node *kn;
 	struct kernfs_super_info *info;
+	struct kernfs_root *root;
 repeat:
 	/* pop one off the notify_list */
 	spin_lock_irq(&kernfs_notify_lock);
@@ -879,9 +920,10 @@ static void kernfs_notify_workfn(struct work_struct *work)
 	spin_unlock_irq(&kernfs_notify_lock);
 
 	/* kick fsnotify */
-	mutex_lock(&kernfs_mutex);
+	root = kernfs_root(kn);
+	down_read(&root->kernfs_rwsem);
 
-	list_for_each_entry(info, &kernfs_root(kn)->supers, node) {
+	list_for_each_entry(info, &root->supers, node) {
 		struct kernfs_node *parent;
 		struct inode *p_inode = NULL;
 		struct inode *inode;
@@ -917,7 +959,7 @@ static void kernfs_notify_workfn(struct work_struct *work)
 		iput(inode);
 	}
 
-	mutex_unlock(&kernfs_mutex);
+	up_read(&root->kernfs_rwsem);
 	kernfs_put(kn);
 	goto repeat;
 }
@@ -934,18 +976,20 @@ void kernfs_notify(struct kernfs_node *kn)
 	static DECLARE_WORK(kernfs_notify_work, kernfs_notify_workfn);
 	unsigned long flags;
 	struct kernfs_open_node *on;
+	spinlock_t *lock;
 
 	if (WARN_ON(kernfs_type(kn) != KERNFS_FILE))
 		return;
 
 	/* kick poll immediately */
-	spin_lock_irqsave(&kernfs_open_node_lock, flags);
+	lock = kernfs_open_node_lock(kn);
+	spin_lock_irqsave(lock, flags);
 	on = kn->attr.open;
 	if (on) {
 		atomic_inc(&on->event);
 		wake_up_interruptible(&on->poll);
 	}
-	spin_unlock_irqrestore(&kernfs_open_node_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
 
 	/* schedule work to kick fsnotify */
 	spin_lock_irqsave(&kernfs_notify_lock, flags);
@@ -160,6 +160,7 @@ static struct nlm_host *nlm_alloc_host(struct nlm_lookup_host_info *ni,
 	spin_lock_init(&host->h_lock);
 	INIT_LIST_HEAD(&host->h_granted);
 	INIT_LIST_HEAD(&host->h_reclaim);
+	INIT_LIST_HEAD(&host->h_files);
 	host->h_nsmhandle  = nsm;
 	host->h_addrbuf    = nsm->sm_addrbuf;
 	host->net	   = ni->net;
@@ -182,6 +183,7 @@ static void nlm_destroy_host_locked(struct nlm_host *host)
 
 	dprintk("lockd: destroy host %s\n", host->h_name);
 
+	WARN_ON_ONCE(!list_empty(&host->h_files));
 	hlist_del_init(&host->h_hash);
 
 	nsm_unmonitor(host);
@@ -680,8 +682,10 @@ nlm_gc_hosts(struct net *net)
 				host->net->ns.inum);
 			continue;
 		}
-		if (refcount_dec_if_one(&host->h_count))
+		if (refcount_dec_if_one(&host->h_count)) {
+			nlmsvc_forget_host_files(host);
 			nlm_destroy_host_locked(host);
+		}
 	}
 
 	if (net) {
@@ -736,6 +736,10 @@ static int __init init_nlm(void)
 	if (err)
 		goto err_pernet;
 
+	err = nlm_files_init();
+	if (err)
+		goto err_files;
+
 	err = lockd_create_procfs();
 	if (err)
 		goto err_procfs;
@@ -743,6 +747,8 @@ static int __init init_nlm(void)
 	return 0;
 
 err_procfs:
+	nlm_files_exit();
+err_files:
 	unregister_pernet_subsys(&lockd_net_ops);
 err_pernet:
 #ifdef CONFIG_SYSCTL
@@ -757,6 +763,7 @@ static void __exit exit_nlm(void)
 	/* FIXME: delete all NLM clients */
 	nlm_shutdown_hosts();
 	lockd_remove_procfs();
+	nlm_files_exit();
 	unregister_pernet_subsys(&lockd_net_ops);
 #ifdef CONFIG_SYSCTL
 	unregister_sysctl_table(nlm_sysctl_table);
@@ -19,19 +19,64 @@
 #include <linux/lockd/share.h>
 #include <linux/module.h>
 #include <linux/mount.h>
+#include <linux/jhash.h>
+#include <linux/rhashtable.h>
 #include <uapi/linux/nfs2.h>
 
 #define NLMDBG_FACILITY		NLMDBG_SVCSUBS
 
 
 /*
- * Global file hash table
+ * Global file table. Files are looked up by file handle in nlm_file_table,
+ * and walked in order on nlm_file_list.
  */
-#define FILE_HASH_BITS		7
-#define FILE_NRHASH		(1<<FILE_HASH_BITS)
-static struct hlist_head	nlm_files[FILE_NRHASH];
+static struct rhashtable	nlm_file_table;
+static LIST_HEAD(nlm_file_list);
 static DEFINE_MUTEX(nlm_file_mutex);
 
+/*
+ * Every client using a file is linked to it, so that releasing the
+ * resources of a client only has to look at the files it used.
+ */
+struct nlm_host_file {
+	struct list_head	hf_host_list;	/* host->h_files */
+	struct list_head	hf_file_list;	/* file->f_hosts */
+	struct nlm_host		*hf_host;
+	struct nlm_file		*hf_file;
+};
+
+static u32 nlm_file_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct nfs_fh *fh = data;
+
+	return jhash(fh->data, fh->size, seed);
+}
+
+static u32 nlm_file_obj_hashfn(const void *data, u32 len, u32 seed)
+{
+	const struct nlm_file *file = data;
+
+	return nlm_file_hashfn(&file->f_handle, len, seed);
+}
+
+static int nlm_file_obj_cmpfn(struct rhashtable_compare_arg *arg,
+			      const void *obj)
+{
+	const struct nlm_file *file = obj;
+
+	return nfs_compare_fh(&file->f_handle, arg->key);
+}
+
+static const struct rhashtable_params nlm_file_params = {
+	.head_offset		= offsetof(struct nlm_file, f_rhash),
+	.key_offset		= offsetof(struct nlm_file, f_handle),
+	.key_len		= sizeof_field(struct nlm_file, f_handle),
+	.hashfn			= nlm_file_hashfn,
+	.obj_hashfn		= nlm_file_obj_hashfn,
+	.obj_cmpfn		= nlm_file_obj_cmpfn,
+	.automatic_shrinking	= true,
+};
+
 #ifdef CONFIG_SUNRPC_DEBUG
 static inline void nlm_debug_print_fh(char *msg, struct nfs_fh *f)
 {
@@ -62,13 +107,34 @@ static inline void nlm_debug_print_file(char *msg, struct nlm_file *file)
 }
 #endif
 
-static inline unsigned int file_hash(struct nfs_fh *f)
+/*
+ * Link @file to @host unless it already is, consuming the preallocated
+ * link in *@hfp. Called with nlm_file_mutex held.
+ */
+static void
+nlm_file_add_host(struct nlm_file *file, struct nlm_host *host,
+		  struct nlm_host_file **hfp)
+{
+	struct nlm_host_file *hf;
+
+	list_for_each_entry(hf, &file->f_hosts, hf_file_list)
+		if (hf->hf_host == host)
+			return;
+
+	hf = *hfp;
+	*hfp = NULL;
+	hf->hf_host = host;
+	hf->hf_file = file;
+	list_add(&hf->hf_host_list, &host->h_files);
+	list_add(&hf->hf_file_list, &file->f_hosts);
+}
+
+static void
+nlm_host_file_unlink(struct nlm_host_file *hf)
 {
-	unsigned int tmp=0;
-	int i;
-	for (i=0; i<NFS2_FHSIZE;i++)
-		tmp += f->data[i];
-	return tmp & (FILE_NRHASH - 1);
+	list_del(&hf->hf_host_list);
+	list_del(&hf->hf_file_list);
+	kfree(hf);
 }
 
 /*
@@ -82,22 +148,25 @@ static inline unsigned int file_hash(struct nfs_fh *f)
  */
 __be32
 nlm_lookup_file(struct svc_rqst *rqstp, struct nlm_file **result,
-					struct nfs_fh *f)
+		struct nlm_host *host, struct nfs_fh *f)
 {
+	struct nlm_host_file *hf;
 	struct nlm_file	*file;
-	unsigned int	hash;
 	__be32		nfserr;
 
 	nlm_debug_print_fh("nlm_lookup_file", f);
 
-	hash = file_hash(f);
+	/* Allocated up front so that linking the file to the host can't fail */
+	hf = kmalloc(sizeof(*hf), GFP_KERNEL);
+	if (!hf)
+		return nlm_lck_denied_nolocks;
 
 	/* Lock file table */
 	mutex_lock(&nlm_file_mutex);
 
-	hlist_for_each_entry(file, &nlm_files[hash], f_list)
-		if (!nfs_compare_fh(&file->f_handle, f))
-			goto found;
+	file = rhashtable_lookup_fast(&nlm_file_table, f, nlm_file_params);
+	if (file)
+		goto found;
 
 	nlm_debug_print_fh("creating file for", f);
 
@@ -108,7 +177,8 @@ nlm_lookup_file(struct svc_rqst *rqstp, struct nlm_file **result,
 
 	memcpy(&file->f_handle, f, sizeof(struct nfs_fh));
 	mutex_init(&file->f_mutex);
-	INIT_HLIST_NODE(&file->f_list);
+	INIT_LIST_HEAD(&file->f_list);
+	INIT_LIST_HEAD(&file->f_hosts);
 	INIT_LIST_HEAD(&file->f_blocks);
 
 	/* Open the file. Note that this must not sleep for too long, else
@@ -122,18 +192,26 @@ nlm_lookup_file(struct svc_rqst *rqstp, struct nlm_file **result,
 		goto out_free;
 	}
 
-	hlist_add_head(&file->f_list, &nlm_files[hash]);
+	nfserr = nlm_lck_denied_nolocks;
+	if (rhashtable_insert_fast(&nlm_file_table, &file->f_rhash,
+				   nlm_file_params))
+		goto out_close;
+	list_add(&file->f_list, &nlm_file_list);
 
 found:
 	dprintk("lockd: found file %p (count %d)\n", file, file->f_count);
+	nlm_file_add_host(file, host, &hf);
 	*result = file;
 	file->f_count++;
 	nfserr = 0;
 
 out_unlock:
 	mutex_unlock(&nlm_file_mutex);
+	kfree(hf);
 	return nfserr;
 
+out_close:
+	nlmsvc_ops->fclose(file->f_file);
 out_free:
 	kfree(file);
 	goto out_unlock;
@@ -145,9 +223,15 @@ nlm_lookup_file(struct svc_rqst *rqstp, struct nlm_file **result,
 static inline void
 nlm_delete_file(struct nlm_file *file)
 {
+	struct nlm_host_file *hf, *next;
+
 	nlm_debug_print_file("closing file", file);
-	if (!hlist_unhashed(&file->f_list)) {
-		hlist_del(&file->f_list);
+	if (!list_empty(&file->f_list)) {
+		rhashtable_remove_fast(&nlm_file_table, &file->f_rhash,
+				       nlm_file_params);
+		list_del(&file->f_list);
+		list_for_each_entry_safe(hf, next, &file->f_hosts, hf_file_list)
+			nlm_host_file_unlink(hf);
 		nlmsvc_ops->fclose(file->f_file);
 		kfree(file);
 	} else {
@@ -249,37 +333,79 @@ nlm_file_inuse(struct nlm_file *file)
 /*
  * Loop over all files in the file table.
  */
+static int
+nlm_traverse_file(void *data, struct nlm_file *file, nlm_host_match_fn_t match)
+{
+	int ret;
+
+	file->f_count++;
+	mutex_unlock(&nlm_file_mutex);
+
+	/* Traverse locks, blocks and shares of this file
+	 * and update file->f_locks count */
+	ret = nlm_inspect_file(data, file, match);
+
+	mutex_lock(&nlm_file_mutex);
+	file->f_count--;
+	return ret;
+}
+
+/*
+ * Let go of a file that was traversed once there are no more references
+ * to it. Called with nlm_file_mutex held.
+ */
+static void
+nlm_traverse_file_done(struct nlm_file *file)
+{
+	if (list_empty(&file->f_blocks) && !file->f_locks
+	 && !file->f_shares && !file->f_count)
+		nlm_delete_file(file);
+}
+
 static int
 nlm_traverse_files(void *data, nlm_host_match_fn_t match,
 		int (*is_failover_file)(void *data, struct nlm_file *file))
 {
-	struct hlist_node *next;
-	struct nlm_file	*file;
-	int i, ret = 0;
+	struct nlm_file	*file, *next;
+	int ret = 0;
 
 	mutex_lock(&nlm_file_mutex);
-	for (i = 0; i < FILE_NRHASH; i++) {
-		hlist_for_each_entry_safe(file, next, &nlm_files[i], f_list) {
-			if (is_failover_file && !is_failover_file(data, file))
-				continue;
-			file->f_count++;
-			mutex_unlock(&nlm_file_mutex);
-
-			/* Traverse locks, blocks and shares of this file
-			 * and update file->f_locks count */
-			if (nlm_inspect_file(data, file, match))
-				ret = 1;
-
-			mutex_lock(&nlm_file_mutex);
-			file->f_count--;
-			/* No more references to this file. Let go of it. */
-			if (list_empty(&file->f_blocks) && !file->f_locks
-			 && !file->f_shares && !file->f_count) {
-				hlist_del(&file->f_list);
-				nlmsvc_ops->fclose(file->f_file);
-				kfree(file);
-			}
+	file = list_first_entry(&nlm_file_list, struct nlm_file, f_list);
+	while (&file->f_list != &nlm_file_list) {
+		if (is_failover_file && !is_failover_file(data, file)) {
+			file = list_next_entry(file, f_list);
+			continue;
 		}
+		if (nlm_traverse_file(data, file, match))
+			ret = 1;
+		/* We held a reference, so our successor is still valid */
+		next = list_next_entry(file, f_list);
+		nlm_traverse_file_done(file);
+		file = next;
+	}
+	mutex_unlock(&nlm_file_mutex);
+	return ret;
+}
+
+/*
+ * Release the resources held by @host on the files it used.
+ */
+static int
+nlm_traverse_host_files(struct nlm_host *host, nlm_host_match_fn_t match)
+{
+	struct nlm_host_file *hf;
+	struct nlm_file	*file;
+	int ret = 0;
+
+	mutex_lock(&nlm_file_mutex);
+	while ((hf = list_first_entry_or_null(&host->h_files,
+					      struct nlm_host_file,
+					      hf_host_list))) {
+		file = hf->hf_file;
+		nlm_host_file_unlink(hf);
+		if (nlm_traverse_file(host, file, match))
+			ret = 1;
+		nlm_traverse_file_done(file);
 	}
 	mutex_unlock(&nlm_file_mutex);
 	return ret;
@@ -384,7 +510,7 @@ nlmsvc_free_host_resources(struct nlm_host *host)
 {
 	dprintk("lockd: nlmsvc_free_host_resources\n");
 
-	if (nlm_traverse_files(host, nlmsvc_same_host, NULL)) {
+	if (nlm_traverse_host_files(host, nlmsvc_same_host)) {
 		printk(KERN_WARNING
 			"lockd: couldn't remove all locks held by %s\n",
 			host->h_name);
@@ -392,6 +518,22 @@ nlmsvc_free_host_resources(struct nlm_host *host)
 	}
 }
 
+/*
+ * Drop the links of a host that is about to be destroyed to the files it
+ * used. The host holds nothing on these files any more, so the files stay
+ * until their last user releases them.
+ */
+void
+nlmsvc_forget_host_files(struct nlm_host *host)
+{
+	struct nlm_host_file *hf, *next;
+
+	mutex_lock(&nlm_file_mutex);
+	list_for_each_entry_safe(hf, next, &host->h_files, hf_host_list)
+		nlm_host_file_unlink(hf);
+	mutex_unlock(&nlm_file_mutex);
+}
+
 /**
  * nlmsvc_invalidate_all - remove all locks held for clients
  *
@@ -456,3 +598,15 @@ nlmsvc_unlock_all_by_ip(struct sockaddr *server_addr)
 	return ret ? -EIO : 0;
 }
 EXPORT_SYMBOL_GPL(nlmsvc_unlock_all_by_ip);
+
+int __init
+nlm_files_init(void)
+{
+	return rhashtable_init(&nlm_file_table, &nlm_file_params);
+}
+
+void
+nlm_files_exit(void)
+{
+	rhashtable_destroy(&nlm_file_table);
+}
@@ -29,8 +29,11 @@
 
 #define FF_LAYOUT_POLL_RETRY_MAX     (15*HZ)
 #define FF_LAYOUTRETURN_MAXERR 20
+/* Don't spread reads to mirrors this many times slower than the fastest */
+#define FF_LAYOUT_SLOW_MIRROR_FACTOR 2
 
 static unsigned short io_maxretrans;
+static bool spread_reads = true;
 
 static const struct pnfs_commit_ops ff_layout_commit_ops;
 static void ff_layout_read_record_layoutstats_done(struct rpc_task *task,
@@ -790,6 +793,84 @@ ff_layout_choose_best_ds_for_read(struct pnfs_layout_segment *lseg,
 	return ff_layout_choose_any_ds_for_read(lseg, start_idx, best_idx);
 }
 
+static bool
+ff_layout_mirror_usable_for_read(struct nfs4_ff_layout_mirror *mirror)
+{
+	struct nfs4_ff_layout_ds *mirror_ds = READ_ONCE(mirror->mirror_ds);
+
+	/* A mirror whose device wasn't looked up yet is worth a try */
+	if (!mirror_ds)
+		return true;
+	return !IS_ERR(mirror_ds) &&
+	       !nfs4_test_deviceid_unavailable(&mirror_ds->id_node);
+}
+
+/* Average completion time of reads from @mirror, 0 if none completed yet */
+static s64
+ff_layout_mirror_read_latency(struct nfs4_ff_layout_mirror *mirror)
+{
+	struct nfs4_ff_io_stat *iostat = &mirror->read_stat.io_stat;
+	s64 latency = 0;
+
+	spin_lock(&mirror->lock);
+	if (iostat->ops_completed)
+		latency = div64_u64(ktime_to_ns(iostat->aggregate_completion_time),
+				    iostat->ops_completed);
+	spin_unlock(&mirror->lock);
+	return latency;
+}
+
+/*
+ * Spread reads over the usable mirrors round-robin, so that large reads
+ * get the bandwidth of all of them. Mirrors whose average read latency
+ * (as recorded for layoutstats) is more than FF_LAYOUT_SLOW_MIRROR_FACTOR
+ * times that of the fastest one are left out, so that a distant or
+ * overloaded replica doesn't hold up the reads spread over the others.
+ */
+static struct nfs4_pnfs_ds *
+ff_layout_choose_spread_ds_for_read(struct pnfs_layout_segment *lseg,
+				    u32 *best_idx)
+{
+	struct nfs4_ff_layout_segment *fls = FF_LAYOUT_LSEG(lseg);
+	u32 cnt = fls->mirror_array_cnt;
+	struct nfs4_ff_layout_mirror *mirror;
+	struct nfs4_pnfs_ds *ds;
+	s64 fastest = S64_MAX;
+	s64 latency;
+	u32 start, idx, i;
+
+	if (!spread_reads || cnt < 2)
+		return NULL;
+
+	for (idx = 0; idx < cnt; idx++) {
+		mirror = FF_LAYOUT_COMP(lseg, idx);
+		if (!ff_layout_mirror_usable_for_read(mirror))
+			continue;
+		latency = ff_layout_mirror_read_latency(mirror);
+		if (latency && latency < fastest)
+			fastest = latency;
+	}
+
+	start = atomic_inc_return(&fls->next_read_mirror);
+	for (i = 0; i < cnt; i++) {
+		idx = (start + i) % cnt;
+		mirror = FF_LAYOUT_COMP(lseg, idx);
+		if (!ff_layout_mirror_usable_for_read(mirror))
+			continue;
+		if (fastest != S64_MAX &&
+		    ff_layout_mirror_read_latency(mirror) >
+				FF_LAYOUT_SLOW_MIRROR_FACTOR * fastest)
+			continue;
+		ds = nfs4_ff_layout_prepare_ds(lseg, mirror, false);
+		if (!ds)
+			continue;
+		*best_idx = idx;
+		return ds;
+	}
+
+	return NULL;
+}
+
 static struct nfs4_pnfs_ds *
 ff_layout_get_ds_for_read(struct nfs_pageio_descriptor *pgio,
 			  u32 *best_idx)
@@ -797,6 +878,15 @@ ff_layout_get_ds_for_read(struct nfs_pageio_descriptor *pgio,
 	struct pnfs_layout_segment *lseg = pgio->pg_lseg;
 	struct nfs4_pnfs_ds *ds;
 
+	/*
+	 * Resends from ff_layout_resend_pnfs_read() start at the mirror after
+	 * the one that failed, keep that failover order for them.
+	 */
+	if (!pgio->pg_resend) {
+		ds = ff_layout_choose_spread_ds_for_read(lseg, best_idx);
+		if (ds)
+			return ds;
+	}
 	ds = ff_layout_choose_best_ds_for_read(lseg, pgio->pg_mirror_idx,
 					       best_idx);
 	if (ds || !pgio->pg_mirror_idx)
@@ -864,8 +954,9 @@ ff_layout_pg_init_read(struct nfs_pageio_descriptor *pgio,
 		goto retry;
 	}
 
+	/* The read goes to a single mirror, size it for that one */
+	mirror = FF_LAYOUT_COMP(pgio->pg_lseg, ds_idx);
 	for (i = 0; i < pgio->pg_mirror_count; i++) {
-		mirror = FF_LAYOUT_COMP(pgio->pg_lseg, i);
 		pgm = &pgio->pg_mirrors[i];
 		pgm->pg_bsize = mirror->mirror_ds->ds_versions[0].rsize;
 	}
@@ -1036,6 +1127,29 @@ static void ff_layout_reset_write(struct nfs_pgio_header *hdr, bool retry_pnfs)
 	}
 }
 
+/*
+ * Same as pnfs_read_resend_pnfs(), but marks the descriptor as a resend so
+ * that ff_layout_get_ds_for_read() starts at @mirror_idx instead of
+ * spreading the read over the mirrors again.
+ */
+static void ff_layout_read_resend_pnfs(struct nfs_pgio_header *hdr,
+				       u32 mirror_idx)
+{
+	struct nfs_pageio_descriptor pgio;
+
+	if (!test_and_set_bit(NFS_IOHDR_REDO, &hdr->flags)) {
+		/* Prevent deadlocks with layoutreturn! */
+		pnfs_put_lseg(hdr->lseg);
+		hdr->lseg = NULL;
+
+		nfs_pageio_init_read(&pgio, hdr->inode, false,
+				     hdr->completion_ops);
+		pgio.pg_mirror_idx = mirror_idx;
+		pgio.pg_resend = 1;
+		hdr->task.tk_status = nfs_pageio_resend(&pgio, hdr);
+	}
+}
+
 static void ff_layout_resend_pnfs_read(struct nfs_pgio_header *hdr)
 {
 	u32 idx = hdr->pgio_mirror_idx + 1;
@@ -1045,7 +1159,7 @@ static void ff_layout_resend_pnfs_read(struct nfs_pgio_header *hdr)
 		ff_layout_send_layouterror(hdr->lseg);
 	else
 		pnfs_error_mark_layout_for_return(hdr->inode, hdr->lseg);
-	pnfs_read_resend_pnfs(hdr, new_idx);
+	ff_layout_read_resend_pnfs(hdr, new_idx);
 }
 
 static void ff_layout_reset_read(struct nfs_pgio_header *hdr)
@@ -2527,3 +2641,6 @@ module_exit(nfs4flexfilelayout_exit);
 module_param(io_maxretrans, ushort, 0644);
 MODULE_PARM_DESC(io_maxretrans, "The  number of times the NFSv4.1 client "
 			"retries an I/O request before returning an error. ");
+module_param(spread_reads, bool, 0644);
+MODULE_PARM_DESC(spread_reads, "Spread reads over all mirrors of a file "
+			"instead of reading from one mirror at a time.");
@@ -99,6 +99,7 @@ struct nfs4_ff_layout_segment {
 	u64				stripe_unit;
 	u32				flags;
 	u32				mirror_array_cnt;
+	atomic_t			next_read_mirror;
 	struct nfs4_ff_layout_mirror	*mirror_array[];
 };
 
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0
 #include <linux/fanotify.h>
 #include <linux/fdtable.h>
+#include <linux/hash.h>
 #include <linux/fsnotify_backend.h>
 #include <linux/init.h>
 #include <linux/jiffies.h>
@@ -129,14 +130,15 @@ static bool fanotify_should_merge(struct fsnotify_event *old_fsn,
 	return false;
 }
 
-/* and the list better be locked by something too! */
-static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
+/* Called with notification_lock held */
+static int fanotify_merge(struct fsnotify_group *group,
+			  struct fsnotify_event *event)
 {
-	struct fsnotify_event *test_event;
-	struct fanotify_event *new;
+	struct fanotify_event *old, *new = FANOTIFY_E(event);
+	struct hlist_head *hlist;
+	int i = 0;
 
-	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
-	new = FANOTIFY_E(event);
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
 	/*
 	 * Don't merge a permission event with any other event so that we know
@@ -146,9 +148,13 @@ static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
 	if (fanotify_is_perm_event(new->mask))
 		return 0;
 
-	list_for_each_entry_reverse(test_event, list, list) {
-		if (fanotify_should_merge(test_event, event)) {
-			FANOTIFY_E(test_event)->mask |= new->mask;
+	/* Newest events are at the head of the chain */
+	hlist = fanotify_event_hash_bucket(group, new);
+	hlist_for_each_entry(old, hlist, merge_list) {
+		if (++i > FANOTIFY_MAX_MERGE_EVENTS)
+			break;
+		if (fanotify_should_merge(&old->fse, event)) {
+			old->mask |= new->mask;
 			return 1;
 		}
 	}
@@ -156,6 +162,21 @@ static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
 	return 0;
 }
 
+/* Called with notification_lock held after the event has been queued */
+static void fanotify_insert_event(struct fsnotify_group *group,
+				  struct fsnotify_event *fsn_event)
+{
+	struct fanotify_event *event = FANOTIFY_E(fsn_event);
+
+	assert_spin_locked(&group->notification_lock);
+
+	if (!fanotify_is_hashed_event(event->mask))
+		return;
+
+	hlist_add_head(&event->merge_list,
+		       fanotify_event_hash_bucket(group, event));
+}
+
 /*
  * Wait for response to permission event. The function also takes care of
  * freeing the permission event (or offloads that in case the wait is canceled
@@ -425,17 +446,75 @@ static struct inode *fanotify_dfid_inode(u32 event_mask, const void *data,
 	return dir;
 }
 
-static struct fanotify_event *fanotify_alloc_path_event(const struct path *path,
-							gfp_t gfp)
+/*
+ * Freed events of the fixed size type a group allocates (path events, or fid
+ * events for groups reporting fids) are kept on a per-group pool instead of
+ * going back to the slab, so a busy group doesn't pay for an allocation and a
+ * memcg charge on every event.  The pool grows with the number of events the
+ * group had in flight, up to max_cached_events, and is freed with the group.
+ */
+static enum fanotify_event_type fanotify_pool_type(struct fsnotify_group *group)
+{
+	if (FAN_GROUP_FLAG(group, FANOTIFY_FID_BITS))
+		return FANOTIFY_EVENT_TYPE_FID;
+
+	return FANOTIFY_EVENT_TYPE_PATH;
+}
+
+static struct fanotify_event *fanotify_pool_get(struct fsnotify_group *group)
 {
+	struct fanotify_event *event = NULL;
+
+	spin_lock(&group->fanotify_data.event_pool_lock);
+	if (!list_empty(&group->fanotify_data.event_pool)) {
+		event = list_first_entry(&group->fanotify_data.event_pool,
+					 struct fanotify_event, fse.list);
+		list_del(&event->fse.list);
+		group->fanotify_data.event_pool_len--;
+	}
+	spin_unlock(&group->fanotify_data.event_pool_lock);
+
+	return event;
+}
+
+static bool fanotify_pool_put(struct fsnotify_group *group,
+			      struct fanotify_event *event)
+{
+	bool pooled = false;
+
+	if (event->type != fanotify_pool_type(group))
+		return false;
+
+	spin_lock(&group->fanotify_data.event_pool_lock);
+	if (group->fanotify_data.event_pool_len <
+	    group->fanotify_data.max_cached_events) {
+		list_add(&event->fse.list, &group->fanotify_data.event_pool);
+		group->fanotify_data.event_pool_len++;
+		pooled = true;
+	}
+	spin_unlock(&group->fanotify_data.event_pool_lock);
+
+	return pooled;
+}
+
+static struct fanotify_event *fanotify_alloc_path_event(
+						struct fsnotify_group *group,
+						const struct path *path,
+						gfp_t gfp)
+{
+	struct fanotify_event *event = fanotify_pool_get(group);
 	struct fanotify_path_event *pevent;
 
-	pevent = kmem_cache_alloc(fanotify_path_event_cachep, gfp);
+	if (event)
+		pevent = FANOTIFY_PE(event);
+	else
+		pevent = kmem_cache_alloc(fanotify_path_event_cachep, gfp);
 	if (!pevent)
 		return NULL;
 
 	pevent->fae.type = FANOTIFY_EVENT_TYPE_PATH;
 	pevent->path = *path;
+	pevent->fd = FAN_NOFD;
 	path_get(path);
 
 	return &pevent->fae;
@@ -459,13 +538,19 @@ static struct fanotify_event *fanotify_alloc_perm_event(const struct path *path,
 	return &pevent->fae;
 }
 
-static struct fanotify_event *fanotify_alloc_fid_event(struct inode *id,
-						       __kernel_fsid_t *fsid,
-						       gfp_t gfp)
+static struct fanotify_event *fanotify_alloc_fid_event(
+						struct fsnotify_group *group,
+						struct inode *id,
+						__kernel_fsid_t *fsid,
+						gfp_t gfp)
 {
+	struct fanotify_event *event = fanotify_pool_get(group);
 	struct fanotify_fid_event *ffe;
 
-	ffe = kmem_cache_alloc(fanotify_fid_event_cachep, gfp);
+	if (event)
+		ffe = FANOTIFY_FE(event);
+	else
+		ffe = kmem_cache_alloc(fanotify_fid_event_cachep, gfp);
 	if (!ffe)
 		return NULL;
 
@@ -589,9 +674,9 @@ static struct fanotify_event *fanotify_alloc_event(struct fsnotify_group *group,
 		event = fanotify_alloc_name_event(id, fsid, file_name, child,
 						  gfp);
 	} else if (fid_mode) {
-		event = fanotify_alloc_fid_event(id, fsid, gfp);
+		event = fanotify_alloc_fid_event(group, id, fsid, gfp);
 	} else {
-		event = fanotify_alloc_path_event(path, gfp);
+		event = fanotify_alloc_path_event(group, path, gfp);
 	}
 
 	if (!event)
@@ -608,6 +693,9 @@ static struct fanotify_event *fanotify_alloc_event(struct fsnotify_group *group,
 	else
 		event->pid = get_pid(task_tgid(current));
 
+	event->hash = hash_long((unsigned long)id ^ (unsigned long)event->pid ^
+				event->type, 32);
+
 out:
 	set_active_memcg(old_memcg);
 	return event;
@@ -716,7 +804,8 @@ static int fanotify_handle_event(struct fsnotify_group *group, u32 mask,
 	}
 
 	fsn_event = &event->fse;
-	ret = fsnotify_add_event(group, fsn_event, fanotify_merge);
+	ret = fsnotify_add_event(group, fsn_event, fanotify_merge,
+				 fanotify_insert_event);
 	if (ret) {
 		/* Permission events shouldn't be merged */
 		BUG_ON(ret == 1 && mask & FANOTIFY_PERM_EVENTS);
@@ -737,17 +826,32 @@ static int fanotify_handle_event(struct fsnotify_group *group, u32 mask,
 
 static void fanotify_free_group_priv(struct fsnotify_group *group)
 {
+	struct fanotify_event *event, *next;
 	struct user_struct *user;
 
+	list_for_each_entry_safe(event, next, &group->fanotify_data.event_pool,
+				 fse.list) {
+		if (event->type == FANOTIFY_EVENT_TYPE_FID)
+			kmem_cache_free(fanotify_fid_event_cachep,
+					FANOTIFY_FE(event));
+		else
+			kmem_cache_free(fanotify_path_event_cachep,
+					FANOTIFY_PE(event));
+	}
+
+	idr_destroy(&group->fanotify_data.deferred_idr);
+	kfree(group->fanotify_data.merge_hash);
 	user = group->fanotify_data.user;
 	atomic_dec(&user->fanotify_listeners);
 	free_uid(user);
 }
 
-static void fanotify_free_path_event(struct fanotify_event *event)
+static void fanotify_free_path_event(struct fsnotify_group *group,
+				     struct fanotify_event *event)
 {
 	path_put(fanotify_event_path(event));
-	kmem_cache_free(fanotify_path_event_cachep, FANOTIFY_PE(event));
+	if (!fanotify_pool_put(group, event))
+		kmem_cache_free(fanotify_path_event_cachep, FANOTIFY_PE(event));
 }
 
 static void fanotify_free_perm_event(struct fanotify_event *event)
@@ -756,13 +860,15 @@ static void fanotify_free_perm_event(struct fanotify_event *event)
 	kmem_cache_free(fanotify_perm_event_cachep, FANOTIFY_PERM(event));
 }
 
-static void fanotify_free_fid_event(struct fanotify_event *event)
+static void fanotify_free_fid_event(struct fsnotify_group *group,
+				    struct fanotify_event *event)
 {
 	struct fanotify_fid_event *ffe = FANOTIFY_FE(event);
 
 	if (fanotify_fh_has_ext_buf(&ffe->object_fh))
 		kfree(fanotify_fh_ext_buf(&ffe->object_fh));
-	kmem_cache_free(fanotify_fid_event_cachep, ffe);
+	if (!fanotify_pool_put(group, event))
+		kmem_cache_free(fanotify_fid_event_cachep, ffe);
 }
 
 static void fanotify_free_name_event(struct fanotify_event *event)
@@ -770,7 +876,8 @@ static void fanotify_free_name_event(struct fanotify_event *event)
 	kfree(FANOTIFY_NE(event));
 }
 
-static void fanotify_free_event(struct fsnotify_event *fsn_event)
+static void fanotify_free_event(struct fsnotify_group *group,
+			       struct fsnotify_event *fsn_event)
 {
 	struct fanotify_event *event;
 
@@ -778,13 +885,13 @@ static void fanotify_free_event(struct fsnotify_event *fsn_event)
 	put_pid(event->pid);
 	switch (event->type) {
 	case FANOTIFY_EVENT_TYPE_PATH:
-		fanotify_free_path_event(event);
+		fanotify_free_path_event(group, event);
 		break;
 	case FANOTIFY_EVENT_TYPE_PATH_PERM:
 		fanotify_free_perm_event(event);
 		break;
 	case FANOTIFY_EVENT_TYPE_FID:
-		fanotify_free_fid_event(event);
+		fanotify_free_fid_event(group, event);
 		break;
 	case FANOTIFY_EVENT_TYPE_FID_NAME:
 		fanotify_free_name_event(event);
@@ -139,8 +139,10 @@ enum fanotify_event_type {
 
 struct fanotify_event {
 	struct fsnotify_event fse;
+	struct hlist_node merge_list;	/* in fanotify_data.merge_hash */
 	u32 mask;
 	enum fanotify_event_type type;
+	unsigned int hash;	/* of objectid, type and pid */
 	struct pid *pid;
 };
 
@@ -148,7 +150,9 @@ static inline void fanotify_init_event(struct fanotify_event *event,
 				       unsigned long id, u32 mask)
 {
 	fsnotify_init_event(&event->fse, id);
+	INIT_HLIST_NODE(&event->merge_list);
 	event->mask = mask;
+	event->hash = 0;
 	event->pid = NULL;
 }
 
@@ -229,6 +233,7 @@ static inline int fanotify_event_dir_fh_len(struct fanotify_event *event)
 struct fanotify_path_event {
 	struct fanotify_event fae;
 	struct path path;
+	int fd;		/* FAN_DEFER_FD token we passed to userspace */
 };
 
 static inline struct fanotify_path_event *
@@ -269,6 +274,30 @@ static inline struct fanotify_event *FANOTIFY_E(struct fsnotify_event *fse)
 	return container_of(fse, struct fanotify_event, fse);
 }
 
+/*
+ * Queued events which may be merged are also hashed by their merge identity,
+ * so fanotify_merge() does not have to walk the whole notification queue.
+ * The number of merge candidates examined per event is capped so that a long
+ * hash chain cannot make queueing expensive either.
+ */
+#define FANOTIFY_HTABLE_BITS		7
+#define FANOTIFY_HTABLE_SIZE		(1 << FANOTIFY_HTABLE_BITS)
+#define FANOTIFY_HTABLE_MASK		(FANOTIFY_HTABLE_SIZE - 1)
+#define FANOTIFY_MAX_MERGE_EVENTS	128
+
+static inline bool fanotify_is_hashed_event(u32 mask)
+{
+	return !fanotify_is_perm_event(mask) && !(mask & FS_Q_OVERFLOW);
+}
+
+static inline struct hlist_head *
+fanotify_event_hash_bucket(struct fsnotify_group *group,
+			   struct fanotify_event *event)
+{
+	return &group->fanotify_data.merge_hash[event->hash &
+						FANOTIFY_HTABLE_MASK];
+}
+
 static inline bool fanotify_event_has_path(struct fanotify_event *event)
 {
 	return event->type == FANOTIFY_EVENT_TYPE_PATH ||
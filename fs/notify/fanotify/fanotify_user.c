@@ -30,6 +30,16 @@
 #define FANOTIFY_DEFAULT_MAX_MARKS	8192
 #define FANOTIFY_DEFAULT_MAX_LISTENERS	128
 
+/* Max events dequeued by read() under one hold of the notification lock */
+#define FANOTIFY_READ_BATCH		32
+
+/*
+ * Max read events kept for FAN_IOC_OPEN_FD.  Each one pins a dentry and a
+ * mount, so keep it small enough not to hold much memory or keep unmount
+ * failing for long.
+ */
+#define FANOTIFY_MAX_DEFERRED_FDS	128
+
 /*
  * All flags that may be specified in parameter event_f_flags of fanotify_init.
  *
@@ -90,41 +100,189 @@ static int fanotify_event_info_len(unsigned int fid_mode,
 }
 
 /*
- * Get an fanotify notification event if one exists and is small
- * enough to fit in "count". Return an error pointer if the count
- * is not large enough. When permission event is dequeued, its state is
- * updated accordingly.
+ * Remove a dequeued event from the merge hash table.  Permission and
+ * overflow events are never hashed.
  */
-static struct fanotify_event *get_one_event(struct fsnotify_group *group,
-					    size_t count)
+static void fanotify_unhash_event(struct fsnotify_group *group,
+				  struct fanotify_event *event)
 {
-	size_t event_size = FAN_EVENT_METADATA_LEN;
-	struct fanotify_event *event = NULL;
+	assert_spin_locked(&group->notification_lock);
+
+	if (!fanotify_is_hashed_event(event->mask))
+		return;
+
+	if (WARN_ON_ONCE(hlist_unhashed(&event->merge_list)))
+		return;
+
+	hlist_del_init(&event->merge_list);
+}
+
+/*
+ * Dequeue as many fanotify notification events as fit in "count", up to
+ * FANOTIFY_READ_BATCH, onto @events under a single hold of the notification
+ * lock.  Return the number of events dequeued, or -EINVAL if the count is
+ * not large enough for the first event.  A permission event is always
+ * dequeued on its own and its state is updated accordingly, so that events
+ * which can't be copied out can simply be put back.
+ */
+static int get_events(struct fsnotify_group *group, size_t count,
+		      struct list_head *events)
+{
+	struct fanotify_event *event;
 	unsigned int fid_mode = FAN_GROUP_FLAG(group, FANOTIFY_FID_BITS);
+	int nr = 0;
 
 	pr_debug("%s: group=%p count=%zd\n", __func__, group, count);
 
 	spin_lock(&group->notification_lock);
-	if (fsnotify_notify_queue_is_empty(group))
-		goto out;
+	while (nr < FANOTIFY_READ_BATCH &&
+	       !fsnotify_notify_queue_is_empty(group)) {
+		size_t event_size = FAN_EVENT_METADATA_LEN;
 
-	if (fid_mode) {
-		event_size += fanotify_event_info_len(fid_mode,
-			FANOTIFY_E(fsnotify_peek_first_event(group)));
+		event = FANOTIFY_E(fsnotify_peek_first_event(group));
+		if (fid_mode)
+			event_size += fanotify_event_info_len(fid_mode, event);
+
+		if (event_size > count) {
+			if (!nr)
+				nr = -EINVAL;
+			break;
+		}
+
+		if (nr && fanotify_is_perm_event(event->mask))
+			break;
+
+		fsnotify_remove_first_event(group);
+		fanotify_unhash_event(group, event);
+		list_add_tail(&event->fse.list, events);
+		count -= event_size;
+		nr++;
+
+		if (fanotify_is_perm_event(event->mask)) {
+			FANOTIFY_PERM(event)->state = FAN_EVENT_REPORTED;
+			break;
+		}
 	}
+	spin_unlock(&group->notification_lock);
 
-	if (event_size > count) {
-		event = ERR_PTR(-EINVAL);
-		goto out;
+	return nr;
+}
+
+/*
+ * Put events dequeued by get_events() which were not copied to userspace
+ * back at the head of the queue, in their original order.
+ */
+static void requeue_events(struct fsnotify_group *group,
+			   struct list_head *events)
+{
+	struct fanotify_event *event, *next;
+
+	spin_lock(&group->notification_lock);
+	list_for_each_entry_safe_reverse(event, next, events, fse.list) {
+		list_move(&event->fse.list, &group->notification_list);
+		group->q_len++;
+		if (fanotify_is_hashed_event(event->mask))
+			hlist_add_head(&event->merge_list,
+				       fanotify_event_hash_bucket(group, event));
 	}
-	event = FANOTIFY_E(fsnotify_remove_first_event(group));
-	if (fanotify_is_perm_event(event->mask))
-		FANOTIFY_PERM(event)->state = FAN_EVENT_REPORTED;
-out:
 	spin_unlock(&group->notification_lock);
+}
+
+/*
+ * With FAN_DEFER_FD, read events keep their path and are looked up by the
+ * token reported in metadata->fd instead of having an fd opened for them.
+ * A token is reserved before the event is copied out and only becomes usable
+ * once the event has been published, so a racing FAN_IOC_OPEN_FD can't free
+ * an event which is still being reported.
+ */
+static bool fanotify_defers_fd(struct fsnotify_group *group,
+			       struct fanotify_event *event)
+{
+	return FAN_GROUP_FLAG(group, FAN_DEFER_FD) &&
+		event->type == FANOTIFY_EVENT_TYPE_PATH;
+}
+
+static int fanotify_reserve_fd_token(struct fsnotify_group *group)
+{
+	int token;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&group->fanotify_data.deferred_lock);
+	token = idr_alloc_cyclic(&group->fanotify_data.deferred_idr, NULL,
+				 0, 0, GFP_NOWAIT);
+	spin_unlock(&group->fanotify_data.deferred_lock);
+	idr_preload_end();
+
+	return token;
+}
+
+static void fanotify_release_fd_token(struct fsnotify_group *group, int token)
+{
+	spin_lock(&group->fanotify_data.deferred_lock);
+	idr_remove(&group->fanotify_data.deferred_idr, token);
+	spin_unlock(&group->fanotify_data.deferred_lock);
+}
+
+static void fanotify_publish_deferred(struct fsnotify_group *group,
+				      struct fanotify_event *event)
+{
+	struct fanotify_event *expired = NULL;
+
+	spin_lock(&group->fanotify_data.deferred_lock);
+	idr_replace(&group->fanotify_data.deferred_idr, event,
+		    FANOTIFY_PE(event)->fd);
+	list_add_tail(&event->fse.list, &group->fanotify_data.deferred_list);
+	if (++group->fanotify_data.deferred_len > FANOTIFY_MAX_DEFERRED_FDS) {
+		expired = list_first_entry(&group->fanotify_data.deferred_list,
+					   struct fanotify_event, fse.list);
+		list_del_init(&expired->fse.list);
+		idr_remove(&group->fanotify_data.deferred_idr,
+			   FANOTIFY_PE(expired)->fd);
+		group->fanotify_data.deferred_len--;
+	}
+	spin_unlock(&group->fanotify_data.deferred_lock);
+
+	if (expired)
+		fsnotify_destroy_event(group, &expired->fse);
+}
+
+static struct fanotify_event *fanotify_take_deferred(
+						struct fsnotify_group *group,
+						int token)
+{
+	struct fanotify_event *event;
+
+	spin_lock(&group->fanotify_data.deferred_lock);
+	event = idr_find(&group->fanotify_data.deferred_idr, token);
+	if (event) {
+		idr_remove(&group->fanotify_data.deferred_idr, token);
+		list_del_init(&event->fse.list);
+		group->fanotify_data.deferred_len--;
+	}
+	spin_unlock(&group->fanotify_data.deferred_lock);
+
 	return event;
 }
 
+static void fanotify_flush_deferred(struct fsnotify_group *group)
+{
+	struct fanotify_event *event;
+
+	spin_lock(&group->fanotify_data.deferred_lock);
+	while (!list_empty(&group->fanotify_data.deferred_list)) {
+		event = list_first_entry(&group->fanotify_data.deferred_list,
+					 struct fanotify_event, fse.list);
+		list_del_init(&event->fse.list);
+		idr_remove(&group->fanotify_data.deferred_idr,
+			   FANOTIFY_PE(event)->fd);
+		group->fanotify_data.deferred_len--;
+		spin_unlock(&group->fanotify_data.deferred_lock);
+		fsnotify_destroy_event(group, &event->fse);
+		spin_lock(&group->fanotify_data.deferred_lock);
+	}
+	spin_unlock(&group->fanotify_data.deferred_lock);
+}
+
 static int create_fd(struct fsnotify_group *group, struct path *path,
 		     struct file **file)
 {
@@ -343,7 +501,10 @@ static ssize_t copy_event_to_user(struct fsnotify_group *group,
 	metadata.pid = pid_vnr(event->pid);
 
 	if (path && path->mnt && path->dentry) {
-		fd = create_fd(group, path, &f);
+		if (fanotify_defers_fd(group, event))
+			fd = fanotify_reserve_fd_token(group);
+		else
+			fd = create_fd(group, path, &f);
 		if (fd < 0)
 			return fd;
 	}
@@ -365,6 +526,8 @@ static ssize_t copy_event_to_user(struct fsnotify_group *group,
 
 	if (fanotify_is_perm_event(event->mask))
 		FANOTIFY_PERM(event)->fd = fd;
+	else if (fanotify_defers_fd(group, event))
+		FANOTIFY_PE(event)->fd = fd;
 
 	if (f)
 		fd_install(fd, f);
@@ -435,9 +598,11 @@ static ssize_t copy_event_to_user(struct fsnotify_group *group,
 	return metadata.event_len;
 
 out_close_fd:
-	if (fd != FAN_NOFD) {
+	if (f) {
 		put_unused_fd(fd);
 		fput(f);
+	} else if (fd != FAN_NOFD) {
+		fanotify_release_fd_token(group, fd);
 	}
 	return ret;
 }
@@ -462,8 +627,9 @@ static ssize_t fanotify_read(struct file *file, char __user *buf,
 {
 	struct fsnotify_group *group;
 	struct fanotify_event *event;
+	LIST_HEAD(events);
 	char __user *start;
-	int ret;
+	int ret, nr;
 	DEFINE_WAIT_FUNC(wait, woken_wake_function);
 
 	start = buf;
@@ -478,13 +644,13 @@ static ssize_t fanotify_read(struct file *file, char __user *buf,
 		 * in case there are lots of available events.
 		 */
 		cond_resched();
-		event = get_one_event(group, count);
-		if (IS_ERR(event)) {
-			ret = PTR_ERR(event);
+		nr = get_events(group, count, &events);
+		if (nr < 0) {
+			ret = nr;
 			break;
 		}
 
-		if (!event) {
+		if (!nr) {
 			ret = -EAGAIN;
 			if (file->f_flags & O_NONBLOCK)
 				break;
@@ -500,40 +666,61 @@ static ssize_t fanotify_read(struct file *file, char __user *buf,
 			continue;
 		}
 
-		ret = copy_event_to_user(group, event, buf, count);
-		if (unlikely(ret == -EOPENSTALE)) {
+		ret = 0;
+		while (!list_empty(&events)) {
+			event = list_first_entry(&events, struct fanotify_event,
+						 fse.list);
+			list_del_init(&event->fse.list);
+
+			ret = copy_event_to_user(group, event, buf, count);
+			if (unlikely(ret == -EOPENSTALE)) {
+				/*
+				 * We cannot report events with stale fd so
+				 * drop it.  Setting ret to 0 will continue the
+				 * event loop and do the right thing if there
+				 * are no more events to read (i.e. return
+				 * bytes read, -EAGAIN or wait).
+				 */
+				ret = 0;
+			}
+
 			/*
-			 * We cannot report events with stale fd so drop it.
-			 * Setting ret to 0 will continue the event loop and
-			 * do the right thing if there are no more events to
-			 * read (i.e. return bytes read, -EAGAIN or wait).
+			 * Permission events get queued to wait for response.
+			 * Events with a deferred fd are kept until userspace
+			 * opens or forgets them.  Other events can be
+			 * destroyed now.
 			 */
-			ret = 0;
-		}
-
-		/*
-		 * Permission events get queued to wait for response.  Other
-		 * events can be destroyed now.
-		 */
-		if (!fanotify_is_perm_event(event->mask)) {
-			fsnotify_destroy_event(group, &event->fse);
-		} else {
-			if (ret <= 0) {
-				spin_lock(&group->notification_lock);
-				finish_permission_event(group,
-					FANOTIFY_PERM(event), FAN_DENY);
-				wake_up(&group->fanotify_data.access_waitq);
+			if (!fanotify_is_perm_event(event->mask)) {
+				if (ret > 0 && fanotify_defers_fd(group, event) &&
+				    FANOTIFY_PE(event)->fd != FAN_NOFD)
+					fanotify_publish_deferred(group, event);
+				else
+					fsnotify_destroy_event(group, &event->fse);
 			} else {
-				spin_lock(&group->notification_lock);
-				list_add_tail(&event->fse.list,
-					&group->fanotify_data.access_list);
-				spin_unlock(&group->notification_lock);
+				if (ret <= 0) {
+					spin_lock(&group->notification_lock);
+					finish_permission_event(group,
+						FANOTIFY_PERM(event), FAN_DENY);
+					wake_up(&group->fanotify_data.access_waitq);
+				} else {
+					spin_lock(&group->notification_lock);
+					list_add_tail(&event->fse.list,
+						&group->fanotify_data.access_list);
+					spin_unlock(&group->notification_lock);
+				}
 			}
+			if (ret < 0)
+				break;
+			buf += ret;
+			count -= ret;
 		}
-		if (ret < 0)
+
+		if (ret < 0) {
+			/* Don't lose the rest of the batch */
+			if (!list_empty(&events))
+				requeue_events(group, &events);
 			break;
-		buf += ret;
-		count -= ret;
+		}
 	}
 	remove_wait_queue(&group->notification_waitq, &wait);
 
@@ -605,6 +792,7 @@ static int fanotify_release(struct inode *ignored, struct file *file)
 		struct fanotify_event *event;
 
 		event = FANOTIFY_E(fsnotify_remove_first_event(group));
+		fanotify_unhash_event(group, event);
 		if (!(event->mask & FANOTIFY_PERM_EVENTS)) {
 			spin_unlock(&group->notification_lock);
 			fsnotify_destroy_event(group, &event->fse);
@@ -619,16 +807,46 @@ static int fanotify_release(struct inode *ignored, struct file *file)
 	/* Response for all permission events it set, wakeup waiters */
 	wake_up(&group->fanotify_data.access_waitq);
 
+	/* Drop the events which still wait for their fd to be opened */
+	fanotify_flush_deferred(group);
+
 	/* matches the fanotify_init->fsnotify_alloc_group */
 	fsnotify_destroy_group(group);
 
 	return 0;
 }
 
+static int fanotify_open_deferred_fd(struct fsnotify_group *group,
+				     int __user *argp)
+{
+	struct fanotify_event *event;
+	struct file *f = NULL;
+	int token, fd;
+
+	if (!FAN_GROUP_FLAG(group, FAN_DEFER_FD))
+		return -EINVAL;
+
+	if (get_user(token, argp))
+		return -EFAULT;
+
+	if (token < 0)
+		return -EINVAL;
+
+	event = fanotify_take_deferred(group, token);
+	if (!event)
+		return -ENOENT;
+
+	fd = create_fd(group, fanotify_event_path(event), &f);
+	if (fd >= 0)
+		fd_install(fd, f);
+
+	fsnotify_destroy_event(group, &event->fse);
+	return fd;
+}
+
 static long fanotify_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct fsnotify_group *group;
-	struct fsnotify_event *fsn_event;
 	void __user *p;
 	int ret = -ENOTTY;
 	size_t send_len = 0;
@@ -640,11 +858,13 @@ static long fanotify_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 	switch (cmd) {
 	case FIONREAD:
 		spin_lock(&group->notification_lock);
-		list_for_each_entry(fsn_event, &group->notification_list, list)
-			send_len += FAN_EVENT_METADATA_LEN;
+		send_len = group->q_len * FAN_EVENT_METADATA_LEN;
 		spin_unlock(&group->notification_lock);
 		ret = put_user(send_len, (int __user *) p);
 		break;
+	case FAN_IOC_OPEN_FD:
+		ret = fanotify_open_deferred_fd(group, p);
+		break;
 	}
 
 	return ret;
@@ -905,6 +1125,22 @@ static int fanotify_add_inode_mark(struct fsnotify_group *group,
 				 FSNOTIFY_OBJ_TYPE_INODE, mask, flags, fsid);
 }
 
+static struct hlist_head *fanotify_alloc_merge_hash(void)
+{
+	struct hlist_head *hash;
+	int i;
+
+	hash = kmalloc_array(FANOTIFY_HTABLE_SIZE, sizeof(*hash),
+			     GFP_KERNEL_ACCOUNT);
+	if (!hash)
+		return NULL;
+
+	for (i = 0; i < FANOTIFY_HTABLE_SIZE; i++)
+		INIT_HLIST_HEAD(&hash[i]);
+
+	return hash;
+}
+
 static struct fsnotify_event *fanotify_alloc_overflow_event(void)
 {
 	struct fanotify_event *oevent;
@@ -956,6 +1192,10 @@ SYSCALL_DEFINE2(fanotify_init, unsigned int, flags, unsigned int, event_f_flags)
 	if (fid_mode && class != FAN_CLASS_NOTIF)
 		return -EINVAL;
 
+	/* Deferred fds are only reported for non-permission path events */
+	if ((flags & FAN_DEFER_FD) && (fid_mode || class != FAN_CLASS_NOTIF))
+		return -EINVAL;
+
 	/*
 	 * Child name is reported with parent fid so requires dir fid.
 	 * We can report both child fid and dir fid with or without name.
@@ -986,6 +1226,17 @@ SYSCALL_DEFINE2(fanotify_init, unsigned int, flags, unsigned int, event_f_flags)
 	group->fanotify_data.flags = flags;
 	atomic_inc(&user->fanotify_listeners);
 	group->memcg = get_mem_cgroup_from_mm(current->mm);
+	spin_lock_init(&group->fanotify_data.event_pool_lock);
+	INIT_LIST_HEAD(&group->fanotify_data.event_pool);
+	spin_lock_init(&group->fanotify_data.deferred_lock);
+	idr_init(&group->fanotify_data.deferred_idr);
+	INIT_LIST_HEAD(&group->fanotify_data.deferred_list);
+
+	group->fanotify_data.merge_hash = fanotify_alloc_merge_hash();
+	if (!group->fanotify_data.merge_hash) {
+		fd = -ENOMEM;
+		goto out_destroy_group;
+	}
 
 	group->overflow_event = fanotify_alloc_overflow_event();
 	if (unlikely(!group->overflow_event)) {
@@ -1021,6 +1272,9 @@ SYSCALL_DEFINE2(fanotify_init, unsigned int, flags, unsigned int, event_f_flags)
 	} else {
 		group->max_events = FANOTIFY_DEFAULT_MAX_EVENTS;
 	}
+	group->fanotify_data.max_cached_events =
+		min_t(unsigned int, group->max_events,
+		      FANOTIFY_DEFAULT_MAX_EVENTS);
 
 	if (flags & FAN_UNLIMITED_MARKS) {
 		fd = -EPERM;
@@ -1315,7 +1569,7 @@ COMPAT_SYSCALL_DEFINE6(fanotify_mark,
  */
 static int __init fanotify_user_setup(void)
 {
-	BUILD_BUG_ON(HWEIGHT32(FANOTIFY_INIT_FLAGS) != 10);
+	BUILD_BUG_ON(HWEIGHT32(FANOTIFY_INIT_FLAGS) != 11);
 	BUILD_BUG_ON(HWEIGHT32(FANOTIFY_MARK_FLAGS) != 9);
 
 	fanotify_mark_cache = KMEM_CACHE(fsnotify_mark,
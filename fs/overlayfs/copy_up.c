@@ -18,6 +18,8 @@
 #include <linux/fdtable.h>
 #include <linux/ratelimit.h>
 #include <linux/exportfs.h>
+#include <linux/fadvise.h>
+#include <linux/fsnotify.h>
 #include "overlayfs.h"
 
 #define OVL_COPY_UP_CHUNK_SIZE (1 << 20)
@@ -129,6 +131,68 @@ int ovl_copy_xattr(struct super_block *sb, struct dentry *old,
 	return error;
 }
 
+/*
+ * Offload one chunk to ->copy_file_range().  vfs_copy_file_range() can't be
+ * used here: it takes freeze protection on the upper sb, which the caller
+ * already holds through ovl_want_write(), and nesting it deadlocks against
+ * a pending fsfreeze.  So do the checks of rw_verify_area() and the fsnotify
+ * calls by hand, the way do_splice_direct() runs without freeze protection.
+ */
+static ssize_t ovl_copy_file_range(struct file *old_file, loff_t old_pos,
+				   struct file *new_file, loff_t new_pos,
+				   size_t len)
+{
+	ssize_t ret;
+
+	/* leave mandatory locks to the splice path */
+	if (mandatory_lock(file_inode(old_file)) ||
+	    mandatory_lock(file_inode(new_file)))
+		return -EOPNOTSUPP;
+
+	ret = security_file_permission(old_file, MAY_READ);
+	if (ret)
+		return ret;
+	ret = security_file_permission(new_file, MAY_WRITE);
+	if (ret)
+		return ret;
+
+	ret = new_file->f_op->copy_file_range(old_file, old_pos,
+					      new_file, new_pos, len, 0);
+	if (ret > 0) {
+		fsnotify_access(old_file);
+		fsnotify_modify(new_file);
+	}
+	return ret;
+}
+
+/*
+ * Copy one chunk of data.  If both files share a ->copy_file_range() method,
+ * try it first, as it may be offloaded to the server or the device.  If the
+ * filesystem can't offload this pair of files, stop trying and splice the
+ * rest of the file.
+ */
+static long ovl_copy_up_chunk(struct file *old_file, loff_t *old_pos,
+			      struct file *new_file, loff_t *new_pos,
+			      size_t len, bool *try_offload)
+{
+	if (*try_offload) {
+		ssize_t bytes = ovl_copy_file_range(old_file, *old_pos,
+						    new_file, *new_pos, len);
+
+		if (bytes > 0) {
+			*old_pos += bytes;
+			*new_pos += bytes;
+			return bytes;
+		}
+		if (bytes != -EXDEV && bytes != -EOPNOTSUPP)
+			return bytes;
+		*try_offload = false;
+	}
+
+	return do_splice_direct(old_file, old_pos, new_file, new_pos,
+				len, SPLICE_F_MOVE);
+}
+
 static int ovl_copy_up_data(struct ovl_fs *ofs, struct path *old,
 			    struct path *new, loff_t len)
 {
@@ -140,6 +204,7 @@ static int ovl_copy_up_data(struct ovl_fs *ofs, struct path *old,
 	loff_t data_pos = -1;
 	loff_t hole_len;
 	bool skip_hole = false;
+	bool try_offload;
 	int error = 0;
 
 	if (len == 0)
@@ -166,6 +231,14 @@ static int ovl_copy_up_data(struct ovl_fs *ofs, struct path *old,
 	    old_file->f_op->llseek)
 		skip_hole = true;
 
+	try_offload = new_file->f_op->copy_file_range &&
+		      new_file->f_op->copy_file_range ==
+		      old_file->f_op->copy_file_range;
+
+	/* Lower data is read once, front to back */
+	if (!try_offload)
+		vfs_fadvise(old_file, 0, len, POSIX_FADV_SEQUENTIAL);
+
 	while (len) {
 		size_t this_len = OVL_COPY_UP_CHUNK_SIZE;
 		long bytes;
@@ -208,9 +281,20 @@ static int ovl_copy_up_data(struct ovl_fs *ofs, struct path *old,
 			}
 		}
 
-		bytes = do_splice_direct(old_file, &old_pos,
-					 new_file, &new_pos,
-					 this_len, SPLICE_F_MOVE);
+		/*
+		 * Start reading the next chunk from the lower layer before
+		 * copying this one, so that reading the lower file and writing
+		 * the upper file overlap instead of taking turns.
+		 */
+		if (!try_offload && len > this_len)
+			vfs_fadvise(old_file, old_pos + this_len,
+				    min_t(loff_t, len - this_len,
+					  OVL_COPY_UP_CHUNK_SIZE),
+				    POSIX_FADV_WILLNEED);
+
+		bytes = ovl_copy_up_chunk(old_file, &old_pos,
+					  new_file, &new_pos,
+					  this_len, &try_offload);
 		if (bytes <= 0) {
 			error = bytes;
 			break;
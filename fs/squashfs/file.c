@@ -495,6 +495,135 @@ static int squashfs_readpage(struct file *file, struct page *page)
 }
 
 
+/* Fill a batch of readahead pages from a datablock or fragment */
+void squashfs_fill_pages(struct page **page, int pages,
+	struct squashfs_cache_entry *buffer, int offset, int bytes)
+{
+	int n;
+
+	for (n = 0; n < pages; n++, bytes -= PAGE_SIZE, offset += PAGE_SIZE) {
+		int avail = buffer ? clamp_t(int, bytes, 0, PAGE_SIZE) : 0;
+
+		squashfs_fill_page(page[n], buffer, offset, avail);
+	}
+}
+
+/*
+ * Read separately compressed datablock into the squashfs cache and copy it
+ * into a batch of readahead pages.  Used when the batch does not cover the
+ * whole datablock and so it can't be decompressed into the pages directly.
+ */
+int squashfs_readahead_cache(struct page **page, int pages, u64 block,
+	int bsize, int offset, int expected)
+{
+	struct inode *i = page[0]->mapping->host;
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(i->i_sb,
+		block, bsize);
+	int res = buffer->error;
+
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+	else
+		squashfs_fill_pages(page, pages, buffer, offset,
+			expected - offset);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
+
+static int squashfs_readahead_fragment(struct page **page, int pages,
+	int offset, int expected)
+{
+	struct inode *inode = page[0]->mapping->host;
+	struct squashfs_cache_entry *buffer = squashfs_get_fragment(inode->i_sb,
+		squashfs_i(inode)->fragment_block,
+		squashfs_i(inode)->fragment_size);
+	int res = buffer->error;
+
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n",
+			squashfs_i(inode)->fragment_block,
+			squashfs_i(inode)->fragment_size);
+	else
+		squashfs_fill_pages(page, pages, buffer,
+			squashfs_i(inode)->fragment_offset + offset,
+			expected - offset);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
+
+/*
+ * Readahead hands us runs of locked pages not yet in the page cache.  Split
+ * the run at datablock boundaries and read each datablock once, decompressing
+ * straight into the page cache pages where the batch covers the whole block,
+ * rather than going through squashfs_readpage() a page at a time.  Pages
+ * left !Uptodate on error are retried (and the error reported) by
+ * squashfs_readpage().
+ */
+static void squashfs_readahead(struct readahead_control *ractl)
+{
+	struct inode *inode = ractl->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_SHIFT;
+	int mask = (1 << shift) - 1;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	pgoff_t end_index = (i_size_read(inode) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	pgoff_t next = readahead_index(ractl);
+	struct page **page;
+	int i, pages;
+
+	page = kmalloc_array(mask + 1, sizeof(void *), GFP_KERNEL);
+	if (page == NULL)
+		return;
+
+	/* Never let a batch straddle two datablocks */
+	while ((pages = __readahead_batch(ractl, page,
+					mask + 1 - (next & mask)))) {
+		int index = page[0]->index >> shift;
+		int offset = (page[0]->index & mask) << PAGE_SHIFT;
+		int expected = index == file_end ?
+			(i_size_read(inode) & (msblk->block_size - 1)) :
+			 msblk->block_size;
+		u64 block = 0;
+		int bsize;
+
+		next = page[pages - 1]->index + 1;
+
+		TRACE("Entered squashfs_readahead, page index %lx, pages %d\n",
+			page[0]->index, pages);
+
+		if (page[0]->index >= end_index)
+			goto release;
+
+		if (index < file_end || squashfs_i(inode)->fragment_block ==
+						SQUASHFS_INVALID_BLK) {
+			bsize = read_blocklist(inode, index, &block);
+			if (bsize < 0)
+				goto release;
+
+			if (bsize == 0)
+				squashfs_fill_pages(page, pages, NULL, 0, 0);
+			else
+				squashfs_readahead_block(page, pages, block,
+					bsize, offset, expected);
+		} else
+			squashfs_readahead_fragment(page, pages, offset,
+				expected);
+
+release:
+		for (i = 0; i < pages; i++) {
+			unlock_page(page[i]);
+			put_page(page[i]);
+		}
+	}
+
+	kfree(page);
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readahead = squashfs_readahead
 };
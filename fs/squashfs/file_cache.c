@@ -34,3 +34,11 @@ int squashfs_readpage_block(struct page *page, u64 block, int bsize, int expecte
 	squashfs_cache_put(buffer);
 	return res;
 }
+
+/* Read separately compressed datablock and memcopy into readahead pages */
+int squashfs_readahead_block(struct page **page, int pages, u64 block,
+	int bsize, int offset, int expected)
+{
+	return squashfs_readahead_cache(page, pages, block, bsize, offset,
+		expected);
+}
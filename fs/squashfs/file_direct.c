@@ -172,3 +172,53 @@ static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
 	squashfs_cache_put(buffer);
 	return res;
 }
+
+/*
+ * Read separately compressed datablock directly into a batch of readahead
+ * pages.  The pages are left locked, and on error are left !Uptodate.
+ */
+int squashfs_readahead_block(struct page **page, int pages, u64 block,
+	int bsize, int offset, int expected)
+{
+	struct inode *inode = page[0]->mapping->host;
+	struct squashfs_page_actor *actor;
+	int i, bytes, res;
+	void *pageaddr;
+
+	/*
+	 * The decompressors need somewhere to put the whole block, if
+	 * readahead only gave us part of it fall back to an intermediate
+	 * buffer.
+	 */
+	if (offset || pages != DIV_ROUND_UP(expected, PAGE_SIZE))
+		return squashfs_readahead_cache(page, pages, block, bsize,
+			offset, expected);
+
+	actor = squashfs_page_actor_init_special(page, pages, 0);
+	if (actor == NULL)
+		return -ENOMEM;
+
+	res = squashfs_read_data(inode->i_sb, block, bsize, NULL, actor);
+	kfree(actor);
+
+	if (res < 0)
+		return res;
+
+	if (res != expected)
+		return -EIO;
+
+	/* Last page may have trailing bytes not filled */
+	bytes = res % PAGE_SIZE;
+	if (bytes) {
+		pageaddr = kmap_atomic(page[pages - 1]);
+		memset(pageaddr + bytes, 0, PAGE_SIZE - bytes);
+		kunmap_atomic(pageaddr);
+	}
+
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+	}
+
+	return 0;
+}
@@ -19,6 +19,7 @@
 #include <linux/mempool.h>
 
 struct ahash_request;
+struct fsverity_hash_batch;
 
 /*
  * Implementation limit: maximum depth of the Merkle tree.  For now 8 is plenty;
@@ -32,6 +33,13 @@ struct ahash_request;
  */
 #define FS_VERITY_MAX_DIGEST_SIZE	SHA512_DIGEST_SIZE
 
+/*
+ * Maximum number of data pages whose hashes are computed concurrently when
+ * verifying a bio.  This lets asynchronous hash implementations (e.g. crypto
+ * engines) work on several pages in parallel.
+ */
+#define FS_VERITY_HASH_BATCH		8
+
 /* A hash algorithm supported by fs-verity */
 struct fsverity_hash_alg {
 	struct crypto_ahash *tfm; /* hash tfm, allocated on demand */
@@ -39,6 +47,7 @@ struct fsverity_hash_alg {
 	unsigned int digest_size; /* digest size in bytes, e.g. 32 for SHA-256 */
 	unsigned int block_size;  /* block size in bytes, e.g. 64 for SHA-256 */
 	mempool_t req_pool;	  /* mempool with a preallocated hash request */
+	struct fsverity_hash_batch *batch; /* async tfms only, else NULL */
 };
 
 /* Merkle tree parameters: hash algorithm, initial hash state, and topology */
@@ -128,6 +137,13 @@ const u8 *fsverity_prepare_hash_state(struct fsverity_hash_alg *alg,
 int fsverity_hash_page(const struct merkle_tree_params *params,
 		       const struct inode *inode,
 		       struct ahash_request *req, struct page *page, u8 *out);
+struct fsverity_hash_batch *fsverity_get_hash_batch(struct fsverity_hash_alg *alg);
+void fsverity_put_hash_batch(struct fsverity_hash_alg *alg,
+			     struct fsverity_hash_batch *batch);
+const u8 *fsverity_hash_pages(const struct merkle_tree_params *params,
+			      const struct inode *inode,
+			      struct fsverity_hash_batch *batch,
+			      struct page **pages, unsigned int nr_pages);
 int fsverity_hash_buffer(struct fsverity_hash_alg *alg,
 			 const void *data, size_t size, u8 *out);
 void __init fsverity_check_hash_algs(void);
@@ -93,6 +93,9 @@ struct fsverity_hash_alg *fsverity_get_hash_alg(const struct inode *inode,
 	if (err)
 		goto err_free_tfm;
 
+	/* Allocation failure only costs concurrency, so it isn't an error */
+	alg->batch = fsverity_alloc_hash_batch(tfm);
+
 	pr_info("%s using implementation \"%s\"\n",
 		alg->name, crypto_ahash_driver_name(tfm));
 
@@ -217,6 +220,38 @@ const u8 *fsverity_prepare_hash_state(struct fsverity_hash_alg *alg,
 	goto out;
 }
 
+/*
+ * Start hashing a single page with @req.  Returns the result of submitting the
+ * request, which may be -EINPROGRESS or -EBUSY; see crypto_wait_req().
+ */
+static int fsverity_start_hash_page(const struct merkle_tree_params *params,
+				    const struct inode *inode,
+				    struct ahash_request *req,
+				    struct scatterlist *sg,
+				    struct crypto_wait *wait,
+				    struct page *page, u8 *out)
+{
+	int err;
+
+	sg_init_table(sg, 1);
+	sg_set_page(sg, page, PAGE_SIZE, 0);
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_SLEEP |
+					CRYPTO_TFM_REQ_MAY_BACKLOG,
+				   crypto_req_done, wait);
+	ahash_request_set_crypt(req, sg, out, PAGE_SIZE);
+
+	if (params->hashstate) {
+		err = crypto_ahash_import(req, params->hashstate);
+		if (err) {
+			fsverity_err(inode,
+				     "Error %d importing hash state", err);
+			return err;
+		}
+		return crypto_ahash_finup(req);
+	}
+	return crypto_ahash_digest(req);
+}
+
 /**
  * fsverity_hash_page() - hash a single data or hash page
  * @params: the Merkle tree's parameters
@@ -241,31 +276,142 @@ int fsverity_hash_page(const struct merkle_tree_params *params,
 	if (WARN_ON(params->block_size != PAGE_SIZE))
 		return -EINVAL;
 
-	sg_init_table(&sg, 1);
-	sg_set_page(&sg, page, PAGE_SIZE, 0);
-	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_SLEEP |
-					CRYPTO_TFM_REQ_MAY_BACKLOG,
-				   crypto_req_done, &wait);
-	ahash_request_set_crypt(req, &sg, out, PAGE_SIZE);
-
-	if (params->hashstate) {
-		err = crypto_ahash_import(req, params->hashstate);
-		if (err) {
-			fsverity_err(inode,
-				     "Error %d importing hash state", err);
-			return err;
-		}
-		err = crypto_ahash_finup(req);
-	} else {
-		err = crypto_ahash_digest(req);
-	}
-
+	err = fsverity_start_hash_page(params, inode, req, &sg, &wait,
+				       page, out);
 	err = crypto_wait_req(err, &wait);
 	if (err)
 		fsverity_err(inode, "Error %d computing page hash", err);
 	return err;
 }
 
+struct fsverity_hash_slot {
+	struct ahash_request *req;
+	struct scatterlist sg;
+	struct crypto_wait wait;
+	int err;
+};
+
+/*
+ * Requests and output buffer for hashing up to FS_VERITY_HASH_BATCH data pages
+ * concurrently.  Only asynchronous hash algorithms get one, allocated along
+ * with the tfm; a synchronous one gains nothing from having several requests
+ * in flight.
+ */
+struct fsverity_hash_batch {
+	struct fsverity_hash_slot slots[FS_VERITY_HASH_BATCH];
+	u8 hashes[FS_VERITY_HASH_BATCH * FS_VERITY_MAX_DIGEST_SIZE];
+};
+
+static void fsverity_free_hash_batch(struct fsverity_hash_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < FS_VERITY_HASH_BATCH; i++)
+		ahash_request_free(batch->slots[i].req);
+	kfree(batch);
+}
+
+static struct fsverity_hash_batch *
+fsverity_alloc_hash_batch(struct crypto_ahash *tfm)
+{
+	struct fsverity_hash_batch *batch;
+	unsigned int i;
+
+	if (!(crypto_hash_alg_common(tfm)->base.cra_flags & CRYPTO_ALG_ASYNC))
+		return NULL;
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return NULL;
+	for (i = 0; i < FS_VERITY_HASH_BATCH; i++) {
+		batch->slots[i].req = ahash_request_alloc(tfm, GFP_KERNEL);
+		if (!batch->slots[i].req) {
+			fsverity_free_hash_batch(batch);
+			return NULL;
+		}
+		crypto_init_wait(&batch->slots[i].wait);
+	}
+	return batch;
+}
+
+/**
+ * fsverity_get_hash_batch() - take the hash algorithm's batch
+ * @alg: the hash algorithm
+ *
+ * Return: the batch for use with fsverity_hash_pages(), or NULL if the
+ *	   algorithm has none or another task is using it.  Callers then hash
+ *	   one page at a time.
+ */
+struct fsverity_hash_batch *fsverity_get_hash_batch(struct fsverity_hash_alg *alg)
+{
+	if (!READ_ONCE(alg->batch))
+		return NULL;
+	return xchg(&alg->batch, NULL);
+}
+
+/**
+ * fsverity_put_hash_batch() - give back a batch from fsverity_get_hash_batch()
+ * @alg: the hash algorithm
+ * @batch: the batch, may be NULL
+ */
+void fsverity_put_hash_batch(struct fsverity_hash_alg *alg,
+			     struct fsverity_hash_batch *batch)
+{
+	/* pairs with the xchg() in fsverity_get_hash_batch() */
+	if (batch)
+		smp_store_release(&alg->batch, batch);
+}
+
+/**
+ * fsverity_hash_pages() - hash several data pages
+ * @params: the Merkle tree's parameters
+ * @inode: inode for which the hashing is being done
+ * @batch: batch from fsverity_get_hash_batch()
+ * @pages: the pages to hash
+ * @nr_pages: number of pages in @pages, at most FS_VERITY_HASH_BATCH
+ *
+ * Like fsverity_hash_page(), but for several pages at once.  The requests for
+ * all pages are submitted before any of them is waited for, so that
+ * asynchronous hash implementations can process them concurrently.
+ *
+ * Return: the digests, 'params->digest_size' bytes for each page, stored in
+ *	   @batch; or an ERR_PTR() on failure
+ */
+const u8 *fsverity_hash_pages(const struct merkle_tree_params *params,
+			      const struct inode *inode,
+			      struct fsverity_hash_batch *batch,
+			      struct page **pages, unsigned int nr_pages)
+{
+	const unsigned int hsize = params->digest_size;
+	unsigned int i;
+	int err = 0;
+
+	if (WARN_ON(params->block_size != PAGE_SIZE ||
+		    nr_pages > FS_VERITY_HASH_BATCH))
+		return ERR_PTR(-EINVAL);
+
+	for (i = 0; i < nr_pages; i++) {
+		struct fsverity_hash_slot *slot = &batch->slots[i];
+
+		slot->err = fsverity_start_hash_page(params, inode, slot->req,
+						     &slot->sg, &slot->wait,
+						     pages[i],
+						     &batch->hashes[i * hsize]);
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		struct fsverity_hash_slot *slot = &batch->slots[i];
+		int err2 = crypto_wait_req(slot->err, &slot->wait);
+
+		if (err2 && !err) {
+			fsverity_err(inode, "Error %d computing page hash",
+				     err2);
+			err = err2;
+		}
+	}
+	return err ? ERR_PTR(err) : batch->hashes;
+}
+
 /**
  * fsverity_hash_buffer() - hash some data
  * @alg: the hash algorithm to use
@@ -66,6 +66,16 @@ static inline int cmp_hashes(const struct fsverity_info *vi,
 	return -EBADMSG;
 }
 
+/*
+ * A checked level 0 hash page kept around while verifying a bio.  Data pages
+ * in a bio are mostly contiguous and so usually share their level 0 hash
+ * page, which then doesn't need to be looked up again for each of them.
+ */
+struct level0_cache {
+	struct page *hpage;
+	pgoff_t hindex;
+};
+
 /*
  * Verify a single data page against the file's Merkle tree.
  *
@@ -81,11 +91,15 @@ static inline int cmp_hashes(const struct fsverity_info *vi,
  * Note that multiple processes may race to verify a hash page and mark it
  * Checked, but it doesn't matter; the result will be the same either way.
  *
+ * If @data_hash is non-NULL, it is the already computed hash of the data page.
+ * @cache, if non-NULL, is used to reuse the level 0 hash page across calls.
+ *
  * Return: true if the page is valid, else false.
  */
 static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 			struct ahash_request *req, struct page *data_page,
-			unsigned long level0_ra_pages)
+			unsigned long level0_ra_pages, const u8 *data_hash,
+			struct level0_cache *cache)
 {
 	const struct merkle_tree_params *params = &vi->tree_params;
 	const unsigned int hsize = params->digest_size;
@@ -118,6 +132,13 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 		pr_debug_ratelimited("Level %d: hindex=%lu, hoffset=%u\n",
 				     level, hindex, hoffset);
 
+		if (level == 0 && cache && cache->hpage &&
+		    cache->hindex == hindex) {
+			extract_hash(cache->hpage, hoffset, hsize, _want_hash);
+			want_hash = _want_hash;
+			goto descend;
+		}
+
 		hpage = inode->i_sb->s_vop->read_merkle_tree_page(inode, hindex,
 				level == 0 ? level0_ra_pages : 0);
 		if (IS_ERR(hpage)) {
@@ -131,7 +152,14 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 		if (PageChecked(hpage)) {
 			extract_hash(hpage, hoffset, hsize, _want_hash);
 			want_hash = _want_hash;
-			put_page(hpage);
+			if (level == 0 && cache) {
+				if (cache->hpage)
+					put_page(cache->hpage);
+				cache->hpage = hpage;
+				cache->hindex = hindex;
+			} else {
+				put_page(hpage);
+			}
 			pr_debug_ratelimited("Hash page already checked, want %s:%*phN\n",
 					     params->hash_alg->name,
 					     hsize, want_hash);
@@ -166,10 +194,14 @@ static bool verify_page(struct inode *inode, const struct fsverity_info *vi,
 	}
 
 	/* Finally, verify the data page */
-	err = fsverity_hash_page(params, inode, req, data_page, real_hash);
-	if (err)
-		goto out;
-	err = cmp_hashes(vi, want_hash, real_hash, index, -1);
+	if (!data_hash) {
+		err = fsverity_hash_page(params, inode, req, data_page,
+					 real_hash);
+		if (err)
+			goto out;
+		data_hash = real_hash;
+	}
+	err = cmp_hashes(vi, want_hash, data_hash, index, -1);
 out:
 	for (; level > 0; level--)
 		put_page(hpages[level - 1]);
@@ -196,7 +228,7 @@ bool fsverity_verify_page(struct page *page)
 	/* This allocation never fails, since it's mempool-backed. */
 	req = fsverity_alloc_hash_request(vi->tree_params.hash_alg, GFP_NOFS);
 
-	valid = verify_page(inode, vi, req, page, 0);
+	valid = verify_page(inode, vi, req, page, 0, NULL, NULL);
 
 	fsverity_free_hash_request(vi->tree_params.hash_alg, req);
 
@@ -205,6 +237,41 @@ bool fsverity_verify_page(struct page *page)
 EXPORT_SYMBOL_GPL(fsverity_verify_page);
 
 #ifdef CONFIG_BLOCK
+/*
+ * Verify up to FS_VERITY_HASH_BATCH data pages of a bio.  With a @batch, the
+ * data pages are hashed together first, then each is checked against the tree.
+ */
+static void verify_pages(struct inode *inode, const struct fsverity_info *vi,
+			 struct ahash_request *req,
+			 struct fsverity_hash_batch *batch, struct page **pages,
+			 unsigned int nr_pages, unsigned long max_ra_pages,
+			 struct level0_cache *cache)
+{
+	const struct merkle_tree_params *params = &vi->tree_params;
+	const u8 *hashes = NULL;
+	unsigned int i;
+
+	/* On error, let verify_page() hash (and report) each page itself */
+	if (batch) {
+		hashes = fsverity_hash_pages(params, inode, batch, pages,
+					     nr_pages);
+		if (IS_ERR(hashes))
+			hashes = NULL;
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = pages[i];
+		unsigned long level0_index = page->index >> params->log_arity;
+		unsigned long level0_ra_pages =
+			min(max_ra_pages, params->level0_blocks - level0_index);
+
+		if (!verify_page(inode, vi, req, page, level0_ra_pages,
+				 hashes ? &hashes[i * params->digest_size] :
+					  NULL, cache))
+			SetPageError(page);
+	}
+}
+
 /**
  * fsverity_verify_bio() - verify a 'read' bio that has just completed
  * @bio: the bio to verify
@@ -226,12 +293,17 @@ void fsverity_verify_bio(struct bio *bio)
 	const struct fsverity_info *vi = inode->i_verity_info;
 	const struct merkle_tree_params *params = &vi->tree_params;
 	struct ahash_request *req;
+	struct fsverity_hash_batch *batch;
 	struct bio_vec *bv;
 	struct bvec_iter_all iter_all;
 	unsigned long max_ra_pages = 0;
+	struct page *pages[FS_VERITY_HASH_BATCH];
+	unsigned int nr_pages = 0;
+	struct level0_cache cache = {};
 
 	/* This allocation never fails, since it's mempool-backed. */
 	req = fsverity_alloc_hash_request(params->hash_alg, GFP_NOFS);
+	batch = fsverity_get_hash_batch(params->hash_alg);
 
 	if (bio->bi_opf & REQ_RAHEAD) {
 		/*
@@ -250,15 +322,23 @@ void fsverity_verify_bio(struct bio *bio)
 
 	bio_for_each_segment_all(bv, bio, iter_all) {
 		struct page *page = bv->bv_page;
-		unsigned long level0_index = page->index >> params->log_arity;
-		unsigned long level0_ra_pages =
-			min(max_ra_pages, params->level0_blocks - level0_index);
 
-		if (!PageError(page) &&
-		    !verify_page(inode, vi, req, page, level0_ra_pages))
-			SetPageError(page);
+		if (PageError(page))
+			continue;
+		pages[nr_pages++] = page;
+		if (nr_pages == FS_VERITY_HASH_BATCH) {
+			verify_pages(inode, vi, req, batch, pages, nr_pages,
+				     max_ra_pages, &cache);
+			nr_pages = 0;
+		}
 	}
+	if (nr_pages)
+		verify_pages(inode, vi, req, batch, pages, nr_pages,
+			     max_ra_pages, &cache);
 
+	if (cache.hpage)
+		put_page(cache.hpage);
+	fsverity_put_hash_batch(params->hash_alg, batch);
 	fsverity_free_hash_request(params->hash_alg, req);
 }
 EXPORT_SYMBOL_GPL(fsverity_verify_bio);
@@ -154,7 +154,8 @@ struct fsnotify_ops {
 			    const struct qstr *file_name);
 	void (*free_group_priv)(struct fsnotify_group *group);
 	void (*freeing_mark)(struct fsnotify_mark *mark, struct fsnotify_group *group);
-	void (*free_event)(struct fsnotify_event *event);
+	void (*free_event)(struct fsnotify_group *group,
+			   struct fsnotify_event *event);
 	/* called on final put+free to free memory */
 	void (*free_mark)(struct fsnotify_mark *mark);
 };
@@ -240,6 +241,19 @@ struct fsnotify_group {
 			int f_flags; /* event_f_flags from fanotify_init() */
 			unsigned int max_marks;
 			struct user_struct *user;
+			/* queued events hashed by merge identity */
+			struct hlist_head *merge_hash;
+			/* bound on the event pool */
+			unsigned int max_cached_events;
+			/* freed fixed size events kept for reuse */
+			spinlock_t event_pool_lock;
+			struct list_head event_pool;
+			unsigned int event_pool_len;
+			/* read events whose fd is opened on request */
+			spinlock_t deferred_lock;
+			struct idr deferred_idr;
+			struct list_head deferred_list;
+			unsigned int deferred_len;
 		} fanotify_data;
 #endif /* CONFIG_FANOTIFY */
 	};
@@ -485,12 +499,14 @@ extern void fsnotify_destroy_event(struct fsnotify_group *group,
 /* attach the event to the group notification queue */
 extern int fsnotify_add_event(struct fsnotify_group *group,
 			      struct fsnotify_event *event,
-			      int (*merge)(struct list_head *,
-					   struct fsnotify_event *));
+			      int (*merge)(struct fsnotify_group *,
+					   struct fsnotify_event *),
+			      void (*insert)(struct fsnotify_group *,
+					     struct fsnotify_event *));
 /* Queue overflow event to a notification group */
 static inline void fsnotify_queue_overflow(struct fsnotify_group *group)
 {
-	fsnotify_add_event(group, group->overflow_event, NULL);
+	fsnotify_add_event(group, group->overflow_event, NULL, NULL);
 }
 
 /* true if the group notification queue is empty */
@@ -63,6 +63,7 @@ struct ipc_namespace {
 	unsigned int    mq_msgsize_max;  /* initialized to DFLT_MSGSIZEMAX */
 	unsigned int    mq_msg_default;
 	unsigned int    mq_msgsize_default;
+	unsigned int    mq_zerocopy_min; /* 0 disables pinned handover */
 
 	/* user_ns which owns the ipc ns */
 	struct user_namespace *user_ns;
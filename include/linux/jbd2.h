@@ -28,6 +28,8 @@
 #include <linux/slab.h>
 #include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
 #include <crypto/hash.h>
 #endif
 
@@ -47,6 +49,12 @@
  */
 #define JBD2_DEFAULT_MAX_COMMIT_AGE 5
 
+/*
+ * The maximum number of credits a CPU takes from the running transaction
+ * at once when it starts a handle, see struct jbd2_credit_cache.
+ */
+#define JBD2_CREDIT_BATCH 64
+
 #ifdef CONFIG_JBD2_DEBUG
 /*
  * Define JBD2_EXPENSIVE_CHECKING to enable more expensive internal
@@ -468,6 +476,7 @@ struct jbd2_revoke_table_s;
  * @h_jdata: Flag to force data journaling.
  * @h_reserved: Flag for handle for reserved credits.
  * @h_aborted: Flag indicating fatal error on handle.
+ * @h_cached: Flag for handle counted in the credit cache, not in t_updates.
  * @h_type: For handle statistics.
  * @h_line_no: For handle statistics.
  * @h_start_jiffies: Handle Start time.
@@ -500,6 +509,7 @@ struct jbd2_journal_handle
 	unsigned int	h_jdata:	1;
 	unsigned int	h_reserved:	1;
 	unsigned int	h_aborted:	1;
+	unsigned int	h_cached:	1;
 	unsigned int	h_type:		8;
 	unsigned int	h_line_no:	16;
 
@@ -664,8 +674,8 @@ struct transaction_s
 	struct transaction_chp_stats_s t_chp_stats;
 
 	/*
-	 * Number of outstanding updates running on this transaction
-	 * [none]
+	 * Number of outstanding updates running on this transaction, apart
+	 * from those counted in the journal's credit caches [none]
 	 */
 	atomic_t		t_updates;
 
@@ -749,13 +759,33 @@ jbd2_time_diff(unsigned long start, unsigned long end)
 	return end + (MAX_JIFFY_OFFSET - start);
 }
 
-#define JBD2_NR_BATCH	64
+#define JBD2_NR_BATCH	256
 
 enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 
 #define JBD2_FC_REPLAY_STOP	0
 #define JBD2_FC_REPLAY_CONTINUE	1
 
+/*
+ * Handles take their credits from a per-CPU cache which is refilled from
+ * the running transaction JBD2_CREDIT_BATCH credits at a time, so that
+ * starting and stopping handles doesn't bounce t_outstanding_credits and
+ * t_handle_count between CPUs.  Cached credits are accounted in
+ * t_outstanding_credits; the caches are drained back into the running
+ * transaction once it is locked down for commit and all its handles are
+ * stopped.
+ *
+ * Handles started from the cache don't take j_state_lock and count
+ * themselves in cc_updates instead of t_updates.  A handle may stop on
+ * another CPU than it started on, so only the sum over all CPUs is
+ * meaningful, see jbd2_journal_updates().
+ */
+struct jbd2_credit_cache {
+	int	cc_credits;
+	int	cc_handles;
+	int	cc_updates;
+};
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -890,6 +920,14 @@ struct journal_s
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
 
+	/**
+	 * @j_checkpoint_work:
+	 *
+	 * Work item checkpointing transactions in the background once the
+	 * log starts filling up.
+	 */
+	struct work_struct	j_checkpoint_work;
+
 	/**
 	 * @j_head:
 	 *
@@ -996,6 +1034,22 @@ struct journal_s
 	 */
 	atomic_t		j_reserved_credits;
 
+	/**
+	 * @j_credit_cache:
+	 *
+	 * Per-CPU credits, handle and update counts of the running
+	 * transaction. [j_state_lock or cc_updates]
+	 */
+	struct jbd2_credit_cache __percpu *j_credit_cache;
+
+	/**
+	 * @j_credit_batch:
+	 *
+	 * Number of credits a CPU takes from the running transaction when its
+	 * credit cache runs dry. Zero disables the credit cache.
+	 */
+	int			j_credit_batch;
+
 	/**
 	 * @j_list_lock: Protects the buffer lists and internal buffer state.
 	 */
@@ -1354,6 +1408,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 						 * mode */
 #define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit is ongoing */
 #define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit is ongoing */
+#define JBD2_CKPT_STOPPED	0x400	/* Background checkpointing is stopped */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1438,6 +1493,8 @@ extern void		__wait_on_journal (journal_t *);
 extern void jbd2_journal_destroy_transaction_cache(void);
 extern int __init jbd2_journal_init_transaction_cache(void);
 extern void jbd2_journal_free_transaction(transaction_t *);
+extern void jbd2_journal_drain_credit_cache(journal_t *, transaction_t *);
+extern int jbd2_journal_updates(journal_t *, transaction_t *);
 
 /*
  * Journal locking.
@@ -1607,6 +1664,8 @@ int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
+void __jbd2_log_start_checkpoint(journal_t *journal);
+void jbd2_checkpoint_workfn(struct work_struct *work);
 extern void __jbd2_journal_drop_transaction(journal_t *, transaction_t *);
 extern int jbd2_cleanup_journal_tail(journal_t *);
 
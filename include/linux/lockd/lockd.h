@@ -16,6 +16,7 @@
 #include <linux/fs.h>
 #include <linux/kref.h>
 #include <linux/refcount.h>
+#include <linux/rhashtable-types.h>
 #include <linux/utsname.h>
 #include <linux/lockd/bind.h>
 #include <linux/lockd/xdr.h>
@@ -65,6 +66,7 @@ struct nlm_host {
 	spinlock_t		h_lock;
 	struct list_head	h_granted;	/* Locks in GRANTED state */
 	struct list_head	h_reclaim;	/* Locks in RECLAIM state */
+	struct list_head	h_files;	/* Files used by a client */
 	struct nsm_handle	*h_nsmhandle;	/* NSM status handle */
 	char			*h_addrbuf;	/* address eyecatcher */
 	struct net		*net;		/* host net */
@@ -152,7 +154,9 @@ struct nlm_rqst {
  * an NFS client.
  */
 struct nlm_file {
-	struct hlist_node	f_list;		/* linked list */
+	struct rhash_head	f_rhash;	/* file table linkage */
+	struct list_head	f_list;		/* linked list */
+	struct list_head	f_hosts;	/* clients using the file */
 	struct nfs_fh		f_handle;	/* NFS file handle */
 	struct file *		f_file;		/* VFS file pointer */
 	struct nlm_share *	f_shares;	/* DOS shares */
@@ -286,12 +290,15 @@ void		  nlmsvc_locks_init_private(struct file_lock *, struct nlm_host *, pid_t);
  * File handling for the server personality
  */
 __be32		  nlm_lookup_file(struct svc_rqst *, struct nlm_file **,
-					struct nfs_fh *);
+					struct nlm_host *, struct nfs_fh *);
 void		  nlm_release_file(struct nlm_file *);
 void		  nlmsvc_release_lockowner(struct nlm_lock *);
 void		  nlmsvc_mark_resources(struct net *);
 void		  nlmsvc_free_host_resources(struct nlm_host *);
+void		  nlmsvc_forget_host_files(struct nlm_host *);
 void		  nlmsvc_invalidate_all(void);
+int		  nlm_files_init(void);
+void		  nlm_files_exit(void);
 
 /*
  * Cluster failover support
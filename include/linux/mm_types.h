@@ -385,6 +385,7 @@ struct core_state {
 };
 
 struct kioctx_table;
+struct futex_private_hash;
 struct mm_struct {
 	struct {
 		struct vm_area_struct *mmap;		/* list of VMAs */
@@ -555,6 +556,10 @@ struct mm_struct {
 
 #ifdef CONFIG_IOMMU_SUPPORT
 		u32 pasid;
+#endif
+#ifdef CONFIG_FUTEX
+		/* PROCESS_PRIVATE futex hash, allocated on first use */
+		struct futex_private_hash *futex_hash;
 #endif
 	} __randomize_layout;
 
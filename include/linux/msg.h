@@ -8,6 +8,7 @@
 /* one msg_msg structure for each message */
 struct msg_msg {
 	struct list_head m_list;
+	struct list_head m_type_list;	/* SysV: messages of the same m_type */
 	long m_type;
 	size_t m_ts;		/* message text size */
 	struct msg_msgseg *next;
@@ -135,7 +135,8 @@ struct padata_shell {
  *             the client to communicate the minimum amount of work that's
  *             appropriate for one worker thread to do at once.
  * @max_threads: Max threads to use for the job, actual number may be less
- *               depending on task size and minimum chunk size.
+ *               depending on task size, minimum chunk size and the number of
+ *               CPUs the caller is allowed to run on.
  */
 struct padata_mt_job {
 	void (*thread_fn)(unsigned long start, unsigned long end, void *arg);
@@ -177,8 +178,15 @@ struct padata_instance {
 
 #ifdef CONFIG_PADATA
 extern void __init padata_init(void);
+extern void padata_do_multithreaded(struct padata_mt_job *job);
 #else
 static inline void __init padata_init(void) {}
+static inline void padata_do_multithreaded(struct padata_mt_job *job)
+{
+	if (job->size)
+		job->thread_fn(job->start, job->start + job->size,
+			       job->fn_arg);
+}
 #endif
 
 extern struct padata_instance *padata_alloc(const char *name);
@@ -188,7 +196,6 @@ extern void padata_free_shell(struct padata_shell *ps);
 extern int padata_do_parallel(struct padata_shell *ps,
 			      struct padata_priv *padata, int *cb_cpu);
 extern void padata_do_serial(struct padata_priv *padata);
-extern void __init padata_do_multithreaded(struct padata_mt_job *job);
 extern int padata_set_cpumask(struct padata_instance *pinst, int cpumask_type,
 			      cpumask_var_t cpumask);
 #endif
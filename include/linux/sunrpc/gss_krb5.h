@@ -37,6 +37,8 @@
  */
 
 #include <crypto/skcipher.h>
+#include <crypto/hash.h>
+#include <linux/mutex.h>
 #include <linux/sunrpc/auth_gss.h>
 #include <linux/sunrpc/gss_err.h>
 #include <linux/sunrpc/gss_asn1.h>
@@ -93,6 +95,18 @@ struct gss_krb5_enctype {
 #define KRB5_CTX_FLAG_CFX               0x00000002
 #define KRB5_CTX_FLAG_ACCEPTOR_SUBKEY   0x00000004
 
+/*
+ * A keyed checksum transform, plus a request and output buffer that are
+ * allocated along with it.  Whoever holds req_lock uses the preallocated
+ * pair; callers that find it busy allocate their own rather than wait.
+ */
+struct krb5_hmac {
+	struct crypto_ahash	*tfm;
+	struct ahash_request	*req;
+	u8			*cksumdata;
+	struct mutex		req_lock;
+};
+
 struct krb5_ctx {
 	int			initiate; /* 1 = initiating, 0 = accepting */
 	u32			enctype;
@@ -104,6 +118,10 @@ struct krb5_ctx {
 	struct crypto_sync_skcipher *initiator_enc;
 	struct crypto_sync_skcipher *acceptor_enc_aux;
 	struct crypto_sync_skcipher *initiator_enc_aux;
+	struct krb5_hmac	initiator_sign_hmac;
+	struct krb5_hmac	acceptor_sign_hmac;
+	struct krb5_hmac	initiator_integ_hmac;
+	struct krb5_hmac	acceptor_integ_hmac;
 	u8			Ksess[GSS_KRB5_MAX_KEYLEN]; /* session key */
 	u8			cksum[GSS_KRB5_MAX_KEYLEN];
 	atomic_t		seq_send;
@@ -239,8 +257,9 @@ make_checksum(struct krb5_ctx *kctx, char *header, int hdrlen,
 
 u32
 make_checksum_v2(struct krb5_ctx *, char *header, int hdrlen,
-		 struct xdr_buf *body, int body_offset, u8 *key,
-		 unsigned int usage, struct xdr_netobj *cksum);
+		 struct xdr_buf *body, int body_offset,
+		 struct krb5_hmac *hmac, unsigned int usage,
+		 struct xdr_netobj *cksum);
 
 u32 gss_get_mic_kerberos(struct gss_ctx *, struct xdr_buf *,
 		struct xdr_netobj *);
@@ -73,6 +73,19 @@ extern atomic_t rdma_stat_rq_prod;
 extern atomic_t rdma_stat_sq_poll;
 extern atomic_t rdma_stat_sq_prod;
 
+/* Page cache pages sent by RDMA Send keep their DMA mapping in a
+ * small per-transport cache, so that frequently read file data is
+ * not mapped and unmapped for every reply.
+ */
+#define SVC_RDMA_DMA_CACHE_BITS	6
+#define SVC_RDMA_DMA_CACHE_SIZE	(1 << SVC_RDMA_DMA_CACHE_BITS)
+
+struct svc_rdma_dma_cache {
+	struct page		*dc_page;
+	dma_addr_t		dc_addr;
+	unsigned int		dc_users;
+};
+
 struct svcxprt_rdma {
 	struct svc_xprt      sc_xprt;		/* SVC transport structure */
 	struct rdma_cm_id    *sc_cm_id;		/* RDMA connection id */
@@ -93,6 +106,8 @@ struct svcxprt_rdma {
 
 	spinlock_t	     sc_send_lock;
 	struct list_head     sc_send_ctxts;
+	struct list_head     sc_parked_ctxts;	/* Wait for QP drain */
+	struct llist_head    sc_send_batch;	/* Sends ready to post */
 	spinlock_t	     sc_rw_ctxt_lock;
 	struct list_head     sc_rw_ctxts;
 
@@ -112,9 +127,13 @@ struct svcxprt_rdma {
 	struct llist_head    sc_recv_ctxts;
 
 	atomic_t	     sc_completion_ids;
+
+	spinlock_t	     sc_dma_cache_lock;
+	struct svc_rdma_dma_cache sc_dma_cache[SVC_RDMA_DMA_CACHE_SIZE];
 };
 /* sc_flags */
 #define RDMAXPRT_CONN_PENDING	3
+#define RDMAXPRT_SQ_POSTING	4
 
 /*
  * Default connection parameters
@@ -154,6 +173,11 @@ struct svc_rdma_send_ctxt {
 	struct rpc_rdma_cid	sc_cid;
 
 	struct ib_send_wr	sc_send_wr;
+	struct ib_send_wr	*sc_wr_chain;
+	int			sc_sqecount;
+	bool			sc_writes_posted;
+	struct llist_node	sc_batch_node;
+	struct list_head	sc_write_info_list;
 	struct ib_cqe		sc_cqe;
 	struct xdr_buf		sc_hdrbuf;
 	struct xdr_stream	sc_stream;
@@ -161,6 +185,7 @@ struct svc_rdma_send_ctxt {
 	int			sc_page_count;
 	int			sc_cur_sge_no;
 	struct page		*sc_pages[RPCSVC_MAXPAGES];
+	u8			*sc_sge_slots;
 	struct ib_sge		sc_sges[];
 };
 
@@ -182,22 +207,30 @@ extern void svc_rdma_destroy_rw_ctxts(struct svcxprt_rdma *rdma);
 extern int svc_rdma_recv_read_chunk(struct svcxprt_rdma *rdma,
 				    struct svc_rqst *rqstp,
 				    struct svc_rdma_recv_ctxt *head, __be32 *p);
+extern void svc_rdma_write_chunk_release(struct svcxprt_rdma *rdma,
+					 struct svc_rdma_send_ctxt *sctxt);
 extern int svc_rdma_send_write_chunk(struct svcxprt_rdma *rdma,
+				     struct svc_rdma_send_ctxt *sctxt,
 				     __be32 *wr_ch, struct xdr_buf *xdr,
 				     unsigned int offset,
 				     unsigned long length);
 extern int svc_rdma_send_reply_chunk(struct svcxprt_rdma *rdma,
+				     struct svc_rdma_send_ctxt *sctxt,
 				     const struct svc_rdma_recv_ctxt *rctxt,
 				     struct xdr_buf *xdr);
 
 /* svc_rdma_sendto.c */
 extern void svc_rdma_send_ctxts_destroy(struct svcxprt_rdma *rdma);
+extern void svc_rdma_send_ctxts_unpark(struct svcxprt_rdma *rdma);
+extern void svc_rdma_dma_cache_destroy(struct svcxprt_rdma *rdma);
 extern struct svc_rdma_send_ctxt *
 		svc_rdma_send_ctxt_get(struct svcxprt_rdma *rdma);
 extern void svc_rdma_send_ctxt_put(struct svcxprt_rdma *rdma,
 				   struct svc_rdma_send_ctxt *ctxt);
 extern int svc_rdma_send(struct svcxprt_rdma *rdma,
 			 struct svc_rdma_send_ctxt *ctxt);
+extern int svc_rdma_post_writes(struct svcxprt_rdma *rdma,
+				struct svc_rdma_send_ctxt *ctxt);
 extern int svc_rdma_map_reply_msg(struct svcxprt_rdma *rdma,
 				  struct svc_rdma_send_ctxt *sctxt,
 				  const struct svc_rdma_recv_ctxt *rctxt,
@@ -3,6 +3,7 @@
 #define _UAPI_LINUX_FANOTIFY_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /* the following events that user-space can register for */
 #define FAN_ACCESS		0x00000001	/* File was accessed */
@@ -59,6 +60,14 @@
 /* Convenience macro - FAN_REPORT_NAME requires FAN_REPORT_DIR_FID */
 #define FAN_REPORT_DFID_NAME	(FAN_REPORT_DIR_FID | FAN_REPORT_NAME)
 
+/*
+ * Do not open an fd for every event read.  metadata->fd holds a token which
+ * can be passed to FAN_IOC_OPEN_FD to open the object of the event later.
+ * Until its token is used or expires, an event holds a reference on the
+ * path of the object, so unmounting the filesystem fails with EBUSY.
+ */
+#define FAN_DEFER_FD		0x00100000
+
 /* Deprecated - do not use this in programs and do not add new flags here! */
 #define FAN_ALL_INIT_FLAGS	(FAN_CLOEXEC | FAN_NONBLOCK | \
 				 FAN_ALL_CLASS_BITS | FAN_UNLIMITED_QUEUE |\
@@ -161,6 +170,14 @@ struct fanotify_response {
 /* No fd set in event */
 #define FAN_NOFD	-1
 
+/*
+ * Open the object of an event read by a FAN_DEFER_FD group.  The argument
+ * points to the token reported in metadata->fd and the new fd is returned.
+ * Each token can be used once; unused tokens expire after 128 newer events
+ * and all of them are dropped when the group is closed.
+ */
+#define FAN_IOC_OPEN_FD	_IOW('F', 0x40, __s32)
+
 /* Helper functions to deal with fanotify_event_metadata buffers */
 #define FAN_EVENT_METADATA_LEN (sizeof(struct fanotify_event_metadata))
 
@@ -21,6 +21,11 @@
 #define FUTEX_WAKE_BITSET	10
 #define FUTEX_WAIT_REQUEUE_PI	11
 #define FUTEX_CMP_REQUEUE_PI	12
+/*
+ * 13 is FUTEX_LOCK_PI2 upstream, and 31 is taken by an out-of-tree
+ * FUTEX_WAIT_MULTIPLE with a different layout and relative timeouts.
+ */
+#define FUTEX_WAIT_MULTIPLE	14
 
 #define FUTEX_PRIVATE_FLAG	128
 #define FUTEX_CLOCK_REALTIME	256
@@ -40,6 +45,22 @@
 					 FUTEX_PRIVATE_FLAG)
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE	(FUTEX_CMP_REQUEUE_PI | \
 					 FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAIT_MULTIPLE_PRIVATE	(FUTEX_WAIT_MULTIPLE | \
+					 FUTEX_PRIVATE_FLAG)
+
+/*
+ * Array element for FUTEX_WAIT_MULTIPLE. The futex syscall is passed the
+ * address of an array of these in place of the futex address, and the
+ * number of elements in place of the expected value.
+ */
+struct futex_wait_block {
+	__u64 uaddr;
+	__u32 val;
+	__u32 bitset;
+};
+
+/* Maximum number of futexes FUTEX_WAIT_MULTIPLE can wait on at once */
+#define FUTEX_WAIT_MULTIPLE_MAX	128
 
 /*
  * Support for robust futexes: the kernel cleans up held futexes at
@@ -93,6 +93,15 @@ static struct ctl_table mq_sysctls[] = {
 		.extra1		= &msg_maxsize_limit_min,
 		.extra2		= &msg_maxsize_limit_max,
 	},
+	{
+		.procname	= "zerocopy_min",
+		.data		= &init_ipc_ns.mq_zerocopy_min,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_mq_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &msg_maxsize_limit_max,
+	},
 	{}
 };
 
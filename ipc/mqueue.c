@@ -16,6 +16,9 @@
 #include <linux/capability.h>
 #include <linux/init.h>
 #include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/uio.h>
+#include <linux/completion.h>
 #include <linux/file.h>
 #include <linux/mount.h>
 #include <linux/fs_context.h>
@@ -39,6 +42,7 @@
 #include <linux/sched/wake_q.h>
 #include <linux/sched/signal.h>
 #include <linux/sched/user.h>
+#include <linux/security.h>
 
 #include <net/sock.h>
 #include "util.h"
@@ -57,6 +61,12 @@ struct mqueue_fs_context {
 #define STATE_NONE	0
 #define STATE_READY	1
 
+/* Recycled msg_msg chains kept per queue, see mq_load_msg() */
+#define MQ_MSG_CACHE_MAX	8
+
+/* Largest sender buffer, in pages, that is handed over pinned */
+#define MQ_ZEROCOPY_MAX_PAGES	32
+
 struct posix_msg_tree_node {
 	struct rb_node		rb_node;
 	struct list_head	msg_list;
@@ -123,10 +133,26 @@ struct posix_msg_tree_node {
  *    acquire memory barrier.
  */
 
+/*
+ * A sender buffer pinned by mq_zerocopy_send() and handed to a waiting
+ * receiver in place of a msg_msg.  It lives on the sender's stack; the
+ * sender sleeps on @done until the receiver has copied the payload out.
+ */
+struct mq_zerocopy {
+	struct page *pages[MQ_ZEROCOPY_MAX_PAGES];
+	unsigned int nr_pages;
+	unsigned int offset;	/* of the payload in pages[0] */
+	size_t len;
+	unsigned int prio;
+	bool consumed;		/* set by the receiver */
+	struct completion done;
+};
+
 struct ext_wait_queue {		/* queue of sleeping tasks */
 	struct task_struct *task;
 	struct list_head list;
 	struct msg_msg *msg;	/* ptr of loaded message */
+	struct mq_zerocopy *zc;	/* or pinned sender buffer, receivers only */
 	int state;		/* one of STATE_* values */
 };
 
@@ -140,6 +166,11 @@ struct mqueue_inode_info {
 	struct posix_msg_tree_node *node_cache;
 	struct mq_attr attr;
 
+	/* free full sized msg_msg chains, see mq_load_msg() */
+	struct list_head msg_cache;
+	unsigned int msg_cache_count;
+	unsigned int zerocopy_min;	/* from the ns sysctl at creation */
+
 	struct sigevent notify;
 	struct pid *notify_owner;
 	u32 notify_self_exec_id;
@@ -334,6 +365,9 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 			info->attr.mq_maxmsg = attr->mq_maxmsg;
 			info->attr.mq_msgsize = attr->mq_msgsize;
 		}
+		INIT_LIST_HEAD(&info->msg_cache);
+		info->msg_cache_count = 0;
+		info->zerocopy_min = ipc_ns->mq_zerocopy_min;
 		/*
 		 * We used to allocate a static array of pointers and account
 		 * the size of that array as well as one msg_msg struct per
@@ -512,6 +546,8 @@ static void mqueue_evict_inode(struct inode *inode)
 	spin_lock(&info->lock);
 	while ((msg = msg_get(info)) != NULL)
 		list_add_tail(&msg->m_list, &tmp_msg);
+	list_splice_tail_init(&info->msg_cache, &tmp_msg);
+	info->msg_cache_count = 0;
 	kfree(info->node_cache);
 	spin_unlock(&info->lock);
 
@@ -1041,6 +1077,229 @@ static inline void pipelined_receive(struct wake_q_head *wake_q,
 	__pipelined_op(wake_q, info, sender);
 }
 
+/*
+ * Queues with large messages spend much of their time allocating and
+ * freeing multi-page msg_msg chains.  Messages longer than half the queue's
+ * msgsize are therefore always allocated at full msgsize, and up to
+ * MQ_MSG_CACHE_MAX of those chains are recycled through info->msg_cache
+ * once received.  Cached chains plus queued messages never exceed
+ * mq_maxmsg, so the cache stays within what was accounted in mq_bytes.
+ */
+static inline bool mq_msg_cacheable(struct mqueue_inode_info *info,
+				    size_t len)
+{
+	return info->attr.mq_msgsize > PAGE_SIZE &&
+	       len > info->attr.mq_msgsize / 2;
+}
+
+static struct msg_msg *mq_load_msg(struct mqueue_inode_info *info,
+				   const char __user *u_msg_ptr, size_t len)
+{
+	struct msg_msg *msg = NULL;
+	struct iovec iov;
+	struct iov_iter from;
+	int err;
+
+	if (!mq_msg_cacheable(info, len))
+		return load_msg(u_msg_ptr, len);
+
+	err = import_single_range(WRITE, (void __user *)u_msg_ptr, len,
+				  &iov, &from);
+	if (err)
+		return ERR_PTR(err);
+
+	spin_lock(&info->lock);
+	if (info->msg_cache_count) {
+		msg = list_first_entry(&info->msg_cache, struct msg_msg,
+				       m_list);
+		list_del(&msg->m_list);
+		info->msg_cache_count--;
+	}
+	spin_unlock(&info->lock);
+
+	if (!msg) {
+		msg = alloc_msg(info->attr.mq_msgsize);
+		if (!msg)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	err = fill_msg(msg, &from, len);
+	if (err) {
+		free_msg(msg);
+		return ERR_PTR(err);
+	}
+
+	return msg;
+}
+
+static void mq_free_msg(struct mqueue_inode_info *info, struct msg_msg *msg)
+{
+	if (mq_msg_cacheable(info, msg->m_ts)) {
+		/* the LSM blob is reattached by fill_msg() on reuse */
+		security_msg_msg_free(msg);
+
+		spin_lock(&info->lock);
+		if (info->msg_cache_count < MQ_MSG_CACHE_MAX &&
+		    info->msg_cache_count + info->attr.mq_curmsgs <
+		    info->attr.mq_maxmsg) {
+			list_add(&msg->m_list, &info->msg_cache);
+			info->msg_cache_count++;
+			msg = NULL;
+		}
+		spin_unlock(&info->lock);
+	}
+
+	if (msg)
+		free_msg(msg);
+}
+
+/*
+ * mq_zerocopy_send() - hand the sender's buffer directly to a waiting
+ * receiver.  The buffer is pinned and the receiver copies straight from it
+ * into its own buffer, so the message is copied once and never allocated.
+ * Only used when a receiver is already waiting, i.e. the queue is empty;
+ * returns false if the caller has to go through the regular path.
+ */
+static bool mq_zerocopy_send(struct mqueue_inode_info *info,
+			     struct inode *inode, const char __user *u_msg_ptr,
+			     size_t msg_len, unsigned int msg_prio)
+{
+	unsigned long start = (unsigned long)u_msg_ptr;
+	struct ext_wait_queue *receiver;
+	struct mq_zerocopy zc;
+	int nr_pages, pinned;
+	DEFINE_WAKE_Q(wake_q);
+
+	/* racy, rechecked under info->lock */
+	if (list_empty_careful(&info->e_wait_q[RECV].list))
+		return false;
+
+	nr_pages = DIV_ROUND_UP(offset_in_page(start) + msg_len, PAGE_SIZE);
+	if (nr_pages > MQ_ZEROCOPY_MAX_PAGES)
+		return false;
+
+	pinned = pin_user_pages_fast(start & PAGE_MASK, nr_pages, 0, zc.pages);
+	if (pinned != nr_pages) {
+		if (pinned > 0)
+			unpin_user_pages(zc.pages, pinned);
+		return false;
+	}
+
+	zc.nr_pages = nr_pages;
+	zc.offset = offset_in_page(start);
+	zc.len = msg_len;
+	zc.prio = msg_prio;
+	zc.consumed = false;
+	init_completion(&zc.done);
+
+	spin_lock(&info->lock);
+	receiver = wq_get_first_waiter(info, RECV);
+	if (receiver) {
+		receiver->msg = NULL;
+		receiver->zc = &zc;
+		__pipelined_op(&wake_q, info, receiver);
+		inode->i_atime = inode->i_mtime = inode->i_ctime =
+				current_time(inode);
+	}
+	spin_unlock(&info->lock);
+
+	if (receiver) {
+		wake_up_q(&wake_q);
+		/* bounded: the receiver copies with page faults disabled */
+		wait_for_completion(&zc.done);
+	}
+
+	unpin_user_pages(zc.pages, nr_pages);
+	return zc.consumed;
+}
+
+/*
+ * Slow path of mq_zerocopy_recv(): the receive buffer isn't faulted in, so
+ * copy the pinned pages into a msg_msg that the receiver can store once the
+ * sender has been released.
+ */
+static struct msg_msg *mq_zerocopy_load(struct mq_zerocopy *zc)
+{
+	unsigned int i, offset = zc->offset;
+	size_t len = zc->len;
+	struct bio_vec *bvec;
+	struct iov_iter from;
+	struct msg_msg *msg;
+
+	bvec = kmalloc_array(zc->nr_pages, sizeof(*bvec), GFP_KERNEL);
+	if (!bvec)
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < zc->nr_pages; i++) {
+		bvec[i].bv_page = zc->pages[i];
+		bvec[i].bv_offset = offset;
+		bvec[i].bv_len = min_t(size_t, PAGE_SIZE - offset, len);
+		len -= bvec[i].bv_len;
+		offset = 0;
+	}
+
+	iov_iter_bvec(&from, WRITE, bvec, zc->nr_pages, zc->len);
+	msg = load_msg_iter(&from, zc->len);
+	kfree(bvec);
+
+	return msg;
+}
+
+/*
+ * mq_zerocopy_recv() - receive a message handed over by mq_zerocopy_send().
+ * The sender sleeps uninterruptibly until we complete zc->done, so nothing
+ * here may wait for our own page faults: the direct copy runs under
+ * kmap_atomic(), which disables them.  If the message was lost (-ENOMEM),
+ * zc->consumed stays false and the sender queues it the regular way.
+ */
+static ssize_t mq_zerocopy_recv(struct mq_zerocopy *zc,
+				char __user *u_msg_ptr,
+				unsigned int __user *u_msg_prio)
+{
+	unsigned int i, offset = zc->offset;
+	unsigned int prio = zc->prio;
+	size_t len = zc->len, copied = 0;
+	struct msg_msg *msg = NULL;
+	ssize_t ret;
+
+	if (access_ok(u_msg_ptr, len)) {
+		for (i = 0; i < zc->nr_pages; i++) {
+			size_t chunk = min_t(size_t, PAGE_SIZE - offset,
+					     len - copied);
+			unsigned long left;
+			void *src;
+
+			src = kmap_atomic(zc->pages[i]);
+			left = __copy_to_user_inatomic(u_msg_ptr + copied,
+						       src + offset, chunk);
+			kunmap_atomic(src);
+			if (left)
+				break;
+			copied += chunk;
+			offset = 0;
+		}
+	}
+
+	if (copied < len)
+		msg = mq_zerocopy_load(zc);
+
+	zc->consumed = !IS_ERR(msg);
+	complete(&zc->done);
+	/* zc is on the sender's stack and must not be touched from here on */
+
+	if (IS_ERR(msg))
+		return PTR_ERR(msg);
+
+	ret = len;
+	if ((u_msg_prio && put_user(prio, u_msg_prio)) ||
+	    (msg && store_msg(u_msg_ptr, msg, len)))
+		ret = -EFAULT;
+	if (msg)
+		free_msg(msg);
+
+	return ret;
+}
+
 static int do_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 		size_t msg_len, unsigned int msg_prio,
 		struct timespec64 *ts)
@@ -1090,9 +1349,13 @@ static int do_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 		goto out_fput;
 	}
 
+	if (info->zerocopy_min && msg_len >= info->zerocopy_min &&
+	    mq_zerocopy_send(info, inode, u_msg_ptr, msg_len, msg_prio))
+		goto out_fput;
+
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
-	msg_ptr = load_msg(u_msg_ptr, msg_len);
+	msg_ptr = mq_load_msg(info, u_msg_ptr, msg_len);
 	if (IS_ERR(msg_ptr)) {
 		ret = PTR_ERR(msg_ptr);
 		goto out_fput;
@@ -1154,7 +1417,7 @@ static int do_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	wake_up_q(&wake_q);
 out_free:
 	if (ret)
-		free_msg(msg_ptr);
+		mq_free_msg(info, msg_ptr);
 out_fput:
 	fdput(f);
 out:
@@ -1230,11 +1493,17 @@ static int do_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 			ret = -EAGAIN;
 		} else {
 			wait.task = current;
+			wait.zc = NULL;
 
 			/* memory barrier not required, we hold info->lock */
 			WRITE_ONCE(wait.state, STATE_NONE);
 			ret = wq_sleep(info, RECV, timeout, &wait);
 			msg_ptr = wait.msg;
+			if (ret == 0 && wait.zc) {
+				ret = mq_zerocopy_recv(wait.zc, u_msg_ptr,
+						       u_msg_prio);
+				goto out_fput;
+			}
 		}
 	} else {
 		DEFINE_WAKE_Q(wake_q);
@@ -1257,7 +1526,7 @@ static int do_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 			store_msg(u_msg_ptr, msg_ptr, msg_ptr->m_ts)) {
 			ret = -EFAULT;
 		}
-		free_msg(msg_ptr);
+		mq_free_msg(info, msg_ptr);
 	}
 out_fput:
 	fdput(f);
@@ -1680,6 +1949,7 @@ int mq_init_ns(struct ipc_namespace *ns)
 	ns->mq_msgsize_max   = DFLT_MSGSIZEMAX;
 	ns->mq_msg_default   = DFLT_MSG;
 	ns->mq_msgsize_default  = DFLT_MSGSIZE;
+	ns->mq_zerocopy_min  = 0;
 
 	m = mq_create_mount(ns);
 	if (IS_ERR(m))
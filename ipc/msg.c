@@ -39,11 +39,32 @@
 #include <linux/nsproxy.h>
 #include <linux/ipc_namespace.h>
 #include <linux/rhashtable.h>
+#include <linux/rbtree.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
 
 #include <asm/current.h>
 #include <linux/uaccess.h>
 #include "util.h"
 
+/*
+ * Recycled single allocation message buffers, one per power of two size
+ * class from 1 << MSG_CACHE_MIN_SHIFT up to PAGE_SIZE.  See msg_cache_get().
+ */
+#define MSG_CACHE_MIN_SHIFT	6
+#define MSG_CACHE_CLASSES	(PAGE_SHIFT - MSG_CACHE_MIN_SHIFT + 1)
+
+/*
+ * Queued messages are additionally indexed by type, so that msgrcv() with
+ * msgtyp != 0 doesn't have to scan q_messages.  One node per distinct type
+ * currently queued, holding its messages in FIFO order.
+ */
+struct msg_type_node {
+	struct rb_node		rb_node;
+	struct list_head	msg_list;
+	long			type;
+};
+
 /* one msq_queue structure for each present queue on the system */
 struct msg_queue {
 	struct kern_ipc_perm q_perm;
@@ -59,6 +80,12 @@ struct msg_queue {
 	struct list_head q_messages;
 	struct list_head q_receivers;
 	struct list_head q_senders;
+
+	struct rb_root_cached q_types;	/* struct msg_type_node by type */
+	struct msg_type_node *q_node_cache;
+
+	/* free message buffers, exchanged locklessly under RCU */
+	struct msg_msg *q_cache[MSG_CACHE_CLASSES];
 } __randomize_layout;
 
 /*
@@ -128,6 +155,11 @@ static void msg_rcu_free(struct rcu_head *head)
 {
 	struct kern_ipc_perm *p = container_of(head, struct kern_ipc_perm, rcu);
 	struct msg_queue *msq = container_of(p, struct msg_queue, q_perm);
+	int i;
+
+	/* cached buffers are single allocations without an LSM blob */
+	for (i = 0; i < MSG_CACHE_CLASSES; i++)
+		kfree(msq->q_cache[i]);
 
 	security_msg_queue_free(&msq->q_perm);
 	kvfree(msq);
@@ -169,6 +201,9 @@ static int newque(struct ipc_namespace *ns, struct ipc_params *params)
 	INIT_LIST_HEAD(&msq->q_messages);
 	INIT_LIST_HEAD(&msq->q_receivers);
 	INIT_LIST_HEAD(&msq->q_senders);
+	msq->q_types = RB_ROOT_CACHED;
+	msq->q_node_cache = NULL;
+	memset(msq->q_cache, 0, sizeof(msq->q_cache));
 
 	/* ipc_addid() locks msq upon success. */
 	retval = ipc_addid(&msg_ids(ns), &msq->q_perm, ns->msg_ctlmni);
@@ -183,6 +218,159 @@ static int newque(struct ipc_namespace *ns, struct ipc_params *params)
 	return msq->q_perm.id;
 }
 
+static int msg_type_insert(struct msg_queue *msq, struct msg_msg *msg)
+{
+	struct rb_node **p = &msq->q_types.rb_root.rb_node, *parent = NULL;
+	struct msg_type_node *node;
+	bool leftmost = true;
+
+	while (*p) {
+		parent = *p;
+		node = rb_entry(parent, struct msg_type_node, rb_node);
+
+		if (node->type == msg->m_type)
+			goto insert_msg;
+		if (msg->m_type < node->type) {
+			p = &parent->rb_left;
+		} else {
+			p = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	if (msq->q_node_cache) {
+		node = msq->q_node_cache;
+		msq->q_node_cache = NULL;
+	} else {
+		node = kmalloc(sizeof(*node), GFP_ATOMIC);
+		if (!node)
+			return -ENOMEM;
+	}
+	node->type = msg->m_type;
+	INIT_LIST_HEAD(&node->msg_list);
+	rb_link_node(&node->rb_node, parent, p);
+	rb_insert_color_cached(&node->rb_node, &msq->q_types, leftmost);
+insert_msg:
+	list_add_tail(&msg->m_type_list, &node->msg_list);
+	return 0;
+}
+
+static void msg_type_remove(struct msg_queue *msq, struct msg_msg *msg)
+{
+	struct list_head *next = msg->m_type_list.next;
+	struct msg_type_node *node;
+
+	list_del(&msg->m_type_list);
+	/* only the node's list head remains: it was the last of its type */
+	if (!list_empty(next))
+		return;
+
+	node = list_entry(next, struct msg_type_node, msg_list);
+	rb_erase_cached(&node->rb_node, &msq->q_types);
+	if (msq->q_node_cache)
+		kfree(node);
+	else
+		msq->q_node_cache = node;
+}
+
+static struct msg_type_node *msg_type_find(struct msg_queue *msq, long type)
+{
+	struct rb_node *rb = msq->q_types.rb_root.rb_node;
+
+	while (rb) {
+		struct msg_type_node *node;
+
+		node = rb_entry(rb, struct msg_type_node, rb_node);
+		if (node->type == type)
+			return node;
+		if (type < node->type)
+			rb = rb->rb_left;
+		else
+			rb = rb->rb_right;
+	}
+
+	return NULL;
+}
+
+/*
+ * Message buffers that fit in a single allocation of at most PAGE_SIZE are
+ * allocated with their size rounded up to a power of two, and recycled per
+ * queue once received.  Returns the size class or -1 if @msgsz is too large.
+ */
+static inline int msg_cache_class(size_t msgsz)
+{
+	size_t size = sizeof(struct msg_msg) + msgsz;
+
+	if (size > PAGE_SIZE)
+		return -1;
+
+	return max_t(int, order_base_2(size), MSG_CACHE_MIN_SHIFT) -
+	       MSG_CACHE_MIN_SHIFT;
+}
+
+/*
+ * The cache slots are only exchanged with xchg() and cmpxchg(), so senders
+ * may take a buffer under rcu_read_lock() without the queue lock, before
+ * they copy the message in.  msg_rcu_free() drains them.
+ */
+static inline struct msg_msg *msg_cache_get(struct msg_queue *msq,
+					    size_t msgsz)
+{
+	int class = msg_cache_class(msgsz);
+
+	if (class < 0 || !READ_ONCE(msq->q_cache[class]))
+		return NULL;
+
+	return xchg(&msq->q_cache[class], NULL);
+}
+
+/* Caller holds a reference to @msq. */
+static void msg_cache_put(struct msg_queue *msq, struct msg_msg *msg)
+{
+	int class = msg_cache_class(msg->m_ts);
+
+	/* the LSM blob is reattached by fill_msg() on reuse */
+	security_msg_msg_free(msg);
+	if (cmpxchg(&msq->q_cache[class], NULL, msg) != NULL)
+		free_msg(msg);
+}
+
+/*
+ * Like load_msg(), but buffers of a cacheable size are allocated at the full
+ * size of their class so they can be recycled; @msg is a buffer taken from
+ * the cache by msg_cache_get() or NULL.
+ */
+static struct msg_msg *msg_load(struct msg_msg *msg, void __user *mtext,
+				size_t msgsz)
+{
+	int class = msg_cache_class(msgsz);
+	struct iovec iov;
+	struct iov_iter from;
+	int err;
+
+	if (class < 0)
+		return load_msg(mtext, msgsz);
+
+	err = import_single_range(WRITE, mtext, msgsz, &iov, &from);
+	if (err)
+		goto out_free;
+
+	if (!msg) {
+		msg = alloc_msg((1UL << (class + MSG_CACHE_MIN_SHIFT)) -
+				sizeof(struct msg_msg));
+		if (!msg)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	err = fill_msg(msg, &from, msgsz);
+	if (!err)
+		return msg;
+out_free:
+	if (msg)
+		free_msg(msg);
+	return ERR_PTR(err);
+}
+
 static inline bool msg_fits_inqueue(struct msg_queue *msq, size_t msgsz)
 {
 	return msgsz + msq->q_cbytes <= msq->q_qbytes &&
@@ -272,6 +460,7 @@ static void freeque(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	__releases(&msq->q_perm)
 {
 	struct msg_msg *msg, *t;
+	struct msg_type_node *node, *n;
 	struct msg_queue *msq = container_of(ipcp, struct msg_queue, q_perm);
 	DEFINE_WAKE_Q(wake_q);
 
@@ -286,6 +475,10 @@ static void freeque(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 		atomic_dec(&ns->msg_hdrs);
 		free_msg(msg);
 	}
+	rbtree_postorder_for_each_entry_safe(node, n, &msq->q_types.rb_root,
+					     rb_node)
+		kfree(node);
+	kfree(msq->q_node_cache);
 	atomic_sub(msq->q_cbytes, &ns->msg_bytes);
 	ipc_update_pid(&msq->q_lspid, NULL);
 	ipc_update_pid(&msq->q_lrpid, NULL);
@@ -841,7 +1034,9 @@ static long do_msgsnd(int msqid, long mtype, void __user *mtext,
 		size_t msgsz, int msgflg)
 {
 	struct msg_queue *msq;
-	struct msg_msg *msg;
+	struct msg_msg *msg = NULL;
+	struct msg_type_node *new_node = NULL;
+	bool need_node = false;
 	int err;
 	struct ipc_namespace *ns;
 	DEFINE_WAKE_Q(wake_q);
@@ -853,10 +1048,30 @@ static long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	if (mtype < 1)
 		return -EINVAL;
 
-	msg = load_msg(mtext, msgsz);
+	/*
+	 * Pick up a recycled buffer and find out whether the type index may
+	 * need a node, without taking the queue lock.  Errors are reported
+	 * by the lookup below.
+	 */
+	rcu_read_lock();
+	msq = msq_obtain_object_check(ns, msqid);
+	if (!IS_ERR(msq)) {
+		msg = msg_cache_get(msq, msgsz);
+		need_node = !READ_ONCE(msq->q_node_cache);
+	}
+	rcu_read_unlock();
+
+	msg = msg_load(msg, mtext, msgsz);
 	if (IS_ERR(msg))
 		return PTR_ERR(msg);
 
+	/*
+	 * msg_type_insert() wants a spare node so it doesn't have to fall
+	 * back to a GFP_ATOMIC allocation for a new type.
+	 */
+	if (need_node)
+		new_node = kmalloc(sizeof(*new_node), GFP_KERNEL);
+
 	msg->m_type = mtype;
 	msg->m_ts = msgsz;
 
@@ -925,11 +1140,19 @@ static long do_msgsnd(int msqid, long mtype, void __user *mtext,
 
 	}
 
+	if (!msq->q_node_cache && new_node) {
+		msq->q_node_cache = new_node;
+		new_node = NULL;
+	}
+
 	ipc_update_pid(&msq->q_lspid, task_tgid(current));
 	msq->q_stime = ktime_get_real_seconds();
 
 	if (!pipelined_send(msq, msg, &wake_q)) {
 		/* no one is waiting for this message, enqueue it */
+		err = msg_type_insert(msq, msg);
+		if (err)
+			goto out_unlock0;
 		list_add_tail(&msg->m_list, &msq->q_messages);
 		msq->q_cbytes += msgsz;
 		msq->q_qnum++;
@@ -945,6 +1168,7 @@ static long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	wake_up_q(&wake_q);
 out_unlock1:
 	rcu_read_unlock();
+	kfree(new_node);
 	if (msg != NULL)
 		free_msg(msg);
 	return err;
@@ -1063,19 +1287,53 @@ static inline void free_copy(struct msg_msg *copy)
 }
 #endif
 
+/*
+ * SEARCH_EQUAL and SEARCH_LESSEQUAL go through the type index: the first
+ * acceptable message of the lowest matching type is the one the linear
+ * scan of q_messages would have picked.
+ */
+static struct msg_msg *find_msg_typed(struct msg_queue *msq, long msgtyp,
+				      int mode)
+{
+	struct msg_type_node *node;
+	struct rb_node *rb;
+	struct msg_msg *msg;
+
+	if (mode == SEARCH_EQUAL) {
+		node = msg_type_find(msq, msgtyp);
+		rb = node ? &node->rb_node : NULL;
+	} else {
+		rb = rb_first_cached(&msq->q_types);
+	}
+
+	for (; rb; rb = rb_next(rb)) {
+		node = rb_entry(rb, struct msg_type_node, rb_node);
+		if (node->type > msgtyp)
+			break;
+
+		list_for_each_entry(msg, &node->msg_list, m_type_list) {
+			if (!security_msg_queue_msgrcv(&msq->q_perm, msg,
+						       current, msgtyp, mode))
+				return msg;
+		}
+	}
+
+	return ERR_PTR(-EAGAIN);
+}
+
 static struct msg_msg *find_msg(struct msg_queue *msq, long *msgtyp, int mode)
 {
-	struct msg_msg *msg, *found = NULL;
+	struct msg_msg *msg;
 	long count = 0;
 
+	if (mode == SEARCH_EQUAL || mode == SEARCH_LESSEQUAL)
+		return find_msg_typed(msq, *msgtyp, mode);
+
 	list_for_each_entry(msg, &msq->q_messages, m_list) {
 		if (testmsg(msg, *msgtyp, mode) &&
 		    !security_msg_queue_msgrcv(&msq->q_perm, msg, current,
 					       *msgtyp, mode)) {
-			if (mode == SEARCH_LESSEQUAL && msg->m_type != 1) {
-				*msgtyp = msg->m_type - 1;
-				found = msg;
-			} else if (mode == SEARCH_NUMBER) {
+			if (mode == SEARCH_NUMBER) {
 				if (*msgtyp == count)
 					return msg;
 			} else
@@ -1084,7 +1342,7 @@ static struct msg_msg *find_msg(struct msg_queue *msq, long *msgtyp, int mode)
 		}
 	}
 
-	return found ?: ERR_PTR(-EAGAIN);
+	return ERR_PTR(-EAGAIN);
 }
 
 static long do_msgrcv(int msqid, void __user *buf, size_t bufsz, long msgtyp, int msgflg,
@@ -1094,6 +1352,7 @@ static long do_msgrcv(int msqid, void __user *buf, size_t bufsz, long msgtyp, in
 	struct msg_queue *msq;
 	struct ipc_namespace *ns;
 	struct msg_msg *msg, *copy = NULL;
+	bool recycle = false;
 	DEFINE_WAKE_Q(wake_q);
 
 	ns = current->nsproxy->ipc_ns;
@@ -1153,6 +1412,7 @@ static long do_msgrcv(int msqid, void __user *buf, size_t bufsz, long msgtyp, in
 			}
 
 			list_del(&msg->m_list);
+			msg_type_remove(msq, msg);
 			msq->q_qnum--;
 			msq->q_rtime = ktime_get_real_seconds();
 			ipc_update_pid(&msq->q_lrpid, task_tgid(current));
@@ -1241,6 +1501,10 @@ static long do_msgrcv(int msqid, void __user *buf, size_t bufsz, long msgtyp, in
 	ipc_unlock_object(&msq->q_perm);
 	wake_up_q(&wake_q);
 out_unlock1:
+	/* keep msq around to give the buffer back to its cache */
+	if (!IS_ERR(msg) && !(msgflg & MSG_COPY) &&
+	    msg_cache_class(msg->m_ts) >= 0)
+		recycle = ipc_rcu_getref(&msq->q_perm);
 	rcu_read_unlock();
 	if (IS_ERR(msg)) {
 		free_copy(copy);
@@ -1248,7 +1512,12 @@ static long do_msgrcv(int msqid, void __user *buf, size_t bufsz, long msgtyp, in
 	}
 
 	bufsz = msg_handler(buf, msg, bufsz);
-	free_msg(msg);
+	if (recycle) {
+		msg_cache_put(msq, msg);
+		ipc_rcu_putref(&msq->q_perm, msg_rcu_free);
+	} else {
+		free_msg(msg);
+	}
 
 	return bufsz;
 }
@@ -14,6 +14,7 @@
 #include <linux/utsname.h>
 #include <linux/proc_ns.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/sched.h>
 
 #include "util.h"
@@ -43,7 +44,11 @@ struct msg_msgseg {
 #define DATALEN_SEG	((size_t)PAGE_SIZE-sizeof(struct msg_msgseg))
 
 
-static struct msg_msg *alloc_msg(size_t len)
+/*
+ * alloc_msg - allocate a message chain able to hold @len bytes of payload.
+ * The chain is not labeled; fill_msg() does that once the payload is in.
+ */
+struct msg_msg *alloc_msg(size_t len)
 {
 	struct msg_msg *msg;
 	struct msg_msgseg **pseg;
@@ -81,38 +86,59 @@ static struct msg_msg *alloc_msg(size_t len)
 	return NULL;
 }
 
-struct msg_msg *load_msg(const void __user *src, size_t len)
+/*
+ * fill_msg - copy @len bytes from @from into a chain returned by alloc_msg()
+ * and attach the LSM label.  The chain may be larger than @len, which lets
+ * POSIX message queues recycle full sized chains for shorter messages.
+ */
+int fill_msg(struct msg_msg *msg, struct iov_iter *from, size_t len)
 {
-	struct msg_msg *msg;
 	struct msg_msgseg *seg;
-	int err = -EFAULT;
 	size_t alen;
 
-	msg = alloc_msg(len);
-	if (msg == NULL)
-		return ERR_PTR(-ENOMEM);
-
 	alen = min(len, DATALEN_MSG);
-	if (copy_from_user(msg + 1, src, alen))
-		goto out_err;
+	if (!copy_from_iter_full(msg + 1, alen, from))
+		return -EFAULT;
 
-	for (seg = msg->next; seg != NULL; seg = seg->next) {
+	for (seg = msg->next; seg != NULL && len > alen; seg = seg->next) {
 		len -= alen;
-		src = (char __user *)src + alen;
 		alen = min(len, DATALEN_SEG);
-		if (copy_from_user(seg + 1, src, alen))
-			goto out_err;
+		if (!copy_from_iter_full(seg + 1, alen, from))
+			return -EFAULT;
 	}
 
-	err = security_msg_msg_alloc(msg);
-	if (err)
-		goto out_err;
+	return security_msg_msg_alloc(msg);
+}
+
+struct msg_msg *load_msg_iter(struct iov_iter *from, size_t len)
+{
+	struct msg_msg *msg;
+	int err;
+
+	msg = alloc_msg(len);
+	if (msg == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	err = fill_msg(msg, from, len);
+	if (err) {
+		free_msg(msg);
+		return ERR_PTR(err);
+	}
 
 	return msg;
+}
 
-out_err:
-	free_msg(msg);
-	return ERR_PTR(err);
+struct msg_msg *load_msg(const void __user *src, size_t len)
+{
+	struct iovec iov;
+	struct iov_iter from;
+	int err;
+
+	err = import_single_range(WRITE, (void __user *)src, len, &iov, &from);
+	if (err)
+		return ERR_PTR(err);
+
+	return load_msg_iter(&from, len);
 }
 #ifdef CONFIG_CHECKPOINT_RESTORE
 struct msg_msg *copy_msg(struct msg_msg *src, struct msg_msg *dst)
@@ -156,7 +182,7 @@ int store_msg(void __user *dest, struct msg_msg *msg, size_t len)
 	if (copy_to_user(dest, msg + 1, alen))
 		return -1;
 
-	for (seg = msg->next; seg != NULL; seg = seg->next) {
+	for (seg = msg->next; seg != NULL && len > alen; seg = seg->next) {
 		len -= alen;
 		dest = (char __user *)dest + alen;
 		alen = min(len, DATALEN_SEG);
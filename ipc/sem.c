@@ -49,6 +49,9 @@
  *   Thus: Perfect SMP scaling between independent semaphore arrays.
  *         If multiple semaphores in one array are used, then cache line
  *         trashing on the semaphore array spinlock will limit the scaling.
+ *   - semop() calls that can proceed without sleeping only lock the
+ *     semaphores they operate on, as long as these are few and no
+ *     complex operation is pending (see sem_lock_fine()).
  * - semncnt and semzcnt are calculated on demand in count_semcnt()
  * - the task that performs a successful semop() scans the list of all
  *   sleeping tasks and completes any pending operations that can be fulfilled.
@@ -68,6 +71,8 @@
  *   and per-semaphore list (stored in the array). This allows to achieve FIFO
  *   ordering without always scanning all pending operations.
  *   The worst-case behavior is nevertheless O(N^2) for N wakeups.
+ *   Operations on the per-array list are only retried when one of their
+ *   semaphores was modified (see sem_signature()).
  */
 
 #include <linux/compat.h>
@@ -138,6 +143,7 @@ struct sem_queue {
 	int			nsops;	 /* number of operations */
 	bool			alter;	 /* does *sops alter the array? */
 	bool                    dupsop;	 /* sops on more than one sem_num */
+	unsigned long		sem_mask; /* sem_signature() of *sops */
 };
 
 /* Each task has a list of undo requests. They are executed automatically
@@ -184,6 +190,18 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  */
 #define USE_GLOBAL_LOCK_HYSTERESIS	10
 
+/*
+ * Multi-sop operations that touch at most this many semaphores take the
+ * per-semaphore locks instead of the global lock, unless they must sleep.
+ * Bounded by the number of lockdep subclasses.
+ */
+#define SEM_FINE_LOCK_MAX	8
+
+struct sem_lockset {
+	int		nr;
+	unsigned short	idx[SEM_FINE_LOCK_MAX];	/* sorted, no duplicates */
+};
+
 /*
  * Locking:
  * a) global sem_lock() for read/write
@@ -194,6 +212,9 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *
  * b) global or semaphore sem_lock() for read/write:
  *	sem_array.sems[i].pending_{const,alter}:
+ *	A multi-sop operation may hold the semaphore locks of all the
+ *	semaphores it touches instead (see sem_lock_fine()), but it must
+ *	switch to the global lock before it can sleep.
  *
  * c) special:
  *	sem_undo_list.list_proc:
@@ -466,6 +487,75 @@ static inline void sem_unlock(struct sem_array *sma, int locknum)
 	}
 }
 
+static void sem_unlock_fine(struct sem_array *sma, struct sem_lockset *ls)
+{
+	int i;
+
+	for (i = ls->nr - 1; i >= 0; i--)
+		spin_unlock(&sma->sems[ls->idx[i]].lock);
+}
+
+#define SEM_FINE_LOCK	(-2)
+/*
+ * Try to lock only the semaphores a multi-sop operation touches, in
+ * ascending order. This works as long as no complex operation is pending
+ * or being processed, exactly like the single-sop fast path in sem_lock(),
+ * and as long as few enough semaphores are involved.
+ *
+ * On success the operation may be performed, but not queued: sleeping
+ * multi-sop operations live on the per-array lists, which require the
+ * global lock.
+ */
+static bool sem_lock_fine(struct sem_array *sma, struct sembuf *sops,
+			  int nsops, struct sem_lockset *ls)
+{
+	int i, j, nr = 0;
+
+	/* Same early check as in sem_lock(), no locking, no barrier. */
+	if (sma->use_global_lock)
+		return false;
+
+	for (i = 0; i < nsops; i++) {
+		unsigned short num = sops[i].sem_num;
+
+		for (j = nr; j > 0 && ls->idx[j - 1] > num; j--)
+			;
+		if (j > 0 && ls->idx[j - 1] == num)
+			continue;
+		if (nr == SEM_FINE_LOCK_MAX)
+			return false;
+
+		memmove(&ls->idx[j + 1], &ls->idx[j],
+			(nr - j) * sizeof(ls->idx[0]));
+		ls->idx[j] = array_index_nospec(num, sma->sem_nsems);
+		nr++;
+	}
+	ls->nr = nr;
+
+	for (i = 0; i < nr; i++)
+		spin_lock_nested(&sma->sems[ls->idx[i]].lock, i);
+
+	/*
+	 * See SEM_BARRIER_1 for purpose/pairing. complexmode_enter() waits
+	 * for each of the locks we hold, so checking once after taking all
+	 * of them is sufficient.
+	 */
+	if (!smp_load_acquire(&sma->use_global_lock))
+		return true;
+
+	sem_unlock_fine(sma, ls);
+	return false;
+}
+
+static inline void sem_unlock_sops(struct sem_array *sma, int locknum,
+				   struct sem_lockset *ls)
+{
+	if (locknum == SEM_FINE_LOCK)
+		sem_unlock_fine(sma, ls);
+	else
+		sem_unlock(sma, locknum);
+}
+
 /*
  * sem_lock_(check_) routines are called in the paths where the rwsem
  * is not held.
@@ -833,10 +923,35 @@ static inline int check_restart(struct sem_array *sma, struct sem_queue *q)
 	return 0;
 }
 
+/**
+ * sem_signature - summarize the semaphores used by some operations
+ * @sops: the operations, NULL for all semaphores
+ * @nsops: number of operations
+ *
+ * Returns a bitmap with bit (sem_num % BITS_PER_LONG) set for each
+ * semaphore in @sops. Two sets of operations can only have a semaphore in
+ * common if their signatures intersect.
+ */
+static unsigned long sem_signature(struct sembuf *sops, int nsops)
+{
+	unsigned long mask = 0;
+	int i;
+
+	if (!sops)
+		return ~0UL;
+
+	for (i = 0; i < nsops; i++)
+		mask |= 1UL << (sops[i].sem_num % BITS_PER_LONG);
+
+	return mask;
+}
+
 /**
  * wake_const_ops - wake up non-alter tasks
  * @sma: semaphore array.
  * @semnum: semaphore that was modified.
+ * @changed: sem_signature() of the semaphores that were set to 0,
+ *           only used for semnum = -1.
  * @wake_q: lockless wake-queue head.
  *
  * wake_const_ops must be called after a semaphore in a semaphore array
@@ -848,7 +963,7 @@ static inline int check_restart(struct sem_array *sma, struct sem_queue *q)
  * The function returns 1 if at least one operation was completed successfully.
  */
 static int wake_const_ops(struct sem_array *sma, int semnum,
-			  struct wake_q_head *wake_q)
+			  unsigned long changed, struct wake_q_head *wake_q)
 {
 	struct sem_queue *q, *tmp;
 	struct list_head *pending_list;
@@ -860,7 +975,16 @@ static int wake_const_ops(struct sem_array *sma, int semnum,
 		pending_list = &sma->sems[semnum].pending_const;
 
 	list_for_each_entry_safe(q, tmp, pending_list, list) {
-		int error = perform_atomic_semop(sma, q);
+		int error;
+
+		/*
+		 * A complex const operation can only proceed once one of
+		 * its semaphores became 0.
+		 */
+		if (semnum == -1 && !(q->sem_mask & changed))
+			continue;
+
+		error = perform_atomic_semop(sma, q);
 
 		if (error > 0)
 			continue;
@@ -891,7 +1015,7 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 {
 	int i;
 	int semop_completed = 0;
-	int got_zero = 0;
+	unsigned long got_zero = 0;
 
 	/* first: the per-semaphore queues, if known */
 	if (sops) {
@@ -899,8 +1023,9 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 			int num = sops[i].sem_num;
 
 			if (sma->sems[num].semval == 0) {
-				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, num, wake_q);
+				got_zero |= sem_signature(&sops[i], 1);
+				semop_completed |= wake_const_ops(sma, num, 0,
+								  wake_q);
 			}
 		}
 	} else {
@@ -910,8 +1035,9 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 		 */
 		for (i = 0; i < sma->sem_nsems; i++) {
 			if (sma->sems[i].semval == 0) {
-				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, i, wake_q);
+				got_zero = sem_signature(NULL, 0);
+				semop_completed |= wake_const_ops(sma, i, 0,
+								  wake_q);
 			}
 		}
 	}
@@ -920,7 +1046,7 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 	 * then check the global queue, too.
 	 */
 	if (got_zero)
-		semop_completed |= wake_const_ops(sma, -1, wake_q);
+		semop_completed |= wake_const_ops(sma, -1, got_zero, wake_q);
 
 	return semop_completed;
 }
@@ -930,6 +1056,8 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
  * update_queue - look for tasks that can be completed.
  * @sma: semaphore array.
  * @semnum: semaphore that was modified.
+ * @changed: sem_signature() of the modified semaphores, only used for
+ *           semnum = -1.
  * @wake_q: lockless wake-queue head.
  *
  * update_queue must be called after a semaphore in a semaphore array
@@ -942,7 +1070,8 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
  *
  * The function return 1 if at least one semop was completed successfully.
  */
-static int update_queue(struct sem_array *sma, int semnum, struct wake_q_head *wake_q)
+static int update_queue(struct sem_array *sma, int semnum,
+			unsigned long changed, struct wake_q_head *wake_q)
 {
 	struct sem_queue *q, *tmp;
 	struct list_head *pending_list;
@@ -967,6 +1096,14 @@ static int update_queue(struct sem_array *sma, int semnum, struct wake_q_head *w
 		if (semnum != -1 && sma->sems[semnum].semval == 0)
 			break;
 
+		/*
+		 * An operation on the global queue was tried when it was
+		 * queued, and every time one of its semaphores was modified
+		 * since. If none of them was modified now, it still blocks.
+		 */
+		if (semnum == -1 && !(q->sem_mask & changed))
+			continue;
+
 		error = perform_atomic_semop(sma, q);
 
 		/* Does q->sleeper still need to sleep? */
@@ -981,6 +1118,7 @@ static int update_queue(struct sem_array *sma, int semnum, struct wake_q_head *w
 			semop_completed = 1;
 			do_smart_wakeup_zero(sma, q->sops, q->nsops, wake_q);
 			restart = check_restart(sma, q);
+			changed |= q->sem_mask;
 		}
 
 		wake_up_sem_queue_prepare(q, error, wake_q);
@@ -1031,7 +1169,8 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 
 	if (!list_empty(&sma->pending_alter)) {
 		/* semaphore array uses the global queue - just process it. */
-		otime |= update_queue(sma, -1, wake_q);
+		otime |= update_queue(sma, -1, sem_signature(sops, nsops),
+				      wake_q);
 	} else {
 		if (!sops) {
 			/*
@@ -1039,7 +1178,7 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			 * known. Check all.
 			 */
 			for (i = 0; i < sma->sem_nsems; i++)
-				otime |= update_queue(sma, i, wake_q);
+				otime |= update_queue(sma, i, 0, wake_q);
 		} else {
 			/*
 			 * Check the semaphores that were increased:
@@ -1053,7 +1192,8 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			for (i = 0; i < nsops; i++) {
 				if (sops[i].sem_op > 0) {
 					otime |= update_queue(sma,
-							      sops[i].sem_num, wake_q);
+							      sops[i].sem_num,
+							      0, wake_q);
 				}
 			}
 		}
@@ -1989,6 +2129,7 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	int max, locknum;
 	bool undos = false, alter = false, dupsop = false;
 	struct sem_queue queue;
+	struct sem_lockset lockset = { .nr = 0 };
 	unsigned long dup = 0, jiffies_left = 0;
 	struct ipc_namespace *ns;
 
@@ -2078,13 +2219,17 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 		goto out_free;
 	}
 
+	if (nsops > 1 && sem_lock_fine(sma, sops, nsops, &lockset))
+		locknum = SEM_FINE_LOCK;
+	else
+		locknum = sem_lock(sma, sops, nsops);
+retry_locked:
 	error = -EIDRM;
-	locknum = sem_lock(sma, sops, nsops);
 	/*
 	 * We eventually might perform the following check in a lockless
 	 * fashion, considering ipc_valid_object() locking constraints.
-	 * If nsops == 1 and there is no contention for sem_perm.lock, then
-	 * only a per-semaphore lock is held and it's OK to proceed with the
+	 * If there is no contention for sem_perm.lock, then only the
+	 * per-semaphore locks are held and it's OK to proceed with the
 	 * check below. More details on the fine grained locking scheme
 	 * entangled here and why it's RMID race safe on comments at sem_lock()
 	 */
@@ -2106,6 +2251,7 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	queue.pid = task_tgid(current);
 	queue.alter = alter;
 	queue.dupsop = dupsop;
+	queue.sem_mask = sem_signature(sops, nsops);
 
 	error = perform_atomic_semop(sma, &queue);
 	if (error == 0) { /* non-blocking succesfull path */
@@ -2120,7 +2266,7 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 		else
 			set_semotime(sma, sops);
 
-		sem_unlock(sma, locknum);
+		sem_unlock_sops(sma, locknum, &lockset);
 		rcu_read_unlock();
 		wake_up_q(&wake_q);
 
@@ -2129,6 +2275,17 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	if (error < 0) /* non-blocking error path */
 		goto out_unlock_free;
 
+	/*
+	 * Sleeping multi-sop operations are queued on the per-array lists,
+	 * which needs the global lock. The semaphores may change while no
+	 * lock is held, so try again from scratch once we have it.
+	 */
+	if (locknum == SEM_FINE_LOCK) {
+		sem_unlock_fine(sma, &lockset);
+		locknum = sem_lock(sma, sops, nsops);
+		goto retry_locked;
+	}
+
 	/*
 	 * We need to sleep on this operation, so we put the current
 	 * task into the pending queue and go to sleep.
@@ -2223,7 +2380,7 @@ static long do_semtimedop(int semid, struct sembuf __user *tsops,
 	unlink_queue(sma, &queue);
 
 out_unlock_free:
-	sem_unlock(sma, locknum);
+	sem_unlock_sops(sma, locknum, &lockset);
 	rcu_read_unlock();
 out_free:
 	if (sops != fast_sops)
@@ -111,6 +111,7 @@ struct ipc_ops {
 
 struct seq_file;
 struct ipc_ids;
+struct iov_iter;
 
 void ipc_init_ids(struct ipc_ids *ids);
 #ifdef CONFIG_PROC_FS
@@ -194,7 +195,10 @@ int ipc_parse_version(int *cmd);
 #endif
 
 extern void free_msg(struct msg_msg *msg);
+extern struct msg_msg *alloc_msg(size_t len);
+extern int fill_msg(struct msg_msg *msg, struct iov_iter *from, size_t len);
 extern struct msg_msg *load_msg(const void __user *src, size_t len);
+extern struct msg_msg *load_msg_iter(struct iov_iter *from, size_t len);
 extern struct msg_msg *copy_msg(struct msg_msg *src, struct msg_msg *dst);
 extern int store_msg(void __user *dest, struct msg_msg *msg, size_t len);
 
@@ -38,6 +38,7 @@
 #include <linux/hugetlb.h>
 #include <linux/freezer.h>
 #include <linux/memblock.h>
+#include <linux/vmalloc.h>
 #include <linux/fault-inject.h>
 #include <linux/time_namespace.h>
 
@@ -251,6 +252,27 @@ static struct {
 #define futex_queues   (__futex_data.queues)
 #define futex_hashsize (__futex_data.hashsize)
 
+/*
+ * PROCESS_PRIVATE futexes can only ever be seen by the threads of one mm,
+ * so they are hashed into a table of that mm instead of the global one.
+ * This keeps unrelated processes off each other's bucket locks and puts
+ * the buckets on the node the process started using futexes on.
+ *
+ * The table is allocated by the first private futex operation of the mm
+ * and lives as long as the mm. It is never resized, as that would require
+ * moving queued waiters, so it is not sized by the number of threads at
+ * that point either. Like the global table it scales with the number of
+ * possible CPUs, at 1/16th of the global size: a process can only have as
+ * many waiters in flight at a time as it has CPUs to run them on.
+ */
+#define FUTEX_PRIVATE_HASH_SHIFT	4
+#define FUTEX_PRIVATE_HASH_MIN		16
+
+struct futex_private_hash {
+	unsigned long			hashsize;
+	struct futex_hash_bucket	queues[];
+};
+
 
 /*
  * Fault injections for futexes.
@@ -352,17 +374,80 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	atomic_set(&hb->waiters, 0);
+	plist_head_init(&hb->chain);
+	spin_lock_init(&hb->lock);
+}
+
 /**
- * hash_futex - Return the hash bucket in the global hash
+ * futex_private_hash_alloc - Set up the private futex hash of an mm
+ * @mm:		The mm of the current task
+ *
+ * Called for every PROCESS_PRIVATE futex key before it is hashed, so the
+ * table is in place before the first private waiter of @mm can be queued.
+ *
+ * Return: 0 on success, -ENOMEM if the table could not be allocated.
+ */
+static int futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph;
+	unsigned long i, hashsize;
+
+	if (likely(READ_ONCE(mm->futex_hash)))
+		return 0;
+
+	hashsize = futex_hashsize >> FUTEX_PRIVATE_HASH_SHIFT;
+	hashsize = max_t(unsigned long, hashsize, FUTEX_PRIVATE_HASH_MIN);
+	hashsize = min(hashsize, futex_hashsize);
+
+	fph = kvmalloc_node(struct_size(fph, queues, hashsize),
+			    GFP_KERNEL_ACCOUNT, numa_node_id());
+	if (!fph)
+		return -ENOMEM;
+
+	fph->hashsize = hashsize;
+	for (i = 0; i < hashsize; i++)
+		futex_hash_bucket_init(&fph->queues[i]);
+
+	/* Another thread of @mm may have beaten us to it */
+	if (cmpxchg(&mm->futex_hash, NULL, fph))
+		kvfree(fph);
+
+	return 0;
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph = mm->futex_hash;
+
+	/* __mmdrop() may be called in atomic context, where vfree() can't */
+	if (is_vmalloc_addr(fph))
+		vfree_atomic(fph);
+	else
+		kfree(fph);
+}
+
+/**
+ * hash_futex - Return the hash bucket for a futex key
  * @key:	Pointer to the futex key for which the hash is calculated
  *
  * We hash on the keys returned from get_futex_key (see below) and return the
- * corresponding hash bucket in the global hash.
+ * corresponding hash bucket in the private hash of the mm for private keys,
+ * or in the global hash for shared ones.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32 *)key, offsetof(typeof(*key), both.offset) / 4,
 			  key->both.offset);
+	struct futex_private_hash *fph;
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		fph = READ_ONCE(key->private.mm->futex_hash);
+		if (fph)
+			return &fph->queues[hash & (fph->hashsize - 1)];
+	}
 
 	return &futex_queues[hash & (futex_hashsize - 1)];
 }
@@ -515,6 +600,9 @@ static int get_futex_key(u32 __user *uaddr, bool fshared, union futex_key *key,
 	 *        but access_ok() should be faster than find_vma()
 	 */
 	if (!fshared) {
+		err = futex_private_hash_alloc(mm);
+		if (unlikely(err))
+			return err;
 		key->private.mm = mm;
 		key->private.address = address;
 		return 0;
@@ -2745,6 +2833,202 @@ static long futex_wait_restart(struct restart_block *restart)
 }
 
 
+/**
+ * unqueue_multiple - Remove several futexes from their hash buckets
+ * @qs:		the futex_q array to unqueue
+ * @count:	number of entries in @qs
+ *
+ * Return: the index of the first futex that was woken, or -1 if none was.
+ */
+static int unqueue_multiple(struct futex_q *qs, int count)
+{
+	int ret = -1;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!unqueue_me(&qs[i]) && ret < 0)
+			ret = i;
+	}
+	return ret;
+}
+
+/**
+ * futex_wait_multiple_setup() - Prepare to wait on and queue several futexes
+ * @wb:		the futexes to wait on, as passed in by userspace
+ * @qs:		the associated futex_q array
+ * @count:	number of entries in @wb and @qs
+ * @flags:	futex flags (FLAGS_SHARED, etc.)
+ * @woken:	index of the futex that was woken during the setup, if any
+ *
+ * Same as futex_wait_setup() followed by queue_me() for each futex in turn,
+ * with the task state set before the first one is queued, so that a wakeup
+ * on any of them after that point is not lost. If a value does not match,
+ * the futexes already queued are unqueued again. One of them may have been
+ * woken in the meantime, which is reported instead of the mismatch.
+ *
+ * Return:
+ *  -  1 - one of the futexes was woken, its index is stored in *@woken
+ *  -  0 - all futexes are queued, the task is TASK_INTERRUPTIBLE
+ *  - <0 - -EFAULT or -EWOULDBLOCK, no futex is queued
+ */
+static int futex_wait_multiple_setup(struct futex_wait_block *wb,
+				     struct futex_q *qs, int count,
+				     unsigned int flags, int *woken)
+{
+	struct futex_hash_bucket *hb;
+	u32 __user *uaddr;
+	u32 uval;
+	int ret, i;
+
+retry:
+	for (i = 0; i < count; i++) {
+		ret = get_futex_key(u64_to_user_ptr(wb[i].uaddr),
+				    flags & FLAGS_SHARED, &qs[i].key,
+				    FUTEX_READ);
+		if (unlikely(ret))
+			return ret;
+	}
+
+retry_private:
+	/*
+	 * See futex_wait_queue_me() for why the state has to be set before
+	 * queue_me(). Setting it once up front covers all the futexes.
+	 */
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		uaddr = u64_to_user_ptr(wb[i].uaddr);
+		hb = queue_lock(&qs[i]);
+
+		ret = get_futex_value_locked(&uval, uaddr);
+		if (ret || uval != wb[i].val) {
+			queue_unlock(hb);
+			__set_current_state(TASK_RUNNING);
+
+			*woken = unqueue_multiple(qs, i);
+			if (*woken >= 0)
+				return 1;
+
+			if (!ret)
+				return -EWOULDBLOCK;
+
+			ret = get_user(uval, uaddr);
+			if (ret)
+				return ret;
+
+			if (!(flags & FLAGS_SHARED))
+				goto retry_private;
+
+			goto retry;
+		}
+
+		queue_me(&qs[i], hb);
+	}
+
+	return 0;
+}
+
+/**
+ * futex_wait_multiple() - Wait on several futexes at once
+ * @uaddr:	userspace array of struct futex_wait_block
+ * @flags:	futex flags (FLAGS_SHARED, etc.)
+ * @count:	number of entries in @uaddr
+ * @abs_time:	absolute timeout, or NULL to wait forever
+ *
+ * The task is queued on all the futexes and sleeps until any of them is
+ * woken, using the same hash buckets and futex_q as futex_wait(). As with
+ * FUTEX_WAIT_BITSET the timeout is absolute, so an interrupted wait can be
+ * restarted as it is.
+ *
+ * Return: the index of the futex that was woken, or a negative error.
+ */
+static int futex_wait_multiple(u32 __user *uaddr, unsigned int flags,
+			       u32 count, ktime_t *abs_time)
+{
+	struct hrtimer_sleeper timeout, *to;
+	struct futex_wait_block *wb;
+	struct futex_q *qs;
+	int woken = -1;
+	int ret, i;
+
+	if (!count || count > FUTEX_WAIT_MULTIPLE_MAX)
+		return -EINVAL;
+
+	wb = memdup_user(uaddr, count * sizeof(*wb));
+	if (IS_ERR(wb))
+		return PTR_ERR(wb);
+
+	qs = kmalloc_array(count, sizeof(*qs), GFP_KERNEL);
+	if (!qs) {
+		ret = -ENOMEM;
+		goto out_free_wb;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!wb[i].bitset) {
+			ret = -EINVAL;
+			goto out_free_qs;
+		}
+		qs[i] = futex_q_init;
+		qs[i].bitset = wb[i].bitset;
+	}
+
+	to = futex_setup_timer(abs_time, &timeout, flags,
+			       current->timer_slack_ns);
+
+	for (;;) {
+		ret = futex_wait_multiple_setup(wb, qs, count, flags, &woken);
+		if (ret) {
+			if (ret > 0)
+				ret = woken;
+			break;
+		}
+
+		/* Arm the timer */
+		if (to)
+			hrtimer_sleeper_start_expires(to, HRTIMER_MODE_ABS);
+
+		/*
+		 * If any of the futexes has been removed from its hash list,
+		 * another task has tried to wake us and we can skip the call
+		 * to schedule().
+		 */
+		for (i = 0; i < count; i++) {
+			if (plist_node_empty(&qs[i].list))
+				break;
+		}
+		if (i == count && (!to || to->task))
+			freezable_schedule();
+		__set_current_state(TASK_RUNNING);
+
+		ret = unqueue_multiple(qs, count);
+		if (ret >= 0)
+			break;
+
+		ret = -ETIMEDOUT;
+		if (to && !to->task)
+			break;
+
+		/*
+		 * We expect signal_pending(current), but we might be the
+		 * victim of a spurious wakeup as well.
+		 */
+		ret = -ERESTARTSYS;
+		if (signal_pending(current))
+			break;
+	}
+
+	if (to) {
+		hrtimer_cancel(&to->timer);
+		destroy_hrtimer_on_stack(&to->timer);
+	}
+out_free_qs:
+	kfree(qs);
+out_free_wb:
+	kfree(wb);
+	return ret;
+}
+
 /*
  * Userspace tried a 0 -> TID atomic transition of the futex value
  * and failed. The kernel side here does the whole locking operation:
@@ -3728,7 +4012,7 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 	if (op & FUTEX_CLOCK_REALTIME) {
 		flags |= FLAGS_CLOCKRT;
 		if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET && \
-		    cmd != FUTEX_WAIT_REQUEUE_PI)
+		    cmd != FUTEX_WAIT_REQUEUE_PI && cmd != FUTEX_WAIT_MULTIPLE)
 			return -ENOSYS;
 	}
 
@@ -3771,6 +4055,8 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 					     uaddr2);
 	case FUTEX_CMP_REQUEUE_PI:
 		return futex_requeue(uaddr, flags, uaddr2, val, val2, &val3, 1);
+	case FUTEX_WAIT_MULTIPLE:
+		return futex_wait_multiple(uaddr, flags, val, timeout);
 	}
 	return -ENOSYS;
 }
@@ -3787,7 +4073,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 	if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI ||
 		      cmd == FUTEX_WAIT_BITSET ||
-		      cmd == FUTEX_WAIT_REQUEUE_PI)) {
+		      cmd == FUTEX_WAIT_REQUEUE_PI ||
+		      cmd == FUTEX_WAIT_MULTIPLE)) {
 		if (unlikely(should_fail_futex(!(op & FUTEX_PRIVATE_FLAG))))
 			return -EFAULT;
 		if (get_timespec64(&ts, utime))
@@ -3983,7 +4270,8 @@ SYSCALL_DEFINE6(futex_time32, u32 __user *, uaddr, int, op, u32, val,
 
 	if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI ||
 		      cmd == FUTEX_WAIT_BITSET ||
-		      cmd == FUTEX_WAIT_REQUEUE_PI)) {
+		      cmd == FUTEX_WAIT_REQUEUE_PI ||
+		      cmd == FUTEX_WAIT_MULTIPLE)) {
 		if (get_old_timespec32(&ts, utime))
 			return -EFAULT;
 		if (!timespec64_valid(&ts))
@@ -4044,11 +4332,8 @@ static int __init futex_init(void)
 
 	futex_detect_cmpxchg();
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	for (i = 0; i < futex_hashsize; i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
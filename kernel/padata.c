@@ -58,7 +58,7 @@ struct padata_mt_job_state {
 };
 
 static void padata_free_pd(struct parallel_data *pd);
-static void __init padata_mt_helper(struct work_struct *work);
+static void padata_mt_helper(struct work_struct *work);
 
 static int padata_index_to_cpu(struct parallel_data *pd, int cpu_index)
 {
@@ -106,8 +106,8 @@ static void padata_work_init(struct padata_work *pw, work_func_t work_fn,
 	pw->pw_data = data;
 }
 
-static int __init padata_work_alloc_mt(int nworks, void *data,
-				       struct list_head *head)
+static int padata_work_alloc_mt(int nworks, void *data,
+			       struct list_head *head)
 {
 	int i;
 
@@ -132,7 +132,7 @@ static void padata_work_free(struct padata_work *pw)
 	list_add(&pw->pw_list, &padata_free_works);
 }
 
-static void __init padata_works_free(struct list_head *works)
+static void padata_works_free(struct list_head *works)
 {
 	struct padata_work *cur, *next;
 
@@ -438,7 +438,7 @@ static int padata_setup_cpumasks(struct padata_instance *pinst)
 	return err;
 }
 
-static void __init padata_mt_helper(struct work_struct *w)
+static void padata_mt_helper(struct work_struct *w)
 {
 	struct padata_work *pw = container_of(w, struct padata_work, pw_work);
 	struct padata_mt_job_state *ps = pw->pw_data;
@@ -472,20 +472,48 @@ static void __init padata_mt_helper(struct work_struct *w)
 		complete(&ps->completion);
 }
 
+/*
+ * The number of CPUs the caller may run on.  Helpers are not bound to these
+ * CPUs, but a job is never split into more threads than the caller's cpuset
+ * would let it run in parallel itself.
+ */
+static int padata_mt_allowed_cpus(void)
+{
+	int cpu, nr = 0;
+
+	for_each_cpu_and(cpu, current->cpus_ptr, cpu_online_mask)
+		++nr;
+
+	return max(nr, 1);
+}
+
 /**
  * padata_do_multithreaded - run a multithreaded job
  * @job: Description of the job.
  *
+ * The job is split between the calling thread and up to @job->max_threads - 1
+ * helpers on system_unbound_wq.  The number of threads is further capped by
+ * the CPUs the caller is allowed to run on, and the helpers are queued on the
+ * caller's NUMA node, which is usually where the memory being worked on is.
+ * Workers of the unbound workqueue are moved off CPUs going down, so a job
+ * may run across CPU hotplug operations.
+ *
+ * Returns once all of the job has been done.  May sleep, and may be called
+ * at any time after padata_init(), falling back to the calling thread alone
+ * when no helpers are available.
+ *
  * See the definition of struct padata_mt_job for more details.
  */
-void __init padata_do_multithreaded(struct padata_mt_job *job)
+void padata_do_multithreaded(struct padata_mt_job *job)
 {
 	/* In case threads finish at different times. */
 	static const unsigned long load_balance_factor = 4;
 	struct padata_work my_work, *pw;
 	struct padata_mt_job_state ps;
 	LIST_HEAD(works);
-	int nworks;
+	int nworks, nid;
+
+	might_sleep();
 
 	if (job->size == 0)
 		return;
@@ -493,6 +521,7 @@ void __init padata_do_multithreaded(struct padata_mt_job *job)
 	/* Ensure at least one thread when size < min_chunk. */
 	nworks = max(job->size / job->min_chunk, 1ul);
 	nworks = min(nworks, job->max_threads);
+	nworks = min(nworks, padata_mt_allowed_cpus());
 
 	if (nworks == 1) {
 		/* Single thread, no coordination needed, cut to the chase. */
@@ -516,8 +545,9 @@ void __init padata_do_multithreaded(struct padata_mt_job *job)
 	ps.chunk_size = max(ps.chunk_size, job->min_chunk);
 	ps.chunk_size = roundup(ps.chunk_size, job->align);
 
+	nid = numa_node_id();
 	list_for_each_entry(pw, &works, pw_list)
-		queue_work(system_unbound_wq, &pw->pw_work);
+		queue_work_node(nid, system_unbound_wq, &pw->pw_work);
 
 	/* Use the current thread, which saves starting a workqueue worker. */
 	padata_work_init(&my_work, padata_mt_helper, &ps, PADATA_WORK_ONSTACK);
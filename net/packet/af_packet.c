@@ -83,6 +83,7 @@
 #include <linux/errqueue.h>
 #include <linux/net_tstamp.h>
 #include <linux/percpu.h>
+#include <linux/jhash.h>
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
 #endif
@@ -1231,6 +1232,25 @@ static bool __tpacket_v3_has_room(const struct packet_sock *po, int pow_off)
 	return prb_lookup_block(po, &po->rx_ring, idx, TP_STATUS_KERNEL);
 }
 
+/* True if at least 1/2^pow_off of the receive buffer or ring is free */
+static bool __packet_rcv_has_room_frac(const struct packet_sock *po,
+				       int pow_off)
+{
+	const struct sock *sk = &po->sk;
+
+	if (po->prot_hook.func != tpacket_rcv) {
+		int rcvbuf = READ_ONCE(sk->sk_rcvbuf);
+		int avail = rcvbuf - atomic_read(&sk->sk_rmem_alloc);
+
+		return avail > (rcvbuf >> pow_off);
+	}
+
+	if (po->tp_version == TPACKET_V3)
+		return __tpacket_v3_has_room(po, pow_off);
+
+	return __tpacket_has_room(po, pow_off);
+}
+
 static int __packet_rcv_has_room(const struct packet_sock *po,
 				 const struct sk_buff *skb)
 {
@@ -1350,6 +1370,25 @@ static unsigned int fanout_demux_rnd(struct packet_fanout *f,
 	return prandom_u32_max(num);
 }
 
+/* A member becomes congested once less than a quarter of its ring is
+ * free, and only stops being congested once half of it is free again.
+ */
+static bool fanout_member_congested(struct packet_sock *po)
+{
+	int congested = READ_ONCE(po->fanout_congested);
+
+	if (!congested) {
+		if (__packet_rcv_has_room_frac(po, ROOM_POW_OFF))
+			return false;
+	} else {
+		if (!__packet_rcv_has_room_frac(po, ROOM_POW_OFF - 1))
+			return true;
+	}
+
+	WRITE_ONCE(po->fanout_congested, !congested);
+	return !congested;
+}
+
 static unsigned int fanout_demux_rollover(struct packet_fanout *f,
 					  struct sk_buff *skb,
 					  unsigned int idx, bool try_self,
@@ -1371,6 +1410,9 @@ static unsigned int fanout_demux_rollover(struct packet_fanout *f,
 	i = j = min_t(int, po->rollover->sock, num - 1);
 	do {
 		po_next = pkt_sk(f->arr[i]);
+		/* Rolling over to or past a member tells us how full it is */
+		if (f->type == PACKET_FANOUT_OCCUPANCY)
+			fanout_member_congested(po_next);
 		if (po_next != po_skip && !READ_ONCE(po_next->pressure) &&
 		    packet_rcv_has_room(po_next, skb) == ROOM_NORMAL) {
 			if (i != j)
@@ -1396,6 +1438,43 @@ static unsigned int fanout_demux_qm(struct packet_fanout *f,
 	return skb_get_queue_mapping(skb) % num;
 }
 
+/* Steer flows by symmetric hash, like PACKET_FANOUT_HASH, as long as the
+ * selected member keeps up. Flows of a congested member are rehashed over
+ * the members that are not congested, so that each of them still sticks
+ * to a single member while the congestion lasts. The rehash must not use
+ * the high hash bits that picked idx again, or all flows of the congested
+ * member would land on one or two of its neighbours.
+ */
+static unsigned int fanout_demux_occupancy(struct packet_fanout *f,
+					   struct sk_buff *skb,
+					   unsigned int num)
+{
+	u32 hash = __skb_get_hash_symmetric(skb);
+	unsigned int idx = reciprocal_scale(hash, num);
+	unsigned int i, avail = 0;
+
+	if (!fanout_member_congested(pkt_sk(f->arr[idx])))
+		return idx;
+
+	/* Refresh the state of the other members before picking one */
+	for (i = 0; i < num; i++)
+		if (i != idx && !fanout_member_congested(pkt_sk(f->arr[i])))
+			avail++;
+	if (!avail)
+		return idx;
+
+	avail = reciprocal_scale(jhash_1word(hash, idx), avail);
+	for (i = 0; i < num; i++) {
+		if (i == idx ||
+		    READ_ONCE(pkt_sk(f->arr[i])->fanout_congested))
+			continue;
+		if (!avail--)
+			return i;
+	}
+
+	return idx;
+}
+
 static unsigned int fanout_demux_bpf(struct packet_fanout *f,
 				     struct sk_buff *skb,
 				     unsigned int num)
@@ -1453,6 +1532,9 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	case PACKET_FANOUT_QM:
 		idx = fanout_demux_qm(f, skb, num);
 		break;
+	case PACKET_FANOUT_OCCUPANCY:
+		idx = fanout_demux_occupancy(f, skb, num);
+		break;
 	case PACKET_FANOUT_ROLLOVER:
 		idx = fanout_demux_rollover(f, skb, 0, false, num);
 		break;
@@ -1479,6 +1561,7 @@ static void __fanout_link(struct sock *sk, struct packet_sock *po)
 	struct packet_fanout *f = po->fanout;
 
 	spin_lock(&f->lock);
+	WRITE_ONCE(po->fanout_congested, 0);
 	f->arr[f->num_members] = sk;
 	smp_wmb();
 	f->num_members++;
@@ -1500,6 +1583,7 @@ static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
 	BUG_ON(i >= f->num_members);
 	f->arr[i] = f->arr[f->num_members - 1];
 	f->num_members--;
+	WRITE_ONCE(po->fanout_congested, 0);
 	if (f->num_members == 0)
 		__dev_remove_pack(&f->prot_hook);
 	spin_unlock(&f->lock);
@@ -1656,6 +1740,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	case PACKET_FANOUT_QM:
 	case PACKET_FANOUT_CBPF:
 	case PACKET_FANOUT_EBPF:
+	case PACKET_FANOUT_OCCUPANCY:
 		break;
 	default:
 		return -EINVAL;
@@ -2427,7 +2512,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	atomic_inc(&po->tp_drops);
 	is_drop_n_account = true;
 
-	sk->sk_data_ready(sk);
+	/* TPACKET_V3 readers are woken up once per retired block by
+	 * prb_close_block(), and a V3 ring only drops once all of its
+	 * blocks are retired and owned by user space. Do not add one
+	 * more wakeup per dropped packet on top of that.
+	 */
+	if (po->tp_version != TPACKET_V3)
+		sk->sk_data_ready(sk);
 	kfree_skb(copy_skb);
 	goto drop_n_restore;
 }
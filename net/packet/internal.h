@@ -122,6 +122,7 @@ struct packet_sock {
 				tp_loss:1,
 				tp_tx_has_off:1;
 	int			pressure;
+	int			fanout_congested;
 	int			ifindex;	/* bound device		*/
 	__be16			num;
 	struct packet_rollover	*rollover;
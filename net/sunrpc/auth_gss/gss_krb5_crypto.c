@@ -234,13 +234,19 @@ make_checksum(struct krb5_ctx *kctx, char *header, int hdrlen,
  * body then over the first 16 octets of the MIC token
  * Inclusion of the header data in the calculation of the
  * checksum is optional.
+ *
+ * @hmac holds one of the context's keyed hmac transforms, which are
+ * allocated and keyed once when the context is imported, along with a
+ * request and output buffer for them.  The preallocated request is used
+ * when it is free; concurrent callers on the same context allocate
+ * their own instead of serializing behind it.
  */
 u32
 make_checksum_v2(struct krb5_ctx *kctx, char *header, int hdrlen,
-		 struct xdr_buf *body, int body_offset, u8 *cksumkey,
-		 unsigned int usage, struct xdr_netobj *cksumout)
+		 struct xdr_buf *body, int body_offset,
+		 struct krb5_hmac *hmac, unsigned int usage,
+		 struct xdr_netobj *cksumout)
 {
-	struct crypto_ahash *tfm;
 	struct ahash_request *req;
 	struct scatterlist sg[1];
 	int err = -1;
@@ -251,30 +257,29 @@ make_checksum_v2(struct krb5_ctx *kctx, char *header, int hdrlen,
 			__func__, kctx->gk5e->name);
 		return GSS_S_FAILURE;
 	}
-	if (cksumkey == NULL) {
-		dprintk("%s: no key supplied for %s\n",
+	if (hmac->tfm == NULL) {
+		dprintk("%s: no keyed hash supplied for %s\n",
 			__func__, kctx->gk5e->name);
 		return GSS_S_FAILURE;
 	}
 
-	checksumdata = kmalloc(GSS_KRB5_MAX_CKSUM_LEN, GFP_NOFS);
-	if (!checksumdata)
-		return GSS_S_FAILURE;
-
-	tfm = crypto_alloc_ahash(kctx->gk5e->cksum_name, 0, CRYPTO_ALG_ASYNC);
-	if (IS_ERR(tfm))
-		goto out_free_cksum;
-
-	req = ahash_request_alloc(tfm, GFP_NOFS);
-	if (!req)
-		goto out_free_ahash;
+	if (mutex_trylock(&hmac->req_lock)) {
+		req = hmac->req;
+		checksumdata = hmac->cksumdata;
+	} else {
+		checksumdata = kmalloc(GSS_KRB5_MAX_CKSUM_LEN, GFP_NOFS);
+		if (!checksumdata)
+			return GSS_S_FAILURE;
+
+		req = ahash_request_alloc(hmac->tfm, GFP_NOFS);
+		if (!req) {
+			kfree(checksumdata);
+			return GSS_S_FAILURE;
+		}
+	}
 
 	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_SLEEP, NULL, NULL);
 
-	err = crypto_ahash_setkey(tfm, cksumkey, kctx->gk5e->keylength);
-	if (err)
-		goto out;
-
 	err = crypto_ahash_init(req);
 	if (err)
 		goto out;
@@ -307,11 +312,12 @@ make_checksum_v2(struct krb5_ctx *kctx, char *header, int hdrlen,
 		break;
 	}
 out:
-	ahash_request_free(req);
-out_free_ahash:
-	crypto_free_ahash(tfm);
-out_free_cksum:
-	kfree(checksumdata);
+	if (req == hmac->req) {
+		mutex_unlock(&hmac->req_lock);
+	} else {
+		ahash_request_free(req);
+		kfree(checksumdata);
+	}
 	return err ? GSS_S_FAILURE : 0;
 }
 
@@ -601,7 +607,7 @@ gss_krb5_aes_encrypt(struct krb5_ctx *kctx, u32 offset,
 {
 	u32 err;
 	struct xdr_netobj hmac;
-	u8 *cksumkey;
+	struct krb5_hmac *hmac_key;
 	u8 *ecptr;
 	struct crypto_sync_skcipher *cipher, *aux_cipher;
 	int blocksize;
@@ -614,12 +620,12 @@ gss_krb5_aes_encrypt(struct krb5_ctx *kctx, u32 offset,
 	if (kctx->initiate) {
 		cipher = kctx->initiator_enc;
 		aux_cipher = kctx->initiator_enc_aux;
-		cksumkey = kctx->initiator_integ;
+		hmac_key = &kctx->initiator_integ_hmac;
 		usage = KG_USAGE_INITIATOR_SEAL;
 	} else {
 		cipher = kctx->acceptor_enc;
 		aux_cipher = kctx->acceptor_enc_aux;
-		cksumkey = kctx->acceptor_integ;
+		hmac_key = &kctx->acceptor_integ_hmac;
 		usage = KG_USAGE_ACCEPTOR_SEAL;
 	}
 	blocksize = crypto_sync_skcipher_blocksize(cipher);
@@ -661,7 +667,7 @@ gss_krb5_aes_encrypt(struct krb5_ctx *kctx, u32 offset,
 
 	err = make_checksum_v2(kctx, NULL, 0, buf,
 			       offset + GSS_KRB5_TOK_HDR_LEN,
-			       cksumkey, usage, &hmac);
+			       hmac_key, usage, &hmac);
 	buf->pages = save_pages;
 	if (err)
 		return GSS_S_FAILURE;
@@ -722,7 +728,7 @@ gss_krb5_aes_decrypt(struct krb5_ctx *kctx, u32 offset, u32 len,
 {
 	struct xdr_buf subbuf;
 	u32 ret = 0;
-	u8 *cksum_key;
+	struct krb5_hmac *hmac_key;
 	struct crypto_sync_skcipher *cipher, *aux_cipher;
 	struct xdr_netobj our_hmac_obj;
 	u8 our_hmac[GSS_KRB5_MAX_CKSUM_LEN];
@@ -734,12 +740,12 @@ gss_krb5_aes_decrypt(struct krb5_ctx *kctx, u32 offset, u32 len,
 	if (kctx->initiate) {
 		cipher = kctx->acceptor_enc;
 		aux_cipher = kctx->acceptor_enc_aux;
-		cksum_key = kctx->acceptor_integ;
+		hmac_key = &kctx->acceptor_integ_hmac;
 		usage = KG_USAGE_ACCEPTOR_SEAL;
 	} else {
 		cipher = kctx->initiator_enc;
 		aux_cipher = kctx->initiator_enc_aux;
-		cksum_key = kctx->initiator_integ;
+		hmac_key = &kctx->initiator_integ_hmac;
 		usage = KG_USAGE_INITIATOR_SEAL;
 	}
 	blocksize = crypto_sync_skcipher_blocksize(cipher);
@@ -787,7 +793,7 @@ gss_krb5_aes_decrypt(struct krb5_ctx *kctx, u32 offset, u32 len,
 	our_hmac_obj.data = our_hmac;
 
 	ret = make_checksum_v2(kctx, NULL, 0, &subbuf, 0,
-			       cksum_key, usage, &our_hmac_obj);
+			       hmac_key, usage, &our_hmac_obj);
 	if (ret)
 		goto out_err;
 
@@ -325,6 +325,53 @@ context_v2_alloc_cipher(struct krb5_ctx *ctx, const char *cname, u8 *key)
 	return cp;
 }
 
+/*
+ * Keyed checksums are computed for every wrapped or signed message, so
+ * allocate and key their transforms once per context instead of once
+ * per message, together with a request and output buffer to use them.
+ */
+static int
+context_v2_alloc_hmac(struct krb5_ctx *ctx, struct krb5_hmac *hmac,
+		      const char *cname, u8 *key, gfp_t gfp_mask)
+{
+	hmac->tfm = crypto_alloc_ahash(cname, 0, CRYPTO_ALG_ASYNC);
+	if (IS_ERR(hmac->tfm)) {
+		dprintk("gss_kerberos_mech: unable to initialize "
+			"crypto algorithm %s\n", cname);
+		hmac->tfm = NULL;
+		return -EINVAL;
+	}
+	if (crypto_ahash_setkey(hmac->tfm, key, ctx->gk5e->keylength)) {
+		dprintk("gss_kerberos_mech: error setting key for "
+			"crypto algorithm %s\n", cname);
+		goto out_free_tfm;
+	}
+	hmac->req = ahash_request_alloc(hmac->tfm, gfp_mask);
+	if (!hmac->req)
+		goto out_free_tfm;
+	hmac->cksumdata = kmalloc(GSS_KRB5_MAX_CKSUM_LEN, gfp_mask);
+	if (!hmac->cksumdata)
+		goto out_free_req;
+	mutex_init(&hmac->req_lock);
+	return 0;
+
+out_free_req:
+	ahash_request_free(hmac->req);
+	hmac->req = NULL;
+out_free_tfm:
+	crypto_free_ahash(hmac->tfm);
+	hmac->tfm = NULL;
+	return -EINVAL;
+}
+
+static void
+context_v2_free_hmac(struct krb5_hmac *hmac)
+{
+	kfree(hmac->cksumdata);
+	ahash_request_free(hmac->req);
+	crypto_free_ahash(hmac->tfm);
+}
+
 static inline void
 set_cdata(u8 cdata[GSS_KRB5_K5CLENGTH], u32 usage, u8 seed)
 {
@@ -433,6 +480,10 @@ context_derive_keys_new(struct krb5_ctx *ctx, gfp_t gfp_mask)
 			__func__, err);
 		goto out_free_acceptor_enc;
 	}
+	if (context_v2_alloc_hmac(ctx, &ctx->initiator_sign_hmac,
+				  ctx->gk5e->cksum_name, ctx->initiator_sign,
+				  gfp_mask))
+		goto out_free_acceptor_enc;
 
 	/* acceptor sign checksum */
 	set_cdata(cdata, KG_USAGE_ACCEPTOR_SIGN, KEY_USAGE_SEED_CHECKSUM);
@@ -441,8 +492,12 @@ context_derive_keys_new(struct krb5_ctx *ctx, gfp_t gfp_mask)
 	if (err) {
 		dprintk("%s: Error %d deriving acceptor_sign key\n",
 			__func__, err);
-		goto out_free_acceptor_enc;
+		goto out_free_initiator_sign;
 	}
+	if (context_v2_alloc_hmac(ctx, &ctx->acceptor_sign_hmac,
+				  ctx->gk5e->cksum_name, ctx->acceptor_sign,
+				  gfp_mask))
+		goto out_free_initiator_sign;
 
 	/* initiator seal integrity */
 	set_cdata(cdata, KG_USAGE_INITIATOR_SEAL, KEY_USAGE_SEED_INTEGRITY);
@@ -451,8 +506,12 @@ context_derive_keys_new(struct krb5_ctx *ctx, gfp_t gfp_mask)
 	if (err) {
 		dprintk("%s: Error %d deriving initiator_integ key\n",
 			__func__, err);
-		goto out_free_acceptor_enc;
+		goto out_free_acceptor_sign;
 	}
+	if (context_v2_alloc_hmac(ctx, &ctx->initiator_integ_hmac,
+				  ctx->gk5e->cksum_name, ctx->initiator_integ,
+				  gfp_mask))
+		goto out_free_acceptor_sign;
 
 	/* acceptor seal integrity */
 	set_cdata(cdata, KG_USAGE_ACCEPTOR_SEAL, KEY_USAGE_SEED_INTEGRITY);
@@ -461,8 +520,12 @@ context_derive_keys_new(struct krb5_ctx *ctx, gfp_t gfp_mask)
 	if (err) {
 		dprintk("%s: Error %d deriving acceptor_integ key\n",
 			__func__, err);
-		goto out_free_acceptor_enc;
+		goto out_free_initiator_integ;
 	}
+	if (context_v2_alloc_hmac(ctx, &ctx->acceptor_integ_hmac,
+				  ctx->gk5e->cksum_name, ctx->acceptor_integ,
+				  gfp_mask))
+		goto out_free_initiator_integ;
 
 	switch (ctx->enctype) {
 	case ENCTYPE_AES128_CTS_HMAC_SHA1_96:
@@ -471,18 +534,26 @@ context_derive_keys_new(struct krb5_ctx *ctx, gfp_t gfp_mask)
 			context_v2_alloc_cipher(ctx, "cbc(aes)",
 						ctx->initiator_seal);
 		if (ctx->initiator_enc_aux == NULL)
-			goto out_free_acceptor_enc;
+			goto out_free_acceptor_integ;
 		ctx->acceptor_enc_aux =
 			context_v2_alloc_cipher(ctx, "cbc(aes)",
 						ctx->acceptor_seal);
 		if (ctx->acceptor_enc_aux == NULL) {
 			crypto_free_sync_skcipher(ctx->initiator_enc_aux);
-			goto out_free_acceptor_enc;
+			goto out_free_acceptor_integ;
 		}
 	}
 
 	return 0;
 
+out_free_acceptor_integ:
+	context_v2_free_hmac(&ctx->acceptor_integ_hmac);
+out_free_initiator_integ:
+	context_v2_free_hmac(&ctx->initiator_integ_hmac);
+out_free_acceptor_sign:
+	context_v2_free_hmac(&ctx->acceptor_sign_hmac);
+out_free_initiator_sign:
+	context_v2_free_hmac(&ctx->initiator_sign_hmac);
 out_free_acceptor_enc:
 	crypto_free_sync_skcipher(ctx->acceptor_enc);
 out_free_initiator_enc:
@@ -607,6 +678,10 @@ gss_delete_sec_context_kerberos(void *internal_ctx) {
 	crypto_free_sync_skcipher(kctx->initiator_enc);
 	crypto_free_sync_skcipher(kctx->acceptor_enc_aux);
 	crypto_free_sync_skcipher(kctx->initiator_enc_aux);
+	context_v2_free_hmac(&kctx->acceptor_sign_hmac);
+	context_v2_free_hmac(&kctx->initiator_sign_hmac);
+	context_v2_free_hmac(&kctx->acceptor_integ_hmac);
+	context_v2_free_hmac(&kctx->initiator_integ_hmac);
 	kfree(kctx->mech_used.data);
 	kfree(kctx);
 }
@@ -171,7 +171,7 @@ gss_get_mic_v2(struct krb5_ctx *ctx, struct xdr_buf *text,
 				       .data = cksumdata};
 	void *krb5_hdr;
 	time64_t now;
-	u8 *cksumkey;
+	struct krb5_hmac *hmac;
 	unsigned int cksum_usage;
 	__be64 seq_send_be64;
 
@@ -185,15 +185,15 @@ gss_get_mic_v2(struct krb5_ctx *ctx, struct xdr_buf *text,
 	memcpy(krb5_hdr + 8, (char *) &seq_send_be64, 8);
 
 	if (ctx->initiate) {
-		cksumkey = ctx->initiator_sign;
+		hmac = &ctx->initiator_sign_hmac;
 		cksum_usage = KG_USAGE_INITIATOR_SIGN;
 	} else {
-		cksumkey = ctx->acceptor_sign;
+		hmac = &ctx->acceptor_sign_hmac;
 		cksum_usage = KG_USAGE_ACCEPTOR_SIGN;
 	}
 
 	if (make_checksum_v2(ctx, krb5_hdr, GSS_KRB5_TOK_HDR_LEN,
-			     text, 0, cksumkey, cksum_usage, &cksumobj))
+			     text, 0, hmac, cksum_usage, &cksumobj))
 		return GSS_S_FAILURE;
 
 	memcpy(krb5_hdr + GSS_KRB5_TOK_HDR_LEN, cksumobj.data, cksumobj.len);
@@ -151,7 +151,7 @@ gss_verify_mic_v2(struct krb5_ctx *ctx,
 				      .data = cksumdata};
 	time64_t now;
 	u8 *ptr = read_token->data;
-	u8 *cksumkey;
+	struct krb5_hmac *hmac;
 	u8 flags;
 	int i;
 	unsigned int cksum_usage;
@@ -178,15 +178,15 @@ gss_verify_mic_v2(struct krb5_ctx *ctx,
 			return GSS_S_DEFECTIVE_TOKEN;
 
 	if (ctx->initiate) {
-		cksumkey = ctx->acceptor_sign;
+		hmac = &ctx->acceptor_sign_hmac;
 		cksum_usage = KG_USAGE_ACCEPTOR_SIGN;
 	} else {
-		cksumkey = ctx->initiator_sign;
+		hmac = &ctx->initiator_sign_hmac;
 		cksum_usage = KG_USAGE_INITIATOR_SIGN;
 	}
 
 	if (make_checksum_v2(ctx, ptr, GSS_KRB5_TOK_HDR_LEN, message_buffer, 0,
-			     cksumkey, cksum_usage, &cksumobj))
+			     hmac, cksum_usage, &cksumobj))
 		return GSS_S_FAILURE;
 
 	if (memcmp(cksumobj.data, ptr + GSS_KRB5_TOK_HDR_LEN,
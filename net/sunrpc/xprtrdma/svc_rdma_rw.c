@@ -190,6 +190,8 @@ static void svc_rdma_cc_release(struct svc_rdma_chunk_ctxt *cc,
  *  - Stores arguments for the SGL constructor functions
  */
 struct svc_rdma_write_info {
+	struct list_head	wi_list;
+
 	/* write state of this chunk */
 	unsigned int		wi_seg_off;
 	unsigned int		wi_seg_no;
@@ -233,7 +235,9 @@ static void svc_rdma_write_info_free(struct svc_rdma_write_info *info)
  * @cq: controlling Completion Queue
  * @wc: Work Completion
  *
- * Pages under I/O are freed by a subsequent Send completion.
+ * The chunk's SQ entries are returned here. Its DMA mappings and
+ * the pages under I/O are released by the subsequent Send
+ * completion, which the SQ reports only after this one.
  */
 static void svc_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 {
@@ -241,8 +245,6 @@ static void svc_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 	struct svc_rdma_chunk_ctxt *cc =
 			container_of(cqe, struct svc_rdma_chunk_ctxt, cc_cqe);
 	struct svcxprt_rdma *rdma = cc->cc_rdma;
-	struct svc_rdma_write_info *info =
-			container_of(cc, struct svc_rdma_write_info, wi_cc);
 
 	trace_svcrdma_wc_write(wc, &cc->cc_cid);
 
@@ -251,8 +253,6 @@ static void svc_rdma_write_done(struct ib_cq *cq, struct ib_wc *wc)
 
 	if (unlikely(wc->status != IB_WC_SUCCESS))
 		set_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags);
-
-	svc_rdma_write_info_free(info);
 }
 
 /* State for pulling a Read chunk.
@@ -384,6 +384,74 @@ static int svc_rdma_post_chunk_ctxt(struct svc_rdma_chunk_ctxt *cc)
 	return -ENOTCONN;
 }
 
+/* Link the RDMA Write WRs of one Write or Reply chunk in front of
+ * the Send WR chain of @sctxt, so that svc_rdma_send() posts the
+ * chunk and the RPC Reply together with a single doorbell.
+ *
+ * @sctxt owns @info from here on, and releases it once the Send
+ * WR has completed or, if nothing was posted, when it is put.
+ */
+static int svc_rdma_chain_write_info(struct svc_rdma_write_info *info,
+				     struct svc_rdma_send_ctxt *sctxt)
+{
+	struct svc_rdma_chunk_ctxt *cc = &info->wi_cc;
+	struct svcxprt_rdma *rdma = cc->cc_rdma;
+	struct ib_send_wr *first_wr;
+	struct list_head *tmp;
+	struct ib_cqe *cqe;
+	int ret;
+
+	if (cc->cc_sqecount > rdma->sc_sq_depth)
+		return -EINVAL;
+
+	/* Rather than build a chain deeper than the SQ, post the
+	 * Write WRs chained so far and start a new chain.
+	 */
+	if (sctxt->sc_sqecount + cc->cc_sqecount > rdma->sc_sq_depth) {
+		ret = svc_rdma_post_writes(rdma, sctxt);
+		if (ret < 0)
+			return ret;
+	}
+
+	first_wr = sctxt->sc_wr_chain;
+	cqe = &cc->cc_cqe;
+	list_for_each(tmp, &cc->cc_rwctxts) {
+		struct svc_rdma_rw_ctxt *ctxt;
+
+		ctxt = list_entry(tmp, struct svc_rdma_rw_ctxt, rw_list);
+		first_wr = rdma_rw_ctx_wrs(&ctxt->rw_ctx, rdma->sc_qp,
+					   rdma->sc_port_num, cqe, first_wr);
+		cqe = NULL;
+	}
+
+	trace_svcrdma_post_chunk(&cc->cc_cid, cc->cc_sqecount);
+	sctxt->sc_wr_chain = first_wr;
+	sctxt->sc_sqecount += cc->cc_sqecount;
+	list_add(&info->wi_list, &sctxt->sc_write_info_list);
+	return 0;
+}
+
+/**
+ * svc_rdma_write_chunk_release - Release Write chunk resources
+ * @rdma: controlling RDMA transport
+ * @sctxt: Send context that owns the chained Write chunks
+ *
+ * None of the chunks' WRs can still be executing: either they
+ * were never posted, or the Send WR that follows them completed.
+ */
+void svc_rdma_write_chunk_release(struct svcxprt_rdma *rdma,
+				  struct svc_rdma_send_ctxt *sctxt)
+{
+	struct svc_rdma_write_info *info;
+
+	while ((info = list_first_entry_or_null(&sctxt->sc_write_info_list,
+						struct svc_rdma_write_info,
+						wi_list)) != NULL) {
+		list_del(&info->wi_list);
+		svc_rdma_write_info_free(info);
+	}
+}
+
 /* Build and DMA-map an SGL that covers one kvec in an xdr_buf
  */
 static void svc_rdma_vec_to_sg(struct svc_rdma_write_info *info,
@@ -524,20 +592,24 @@ static int svc_rdma_send_xdr_pagelist(struct svc_rdma_write_info *info,
 /**
  * svc_rdma_send_write_chunk - Write all segments in a Write chunk
  * @rdma: controlling RDMA transport
+ * @sctxt: Send context for the RPC Reply
  * @wr_ch: Write chunk provided by client
  * @xdr: xdr_buf containing the data payload
  * @offset: payload's byte offset in @xdr
  * @length: size of payload, in bytes
  *
+ * The RDMA Writes are not posted here. They are chained in front of
+ * the Send WR of @sctxt and posted along with the RPC Reply.
+ *
  * Returns a non-negative number of bytes the chunk consumed, or
  *	%-E2BIG if the payload was larger than the Write chunk,
  *	%-EINVAL if client provided too many segments,
  *	%-ENOMEM if rdma_rw context pool was exhausted,
- *	%-ENOTCONN if posting failed (connection is lost),
  *	%-EIO if rdma_rw initialization failed (DMA mapping, etc).
  */
-int svc_rdma_send_write_chunk(struct svcxprt_rdma *rdma, __be32 *wr_ch,
-			      struct xdr_buf *xdr,
+int svc_rdma_send_write_chunk(struct svcxprt_rdma *rdma,
+			      struct svc_rdma_send_ctxt *sctxt,
+			      __be32 *wr_ch, struct xdr_buf *xdr,
 			      unsigned int offset, unsigned long length)
 {
 	struct svc_rdma_write_info *info;
@@ -554,7 +626,7 @@ int svc_rdma_send_write_chunk(struct svcxprt_rdma *rdma, __be32 *wr_ch,
 	if (ret < 0)
 		goto out_err;
 
-	ret = svc_rdma_post_chunk_ctxt(&info->wi_cc);
+	ret = svc_rdma_chain_write_info(info, sctxt);
 	if (ret < 0)
 		goto out_err;
 
@@ -569,17 +641,21 @@ int svc_rdma_send_write_chunk(struct svcxprt_rdma *rdma, __be32 *wr_ch,
 /**
  * svc_rdma_send_reply_chunk - Write all segments in the Reply chunk
  * @rdma: controlling RDMA transport
+ * @sctxt: Send context for the RPC Reply
  * @rctxt: Write and Reply chunks from client
  * @xdr: xdr_buf containing an RPC Reply
  *
+ * As with Write chunks, the RDMA Writes are chained in front of the
+ * Send WR of @sctxt rather than posted here.
+ *
  * Returns a non-negative number of bytes the chunk consumed, or
  *	%-E2BIG if the payload was larger than the Reply chunk,
  *	%-EINVAL if client provided too many segments,
  *	%-ENOMEM if rdma_rw context pool was exhausted,
- *	%-ENOTCONN if posting failed (connection is lost),
  *	%-EIO if rdma_rw initialization failed (DMA mapping, etc).
  */
 int svc_rdma_send_reply_chunk(struct svcxprt_rdma *rdma,
+			      struct svc_rdma_send_ctxt *sctxt,
 			      const struct svc_rdma_recv_ctxt *rctxt,
 			      struct xdr_buf *xdr)
 {
@@ -614,7 +690,7 @@ int svc_rdma_send_reply_chunk(struct svcxprt_rdma *rdma,
 		consumed += xdr->tail[0].iov_len;
 	}
 
-	ret = svc_rdma_post_chunk_ctxt(&info->wi_cc);
+	ret = svc_rdma_chain_write_info(info, sctxt);
 	if (ret < 0)
 		goto out_err;
 
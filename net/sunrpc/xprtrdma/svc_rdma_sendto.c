@@ -99,6 +99,7 @@
  * where two different Write segments send portions of the same page.
  */
 
+#include <linux/hash.h>
 #include <linux/spinlock.h>
 #include <asm/unaligned.h>
 
@@ -140,6 +141,7 @@ svc_rdma_send_ctxt_alloc(struct svcxprt_rdma *rdma)
 
 	size = sizeof(*ctxt);
 	size += rdma->sc_max_send_sges * sizeof(struct ib_sge);
+	size += rdma->sc_max_send_sges * sizeof(u8);
 	ctxt = kmalloc(size, GFP_KERNEL);
 	if (!ctxt)
 		goto fail0;
@@ -157,6 +159,8 @@ svc_rdma_send_ctxt_alloc(struct svcxprt_rdma *rdma)
 	ctxt->sc_send_wr.wr_cqe = &ctxt->sc_cqe;
 	ctxt->sc_send_wr.sg_list = ctxt->sc_sges;
 	ctxt->sc_send_wr.send_flags = IB_SEND_SIGNALED;
+	INIT_LIST_HEAD(&ctxt->sc_write_info_list);
+	ctxt->sc_sge_slots = (u8 *)&ctxt->sc_sges[rdma->sc_max_send_sges];
 	ctxt->sc_cqe.done = svc_rdma_wc_send;
 	ctxt->sc_xprt_buf = buffer;
 	xdr_buf_init(&ctxt->sc_hdrbuf, ctxt->sc_xprt_buf,
@@ -195,6 +199,103 @@ void svc_rdma_send_ctxts_destroy(struct svcxprt_rdma *rdma)
 	}
 }
 
+/**
+ * svc_rdma_send_ctxts_unpark - Release send_ctxt's left by post errors
+ * @rdma: svcxprt_rdma being torn down
+ *
+ * The caller has drained the QP, so none of the WRs of these
+ * send_ctxt's can still be executing.
+ */
+void svc_rdma_send_ctxts_unpark(struct svcxprt_rdma *rdma)
+{
+	struct svc_rdma_send_ctxt *ctxt;
+
+	while ((ctxt = svc_rdma_next_send_ctxt(&rdma->sc_parked_ctxts))) {
+		list_del(&ctxt->sc_list);
+		ctxt->sc_writes_posted = false;
+		svc_rdma_send_ctxt_put(rdma, ctxt);
+	}
+}
+
+/**
+ * svc_rdma_dma_cache_destroy - Release cached DMA mappings
+ * @rdma: svcxprt_rdma being torn down
+ *
+ */
+void svc_rdma_dma_cache_destroy(struct svcxprt_rdma *rdma)
+{
+	struct svc_rdma_dma_cache *dc;
+	unsigned int i;
+
+	for (i = 0; i < SVC_RDMA_DMA_CACHE_SIZE; i++) {
+		dc = &rdma->sc_dma_cache[i];
+		if (!dc->dc_page)
+			continue;
+		ib_dma_unmap_page(rdma->sc_cm_id->device, dc->dc_addr,
+				  PAGE_SIZE, DMA_TO_DEVICE);
+		put_page(dc->dc_page);
+		dc->dc_page = NULL;
+	}
+}
+
+/* Find or create a cached DMA mapping of @page. A slot that is in
+ * use by other Sends for a different page is left alone, and the
+ * caller maps @page the usual way.
+ *
+ * Returns the slot number, or -1 if @page could not be cached.
+ */
+static int svc_rdma_dma_cache_get(struct svcxprt_rdma *rdma,
+				  struct page *page, dma_addr_t *addr)
+{
+	struct ib_device *dev = rdma->sc_cm_id->device;
+	int slot = hash_ptr(page, SVC_RDMA_DMA_CACHE_BITS);
+	struct svc_rdma_dma_cache *dc = &rdma->sc_dma_cache[slot];
+
+	spin_lock(&rdma->sc_dma_cache_lock);
+	if (dc->dc_page == page) {
+		dc->dc_users++;
+		spin_unlock(&rdma->sc_dma_cache_lock);
+
+		/* The page may have been written since it was mapped */
+		ib_dma_sync_single_for_device(dev, dc->dc_addr, PAGE_SIZE,
+					      DMA_TO_DEVICE);
+		*addr = dc->dc_addr;
+		return slot;
+	}
+	if (dc->dc_users)
+		goto out_busy;
+
+	if (dc->dc_page) {
+		ib_dma_unmap_page(dev, dc->dc_addr, PAGE_SIZE, DMA_TO_DEVICE);
+		put_page(dc->dc_page);
+		dc->dc_page = NULL;
+	}
+	dc->dc_addr = ib_dma_map_page(dev, page, 0, PAGE_SIZE, DMA_TO_DEVICE);
+	if (ib_dma_mapping_error(dev, dc->dc_addr))
+		goto out_busy;
+
+	/* The reference keeps the page, and thus the mapping, valid
+	 * until the slot is reused or the transport is destroyed.
+	 */
+	get_page(page);
+	dc->dc_page = page;
+	dc->dc_users = 1;
+	spin_unlock(&rdma->sc_dma_cache_lock);
+	*addr = dc->dc_addr;
+	return slot;
+
+out_busy:
+	spin_unlock(&rdma->sc_dma_cache_lock);
+	return -1;
+}
+
+static void svc_rdma_dma_cache_put(struct svcxprt_rdma *rdma, int slot)
+{
+	spin_lock(&rdma->sc_dma_cache_lock);
+	rdma->sc_dma_cache[slot].dc_users--;
+	spin_unlock(&rdma->sc_dma_cache_lock);
+}
+
 /**
  * svc_rdma_send_ctxt_get - Get a free send_ctxt
  * @rdma: controlling svcxprt_rdma
@@ -218,7 +319,11 @@ struct svc_rdma_send_ctxt *svc_rdma_send_ctxt_get(struct svcxprt_rdma *rdma)
 	xdr_init_encode(&ctxt->sc_stream, &ctxt->sc_hdrbuf,
 			ctxt->sc_xprt_buf, NULL);
 
+	ctxt->sc_send_wr.next = NULL;
 	ctxt->sc_send_wr.num_sge = 0;
+	ctxt->sc_wr_chain = &ctxt->sc_send_wr;
+	ctxt->sc_sqecount = 1;
+	ctxt->sc_writes_posted = false;
 	ctxt->sc_cur_sge_no = 0;
 	ctxt->sc_page_count = 0;
 	return ctxt;
@@ -236,7 +341,12 @@ struct svc_rdma_send_ctxt *svc_rdma_send_ctxt_get(struct svcxprt_rdma *rdma)
  * @rdma: controlling svcxprt_rdma
  * @ctxt: object to return to the free list
  *
- * Pages left in sc_pages are DMA unmapped and released.
+ * Pages left in sc_pages are DMA unmapped and released, and so are
+ * the Write chunks that were chained to @ctxt.
+ *
+ * If some of @ctxt's Write WRs were posted but its Send WR was
+ * not, there is no completion to tell when those Writes are done
+ * with its pages. @ctxt is then parked until the QP is drained.
  */
 void svc_rdma_send_ctxt_put(struct svcxprt_rdma *rdma,
 			    struct svc_rdma_send_ctxt *ctxt)
@@ -244,10 +354,24 @@ void svc_rdma_send_ctxt_put(struct svcxprt_rdma *rdma,
 	struct ib_device *device = rdma->sc_cm_id->device;
 	unsigned int i;
 
+	if (unlikely(ctxt->sc_writes_posted)) {
+		spin_lock(&rdma->sc_send_lock);
+		list_add(&ctxt->sc_list, &rdma->sc_parked_ctxts);
+		spin_unlock(&rdma->sc_send_lock);
+		return;
+	}
+
+	svc_rdma_write_chunk_release(rdma, ctxt);
+
 	/* The first SGE contains the transport header, which
 	 * remains mapped until @ctxt is destroyed.
 	 */
 	for (i = 1; i < ctxt->sc_send_wr.num_sge; i++) {
+		if (ctxt->sc_sge_slots[i]) {
+			svc_rdma_dma_cache_put(rdma,
+					       ctxt->sc_sge_slots[i] - 1);
+			continue;
+		}
 		ib_dma_unmap_page(device,
 				  ctxt->sc_sges[i].addr,
 				  ctxt->sc_sges[i].length,
@@ -285,6 +409,8 @@ static void svc_rdma_wc_send(struct ib_cq *cq, struct ib_wc *wc)
 	atomic_inc(&rdma->sc_sq_avail);
 	wake_up(&rdma->sc_send_wait);
 
+	/* WRs posted ahead of this Send have all completed */
+	ctxt->sc_writes_posted = false;
 	svc_rdma_send_ctxt_put(rdma, ctxt);
 
 	if (unlikely(wc->status != IB_WC_SUCCESS)) {
@@ -293,13 +419,176 @@ static void svc_rdma_wc_send(struct ib_cq *cq, struct ib_wc *wc)
 	}
 }
 
+/* Reserve @sqecount SQ entries, waiting for them if the SQ is full.
+ */
+static int svc_rdma_sq_reserve(struct svcxprt_rdma *rdma, int sqecount)
+{
+	while (atomic_sub_return(sqecount, &rdma->sc_sq_avail) < 0) {
+		atomic_inc(&rdma_stat_sq_starve);
+		trace_svcrdma_sq_full(rdma);
+		atomic_add(sqecount, &rdma->sc_sq_avail);
+		wait_event(rdma->sc_send_wait,
+			   atomic_read(&rdma->sc_sq_avail) >= sqecount);
+		if (test_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags))
+			return -ENOTCONN;
+		trace_svcrdma_sq_retry(rdma);
+	}
+	return 0;
+}
+
+/* Return the SQ entries of the WRs that ib_post_send() did not post.
+ * A Write chunk whose signaled WR was not posted never completes,
+ * so the entries of its WRs that were posted stay consumed. The
+ * transport is closing anyway.
+ */
+static void svc_rdma_sq_unreserve(struct svcxprt_rdma *rdma,
+				  const struct ib_send_wr *bad_wr)
+{
+	int sqecount = 0;
+
+	for (; bad_wr; bad_wr = bad_wr->next)
+		sqecount++;
+	atomic_add(sqecount, &rdma->sc_sq_avail);
+	wake_up(&rdma->sc_send_wait);
+}
+
 /**
- * svc_rdma_send - Post a single Send WR
+ * svc_rdma_post_writes - Post the Write WRs chained ahead of a Send WR
+ * @rdma: transport on which to post the WRs
+ * @ctxt: send ctxt whose WR chain is too deep to post at once
+ *
+ * On return, only the Send WR is left on @ctxt's chain. @ctxt
+ * still owns the Write chunks, and releases them after its Send
+ * WR completes.
+ *
+ * Returns zero if the Write WRs were posted. Otherwise, a negative
+ * errno is returned.
+ */
+int svc_rdma_post_writes(struct svcxprt_rdma *rdma,
+			 struct svc_rdma_send_ctxt *ctxt)
+{
+	struct ib_send_wr *first_wr = ctxt->sc_wr_chain;
+	int sqecount = ctxt->sc_sqecount - 1;
+	const struct ib_send_wr *bad_wr;
+	struct ib_send_wr *last_wr;
+	int ret;
+
+	if (first_wr == &ctxt->sc_send_wr)
+		return 0;
+
+	for (last_wr = first_wr; last_wr->next != &ctxt->sc_send_wr;
+	     last_wr = last_wr->next)
+		;
+	last_wr->next = NULL;
+	ctxt->sc_wr_chain = &ctxt->sc_send_wr;
+	ctxt->sc_sqecount = 1;
+
+	ret = svc_rdma_sq_reserve(rdma, sqecount);
+	if (ret)
+		return ret;
+
+	trace_svcrdma_post_chunk(&ctxt->sc_cid, sqecount);
+	ret = ib_post_send(rdma->sc_qp, first_wr, &bad_wr);
+	if (!ret || bad_wr != first_wr)
+		ctxt->sc_writes_posted = true;
+	if (ret) {
+		trace_svcrdma_sq_post_err(rdma, ret);
+		set_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags);
+		svc_rdma_sq_unreserve(rdma, bad_wr);
+	}
+	return ret;
+}
+
+/* Clean up after ib_post_send() failed to post a batch of Sends.
+ * The WRs from @bad_wr to the end of the chain were not posted, so
+ * their send_ctxt's are released here. A send_ctxt whose Send WR
+ * was not posted but some of whose Write WRs were is parked by
+ * svc_rdma_send_ctxt_put().
+ */
+static void svc_rdma_post_batch_err(struct svcxprt_rdma *rdma,
+				    const struct ib_send_wr *bad_wr, int ret)
+{
+	const struct ib_send_wr *wr, *next, *unposted = bad_wr;
+	struct svc_rdma_send_ctxt *ctxt;
+
+	trace_svcrdma_sq_post_err(rdma, ret);
+	set_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags);
+	svc_rdma_sq_unreserve(rdma, bad_wr);
+
+	for (wr = bad_wr; wr; wr = next) {
+		next = wr->next;
+		if (!wr->wr_cqe || wr->wr_cqe->done != svc_rdma_wc_send)
+			continue;
+
+		/* A send_ctxt's WRs end with its Send WR */
+		ctxt = container_of(wr, struct svc_rdma_send_ctxt,
+				    sc_send_wr);
+		if (ctxt->sc_wr_chain != unposted)
+			ctxt->sc_writes_posted = true;
+		svc_rdma_send_ctxt_put(rdma, ctxt);
+		unposted = next;
+	}
+	svc_xprt_enqueue(&rdma->sc_xprt);
+}
+
+/* Post every send_ctxt queued on sc_send_batch. Only one thread at
+ * a time does this: a thread that finds another one posting leaves
+ * its send_ctxt on the queue, and the posting thread picks it up on
+ * its next pass. Replies that become ready while a doorbell is being
+ * rung thus share the next doorbell, and no reply waits for others.
+ */
+static void svc_rdma_post_batch(struct svcxprt_rdma *rdma)
+{
+	struct svc_rdma_send_ctxt *ctxt, *prev;
+	const struct ib_send_wr *bad_wr;
+	struct ib_send_wr *first_wr;
+	struct llist_node *batch;
+	int ret;
+
+	while (!test_and_set_bit(RDMAXPRT_SQ_POSTING, &rdma->sc_flags)) {
+		while ((batch = llist_del_all(&rdma->sc_send_batch))) {
+			batch = llist_reverse_order(batch);
+
+			first_wr = NULL;
+			prev = NULL;
+			llist_for_each_entry(ctxt, batch, sc_batch_node) {
+				trace_svcrdma_post_send(ctxt);
+				if (prev)
+					prev->sc_send_wr.next = ctxt->sc_wr_chain;
+				else
+					first_wr = ctxt->sc_wr_chain;
+				prev = ctxt;
+			}
+
+			/* Once posted, the send_ctxt's can complete and
+			 * be reused at any time: leave them alone.
+			 */
+			ret = ib_post_send(rdma->sc_qp, first_wr, &bad_wr);
+			if (unlikely(ret))
+				svc_rdma_post_batch_err(rdma, bad_wr, ret);
+		}
+
+		clear_bit(RDMAXPRT_SQ_POSTING, &rdma->sc_flags);
+		smp_mb__after_atomic();
+		if (llist_empty(&rdma->sc_send_batch))
+			break;
+	}
+}
+
+/**
+ * svc_rdma_send - Post a Send WR and the RDMA Writes chained to it
  * @rdma: transport on which to post the WR
  * @ctxt: send ctxt with a Send WR ready to post
  *
- * Returns zero the Send WR was posted successfully. Otherwise, a
- * negative errno is returned.
+ * Any RDMA Writes for Write and Reply chunks have been chained in
+ * front of the Send WR, so the whole RPC Reply is posted with one
+ * call to ib_post_send(). Replies that other threads queue in the
+ * meantime are posted with the same call.
+ *
+ * Returns zero if @ctxt was queued to be posted; from then on, it
+ * is released by Send completion or by the posting thread if the
+ * post fails. Otherwise, a negative errno is returned and the
+ * caller still owns @ctxt.
  */
 int svc_rdma_send(struct svcxprt_rdma *rdma, struct svc_rdma_send_ctxt *ctxt)
 {
@@ -314,31 +603,22 @@ int svc_rdma_send(struct svcxprt_rdma *rdma, struct svc_rdma_send_ctxt *ctxt)
 				      wr->sg_list[0].length,
 				      DMA_TO_DEVICE);
 
-	/* If the SQ is full, wait until an SQ entry is available */
-	while (1) {
-		if ((atomic_dec_return(&rdma->sc_sq_avail) < 0)) {
-			atomic_inc(&rdma_stat_sq_starve);
-			trace_svcrdma_sq_full(rdma);
-			atomic_inc(&rdma->sc_sq_avail);
-			wait_event(rdma->sc_send_wait,
-				   atomic_read(&rdma->sc_sq_avail) > 1);
-			if (test_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags))
-				return -ENOTCONN;
-			trace_svcrdma_sq_retry(rdma);
-			continue;
-		}
-
-		trace_svcrdma_post_send(ctxt);
-		ret = ib_post_send(rdma->sc_qp, wr, NULL);
+	/* A chain deeper than the SQ would never find enough free
+	 * SQ entries. Post its Writes ahead of the Send WR instead.
+	 */
+	if (ctxt->sc_sqecount > rdma->sc_sq_depth) {
+		ret = svc_rdma_post_writes(rdma, ctxt);
 		if (ret)
-			break;
-		return 0;
+			return ret;
 	}
 
-	trace_svcrdma_sq_post_err(rdma, ret);
-	set_bit(XPT_CLOSE, &rdma->sc_xprt.xpt_flags);
-	wake_up(&rdma->sc_send_wait);
-	return ret;
+	ret = svc_rdma_sq_reserve(rdma, ctxt->sc_sqecount);
+	if (ret)
+		return ret;
+
+	llist_add(&ctxt->sc_batch_node, &rdma->sc_send_batch);
+	svc_rdma_post_batch(rdma);
+	return 0;
 }
 
 /**
@@ -514,12 +794,25 @@ static int svc_rdma_dma_map_page(struct svcxprt_rdma *rdma,
 {
 	struct ib_device *dev = rdma->sc_cm_id->device;
 	dma_addr_t dma_addr;
+	int slot;
+
+	/* Page cache pages tend to be sent again and again */
+	if (!PageAnon(page) && page_mapping(page)) {
+		slot = svc_rdma_dma_cache_get(rdma, page, &dma_addr);
+		if (slot >= 0) {
+			dma_addr += offset;
+			goto out_mapped;
+		}
+	}
 
+	slot = -1;
 	dma_addr = ib_dma_map_page(dev, page, offset, len, DMA_TO_DEVICE);
 	trace_svcrdma_dma_map_page(rdma, dma_addr, len);
 	if (ib_dma_mapping_error(dev, dma_addr))
 		goto out_maperr;
 
+out_mapped:
+	ctxt->sc_sge_slots[ctxt->sc_cur_sge_no] = slot + 1;
 	ctxt->sc_sges[ctxt->sc_cur_sge_no].addr = dma_addr;
 	ctxt->sc_sges[ctxt->sc_cur_sge_no].length = len;
 	ctxt->sc_send_wr.num_sge++;
@@ -777,9 +1070,8 @@ static void svc_rdma_save_io_pages(struct svc_rqst *rqstp,
  *
  * RDMA Send is the last step of transmitting an RPC reply. Pages
  * involved in the earlier RDMA Writes are here transferred out
- * of the rqstp and into the sctxt's page array. These pages are
- * DMA unmapped by each Write completion, but the subsequent Send
- * completion finally releases these pages.
+ * of the rqstp and into the sctxt's page array. The Send completion
+ * DMA unmaps the Write chunks and releases these pages.
  *
  * Assumptions:
  * - The Reply's transport header will never be larger than a page.
@@ -933,8 +1225,8 @@ int svc_rdma_sendto(struct svc_rqst *rqstp)
 			offset = xdr->head[0].iov_len;
 			length = xdr->page_len;
 		}
-		ret = svc_rdma_send_write_chunk(rdma, wr_lst, xdr, offset,
-						length);
+		ret = svc_rdma_send_write_chunk(rdma, sctxt, wr_lst, xdr,
+						offset, length);
 		if (ret < 0)
 			goto err2;
 		if (svc_rdma_encode_write_list(rctxt, sctxt, length) < 0)
@@ -944,7 +1236,8 @@ int svc_rdma_sendto(struct svc_rqst *rqstp)
 			goto err0;
 	}
 	if (rp_ch) {
-		ret = svc_rdma_send_reply_chunk(rdma, rctxt, &rqstp->rq_res);
+		ret = svc_rdma_send_reply_chunk(rdma, sctxt, rctxt,
+						&rqstp->rq_res);
 		if (ret < 0)
 			goto err2;
 		if (svc_rdma_encode_reply_chunk(rctxt, sctxt, ret) < 0)
@@ -964,13 +1257,17 @@ int svc_rdma_sendto(struct svc_rqst *rqstp)
 		goto err1;
 
 	/* Send completion releases payload pages that were part
-	 * of previously posted RDMA Writes.
+	 * of RDMA Writes chained ahead of the error message.
 	 */
 	svc_rdma_save_io_pages(rqstp, sctxt);
 	svc_rdma_send_error_msg(rdma, sctxt, rctxt, ret);
 	return 0;
 
  err1:
+	/* Write WRs that were already posted may still be reading
+	 * the payload pages: let @sctxt hold on to them.
+	 */
+	svc_rdma_save_io_pages(rqstp, sctxt);
 	svc_rdma_send_ctxt_put(rdma, sctxt);
  err0:
 	trace_svcrdma_send_err(rqstp, ret);
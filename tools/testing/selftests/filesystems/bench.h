@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Minimal harness shared by the filesystem microbenchmarks: runs a worker
+ * function on a number of threads for a fixed time and sums up what they
+ * did.  Workers loop until bench_stop is set, counting in their struct
+ * bench_worker.
+ */
+#ifndef __SELFTESTS_FILESYSTEMS_BENCH_H
+#define __SELFTESTS_FILESYSTEMS_BENCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile bool bench_stop;
+
+struct bench_worker {
+	pthread_t thread;
+	int id;
+	unsigned long ops;
+	unsigned long errors;
+};
+
+struct bench_result {
+	int nr_threads;
+	unsigned long ops;
+	unsigned long errors;
+	double elapsed;
+};
+
+/* Pick the CPU for worker @id among those the benchmark may run on */
+static int bench_worker_cpu(const cpu_set_t *allowed, int id)
+{
+	int nr = CPU_COUNT(allowed);
+	int cpu;
+
+	if (!nr)
+		return -1;
+
+	id %= nr;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, allowed) && !id--)
+			return cpu;
+	}
+	return -1;
+}
+
+/*
+ * Run @fn on @nr_threads threads for @seconds.  With @pin, worker i is bound
+ * to the i-th CPU of the process' affinity mask, wrapping around if there are
+ * more threads than CPUs.  Returns -1 if not a single thread could be started.
+ */
+static int bench_run(void *(*fn)(void *), int nr_threads, int seconds,
+		     bool pin, struct bench_result *res)
+{
+	struct bench_worker *workers;
+	struct timespec start, end;
+	cpu_set_t allowed;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+
+	if (pin && sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return -1;
+	}
+
+	bench_stop = false;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		pthread_attr_t attr;
+		cpu_set_t set;
+		int cpu;
+
+		pthread_attr_init(&attr);
+		cpu = pin ? bench_worker_cpu(&allowed, i) : -1;
+		if (cpu >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+
+		workers[i].id = i;
+		errno = pthread_create(&workers[i].thread, &attr, fn,
+				       &workers[i]);
+		pthread_attr_destroy(&attr);
+		if (errno) {
+			perror("pthread_create");
+			bench_stop = true;
+			nr_threads = i;
+			break;
+		}
+	}
+
+	if (!bench_stop)
+		sleep(seconds);
+	bench_stop = true;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		res->ops += workers[i].ops;
+		res->errors += workers[i].errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(workers);
+
+	res->nr_threads = nr_threads;
+	res->elapsed = (end.tv_sec - start.tv_sec) +
+		       (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	return nr_threads ? 0 : -1;
+}
+
+#endif /* __SELFTESTS_FILESYSTEMS_BENCH_H */
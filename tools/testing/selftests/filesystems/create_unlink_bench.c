@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Parallel create/unlink scaling benchmark for journalling filesystems.
+ *
+ * Every thread creates and unlinks files in its own subdirectory of -d,
+ * so each operation starts a couple of journal handles while the threads
+ * share nothing but the journal.  The run is repeated for 1, 2, 4, ...
+ * threads up to -t (default: number of CPUs in the affinity mask), each
+ * thread pinned to its own CPU of that mask, and the aggregate operations
+ * per second are reported for every CPU count.
+ *
+ *   ./create_unlink_bench -d dir [-t threads] [-s seconds]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+static const char *dir;
+
+static void *worker_fn(void *arg)
+{
+	struct bench_worker *w = arg;
+	char path[PATH_MAX];
+	unsigned long i = 0;
+	int len, fd;
+
+	len = snprintf(path, sizeof(path), "%s/bench.%d", dir, w->id);
+	if (mkdir(path, 0755) && errno != EEXIST) {
+		w->errors++;
+		return NULL;
+	}
+
+	while (!bench_stop) {
+		snprintf(path + len, sizeof(path) - len, "/f%lu", i++ % 64);
+		fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+		if (fd < 0) {
+			w->errors++;
+			continue;
+		}
+		close(fd);
+		if (unlink(path))
+			w->errors++;
+		w->ops++;
+	}
+
+	path[len] = '\0';
+	rmdir(path);
+	return NULL;
+}
+
+static int run(int nr_threads, int seconds)
+{
+	struct bench_result res;
+
+	if (bench_run(worker_fn, nr_threads, seconds, true, &res))
+		return -1;
+
+	printf("%4d cpus: %10lu ops %12.0f ops/s %10.0f ops/s/cpu %lu errors\n",
+	       res.nr_threads, res.ops, res.ops / res.elapsed,
+	       res.ops / res.elapsed / res.nr_threads, res.errors);
+
+	return res.errors ? -1 : 0;
+}
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 5;
+	int opt, n, ret = 0;
+	cpu_set_t allowed;
+
+	if (!sched_getaffinity(0, sizeof(allowed), &allowed))
+		max_threads = CPU_COUNT(&allowed);
+
+	while ((opt = getopt(argc, argv, "d:t:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			dir = NULL;
+			break;
+		}
+	}
+
+	if (!dir || max_threads <= 0 || seconds <= 0) {
+		fprintf(stderr, "usage: %s -d dir [-t threads] [-s seconds]\n",
+			argv[0]);
+		return 1;
+	}
+
+	for (n = 1; ; n *= 2) {
+		if (n > max_threads)
+			n = max_threads;
+		if (run(n, seconds))
+			ret = 1;
+		if (n == max_threads)
+			break;
+	}
+
+	return ret;
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Parallel open/read/close benchmark for kernfs based filesystems.
+ *
+ * Collects up to -n regular files below a directory (default /sys) and
+ * has -t threads open, read and close them round robin for -s seconds,
+ * which is what monitoring agents scraping sysfs and cgroupfs do.  The
+ * aggregate number of open/read/close cycles per second is reported.
+ *
+ *   ./sysfs_read_bench [-d dir] [-n files] [-t threads] [-s seconds]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+static char **files;
+static int nr_files;
+static int max_files = 10000;
+
+static int collect(const char *path, const struct stat *st, int type,
+		   struct FTW *ftw)
+{
+	if (type != FTW_F || !(st->st_mode & S_IRUSR))
+		return 0;
+
+	/* skip anything which may block or have side effects on read */
+	if (strstr(path, "/trace") || strstr(path, "/debug") ||
+	    strstr(path, "/firmware") || strstr(path, "/security"))
+		return 0;
+
+	files[nr_files] = strdup(path);
+	if (!files[nr_files])
+		return -1;
+
+	return ++nr_files >= max_files;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct bench_worker *w = arg;
+	char buf[4096];
+	int i = w->id;
+
+	while (!bench_stop) {
+		int fd = open(files[i % nr_files], O_RDONLY | O_NONBLOCK);
+
+		if (fd < 0) {
+			w->errors++;
+		} else {
+			if (read(fd, buf, sizeof(buf)) < 0)
+				w->errors++;
+			close(fd);
+		}
+		w->ops++;
+		i += 7;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "/sys";
+	int nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 10;
+	struct bench_result res;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:t:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'n':
+			max_files = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n files] [-t threads] [-s seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (max_files <= 0 || nr_threads <= 0 || seconds <= 0) {
+		fprintf(stderr, "invalid arguments\n");
+		return 1;
+	}
+
+	files = calloc(max_files, sizeof(*files));
+	if (!files) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (nftw(dir, collect, 64, FTW_PHYS) < 0) {
+		perror("nftw");
+		return 1;
+	}
+	if (!nr_files) {
+		fprintf(stderr, "no readable files under %s\n", dir);
+		return 1;
+	}
+
+	if (bench_run(worker_fn, nr_threads, seconds, false, &res))
+		return 1;
+
+	printf("%s: %d files, %d threads, %.2fs: %lu ops (%.0f ops/s), %lu errors\n",
+	       dir, nr_files, res.nr_threads, res.elapsed, res.ops,
+	       res.ops / res.elapsed, res.errors);
+
+	return 0;
+}
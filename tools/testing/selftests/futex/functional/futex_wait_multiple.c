@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/******************************************************************************
+ *
+ * DESCRIPTION
+ *      Test FUTEX_WAIT_MULTIPLE: it must fail with EWOULDBLOCK if any of the
+ *      values differs, time out on an absolute timeout, and return the index
+ *      of the futex that was woken.
+ *
+ *****************************************************************************/
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "futextest.h"
+#include "logging.h"
+
+#define TEST_NAME "futex-wait-multiple"
+#define NR_FUTEXES 4
+#define WAKE_INDEX 2
+
+static long timeout_ns = 100000000;	/* 100ms default timeout */
+static futex_t futexes[NR_FUTEXES];
+static struct futex_wait_block fwb[NR_FUTEXES];
+
+void usage(char *prog)
+{
+	printf("Usage: %s\n", prog);
+	printf("  -c	Use color\n");
+	printf("  -h	Display this help message\n");
+	printf("  -t N	Timeout in nanoseconds (default: 100,000,000)\n");
+	printf("  -v L	Verbosity level: %d=QUIET %d=CRITICAL %d=INFO\n",
+	       VQUIET, VCRITICAL, VINFO);
+}
+
+static void *waiter_fn(void *arg)
+{
+	long res;
+
+	res = futex_wait_multiple(fwb, NR_FUTEXES, NULL, FUTEX_PRIVATE_FLAG);
+	if (res < 0)
+		res = -errno;
+
+	return (void *)res;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec to;
+	pthread_t waiter;
+	int res, ret = RET_PASS;
+	void *thr_ret;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "cht:v:")) != -1) {
+		switch (c) {
+		case 'c':
+			log_color(1);
+			break;
+		case 'h':
+			usage(basename(argv[0]));
+			exit(0);
+		case 't':
+			timeout_ns = atoi(optarg);
+			break;
+		case 'v':
+			log_verbosity(atoi(optarg));
+			break;
+		default:
+			usage(basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	ksft_print_header();
+	ksft_set_plan(1);
+	ksft_print_msg("%s: Wait on several futexes at once\n",
+	       basename(argv[0]));
+	ksft_print_msg("\tArguments: timeout=%ldns\n", timeout_ns);
+
+	for (i = 0; i < NR_FUTEXES; i++) {
+		fwb[i].uaddr = (unsigned long)&futexes[i];
+		fwb[i].val = futexes[i];
+		fwb[i].bitset = FUTEX_BITSET_MATCH_ANY;
+	}
+
+	/* A single mismatching value must keep us from blocking */
+	fwb[NR_FUTEXES - 1].val = futexes[NR_FUTEXES - 1] + 1;
+	res = futex_wait_multiple(fwb, NR_FUTEXES, NULL, FUTEX_PRIVATE_FLAG);
+	if (!res || errno != EWOULDBLOCK) {
+		fail("futex_wait_multiple returned: %d %s\n",
+		     res ? errno : res, res ? strerror(errno) : "");
+		ret = RET_FAIL;
+	}
+	fwb[NR_FUTEXES - 1].val = futexes[NR_FUTEXES - 1];
+
+	/* The timeout is absolute, as for FUTEX_WAIT_BITSET */
+	clock_gettime(CLOCK_MONOTONIC, &to);
+	to.tv_sec += timeout_ns / 1000000000;
+	to.tv_nsec += timeout_ns % 1000000000;
+	if (to.tv_nsec >= 1000000000) {
+		to.tv_sec++;
+		to.tv_nsec -= 1000000000;
+	}
+	res = futex_wait_multiple(fwb, NR_FUTEXES, &to, FUTEX_PRIVATE_FLAG);
+	if (!res || errno != ETIMEDOUT) {
+		fail("futex_wait_multiple returned: %d %s\n",
+		     res ? errno : res, res ? strerror(errno) : "");
+		ret = RET_FAIL;
+	}
+
+	if (pthread_create(&waiter, NULL, waiter_fn, NULL))
+		error("pthread_create failed\n", errno);
+
+	/* Wait for the waiter to be queued, but don't hang if it never is */
+	info("Waking futex %d\n", WAKE_INDEX);
+	for (i = 0; i < 5000; i++) {
+		if (futex_wake(&futexes[WAKE_INDEX], 1, FUTEX_PRIVATE_FLAG) > 0)
+			break;
+		usleep(1000);
+	}
+
+	pthread_join(waiter, &thr_ret);
+	if ((long)thr_ret != WAKE_INDEX) {
+		fail("futex_wait_multiple returned %ld, expected %d\n",
+		     (long)thr_ret, WAKE_INDEX);
+		ret = RET_FAIL;
+	}
+
+	print_result(TEST_NAME, ret);
+	return ret;
+}
@@ -46,6 +46,17 @@ typedef volatile u_int32_t futex_t;
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE	(FUTEX_CMP_REQUEUE_PI | \
 					 FUTEX_PRIVATE_FLAG)
 #endif
+#ifndef FUTEX_WAIT_MULTIPLE
+#define FUTEX_WAIT_MULTIPLE		14
+struct futex_wait_block {
+	__u64 uaddr;
+	__u32 val;
+	__u32 bitset;
+};
+#endif
+#ifndef FUTEX_WAIT_MULTIPLE_MAX
+#define FUTEX_WAIT_MULTIPLE_MAX		128
+#endif
 
 /**
  * futex() - SYS_futex syscall wrapper
@@ -189,6 +200,22 @@ futex_wait_requeue_pi(futex_t *uaddr, futex_t val, futex_t *uaddr2,
 		     opflags);
 }
 
+/**
+ * futex_wait_multiple() - block on several futexes until any of them is woken
+ * @fwb:	array of futex address, expected value and bitset
+ * @count:	number of entries in @fwb
+ * @timeout:	absolute timeout
+ *
+ * Returns the index of the futex that was woken.
+ */
+static inline int
+futex_wait_multiple(struct futex_wait_block *fwb, int count,
+		    struct timespec *timeout, int opflags)
+{
+	return futex(fwb, FUTEX_WAIT_MULTIPLE, count, timeout, NULL, 0,
+		     opflags);
+}
+
 /**
  * futex_cmp_requeue_pi() - requeue tasks from uaddr to uaddr2 (PI aware)
  * @uaddr:	non-PI futex source
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Test PACKET_FANOUT_OCCUPANCY.
+ *
+ * All packets of the test share one UDP flow, so PACKET_FANOUT_HASH would
+ * deliver every one of them to the same member.  With a small receive
+ * buffer and nobody reading, that member becomes congested after a few
+ * packets and the occupancy mode must move the flow to the other member.
+ *
+ * Runs over loopback and needs CAP_NET_RAW.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+#ifndef PACKET_FANOUT_OCCUPANCY
+#define PACKET_FANOUT_OCCUPANCY		8
+#endif
+
+#define PORT_BASE			8000
+#define NUM_PACKETS			64
+#define RCVBUF				4096
+
+/* Accept only UDP packets to PORT_BASE on loopback */
+static void sock_setfilter(int fd)
+{
+	struct sock_filter bpf_filter[] = {
+		{ 0x30, 0, 0, offsetof(struct iphdr, protocol) },
+		{ 0x15, 0, 4, IPPROTO_UDP },
+		{ 0xb1, 0, 0, 0 },		/* ldxb 4*([0]&0xf) */
+		{ 0x48, 0, 0, 2 },		/* ldh [x + 2]: dest port */
+		{ 0x15, 0, 1, PORT_BASE },
+		{ 0x06, 0, 0, 0xffff },
+		{ 0x06, 0, 0, 0 },
+	};
+	struct sock_fprog bpf_prog = {
+		.len = sizeof(bpf_filter) / sizeof(bpf_filter[0]),
+		.filter = bpf_filter,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf_prog,
+		       sizeof(bpf_prog))) {
+		perror("setsockopt SO_ATTACH_FILTER");
+		exit(1);
+	}
+}
+
+static int sock_fanout_open(int group_id)
+{
+	int fd, val;
+
+	fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (fd < 0) {
+		if (errno == EPERM) {
+			fprintf(stderr, "need CAP_NET_RAW, skipping\n");
+			exit(KSFT_SKIP);
+		}
+		perror("socket packet");
+		exit(1);
+	}
+
+	sock_setfilter(fd);
+
+	val = RCVBUF;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val))) {
+		perror("setsockopt SO_RCVBUF");
+		exit(1);
+	}
+
+	val = (PACKET_FANOUT_OCCUPANCY << 16) | group_id;
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &val, sizeof(val))) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "PACKET_FANOUT_OCCUPANCY unsupported, skipping\n");
+			exit(KSFT_SKIP);
+		}
+		perror("setsockopt PACKET_FANOUT");
+		exit(1);
+	}
+
+	return fd;
+}
+
+static void send_packets(int num)
+{
+	struct sockaddr_in daddr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(PORT_BASE),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	char buf[64] = "occupancy";
+	int fd, i;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket udp");
+		exit(1);
+	}
+
+	/* a fixed source port keeps all packets in one flow */
+	for (i = 0; i < num; i++) {
+		if (sendto(fd, buf, sizeof(buf), 0, (void *)&daddr,
+			   sizeof(daddr)) != sizeof(buf)) {
+			perror("sendto");
+			exit(1);
+		}
+	}
+
+	close(fd);
+}
+
+static int sock_fanout_read(int fd)
+{
+	char buf[256];
+	int count = 0;
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		count++;
+
+	if (errno != EAGAIN) {
+		perror("recv");
+		exit(1);
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	int group_id = getpid() & 0xffff;
+	int fds[2], count[2];
+
+	fds[0] = sock_fanout_open(group_id);
+	fds[1] = sock_fanout_open(group_id);
+
+	send_packets(NUM_PACKETS);
+	usleep(100 * 1000);
+
+	count[0] = sock_fanout_read(fds[0]);
+	count[1] = sock_fanout_read(fds[1]);
+	fprintf(stderr, "occupancy: sent %d, received %d and %d\n",
+		NUM_PACKETS, count[0], count[1]);
+
+	close(fds[1]);
+	close(fds[0]);
+
+	if (!count[0] || !count[1]) {
+		fprintf(stderr, "[FAIL] flow was not moved off the congested member\n");
+		return 1;
+	}
+
+	fprintf(stderr, "[OK]\n");
+	return 0;
+}